@@ -1,9 +1,247 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "SPOctree.h"
+#include "SPOctreeBakedIndex.h"
+#include "SPOctreeBakedAsset.h"
 #include "SPOctreeDataLayer.h"
+#include "SPOctreeStats.h"
 #include "Engine/Public/DrawDebugHelpers.h"
-#include "Kismet/GameplayStatics.h"
+#include "Async/Async.h"
+#include "Async/ParallelFor.h"
+#include "ConvexVolume.h"
+#include "EngineUtils.h"
+#include "Engine/World.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#if WITH_EDITOR
+#include "WorldPartition/DataLayer/DataLayer.h"
+#endif
+
+namespace SPOctreeFilter
+{
+	/** Classes and tags past this many share no bit and are checked on the actor instead. */
+	static constexpr int32 MaxFilterBits = 64;
+}
+
+namespace SPOctreeBuild
+{
+	/** Cells per axis of the grid AddActorsToOctree sorts elements on, FMath::MortonCode3 takes 10 bits per axis. */
+	static constexpr uint32 MortonCellsPerAxis = 1024;
+}
+
+namespace SPOctreeChanges
+{
+	/** Number of changes HasChangedNear can tell apart, older ones count as changed everywhere. */
+	static constexpr int32 MaxRecentChanges = 64;
+}
+
+/**
+* Copy of an ASPOctree the query snapshots are built from. The game thread only queues changes for it, and each
+* snapshot build replays the changes made since the previous one on the task graph, so the game thread never copies
+* the whole Octree again once the copy exists. Builds run one at a time, which makes the running build its only user.
+*/
+class FSPOctreeSnapshotSource
+{
+public:
+	FSPOctreeSnapshotSource(const FBoxCenterAndExtent& inRootBounds, const ESPOctreeLayout inLayout)
+		: Octree(inRootBounds.Center, inRootBounds.Extent.GetMax(), inLayout)
+	{
+	}
+
+	void ApplyChanges(TConstArrayView<FSPOctreeSnapshotChange> inChanges)
+	{
+		for (const FSPOctreeSnapshotChange& change : inChanges)
+		{
+			FOctreeElementId2 elementId;
+			if (ElementIds.RemoveAndCopyValue(change.Actor, elementId) && Octree.IsValidElementId(elementId))
+			{
+				Octree.RemoveElement(elementId);
+			}
+			ActorRefs.Remove(change.Actor);
+
+			if (!change.bRemoved)
+			{
+				FSPOctreeElement element(change.Actor, change.Bounds);
+				element.ElementIds = &ElementIds;
+				Octree.AddElement(element);
+				ActorRefs.Add(change.Actor, change.ActorRef);
+			}
+		}
+	}
+
+	TSharedPtr<FSPOctreeBakedIndex, ESPMode::ThreadSafe> BuildSnapshot() const
+	{
+		TSharedPtr<FSPOctreeBakedIndex, ESPMode::ThreadSafe> snapshot = MakeShared<FSPOctreeBakedIndex, ESPMode::ThreadSafe>();
+		snapshot->Build(Octree);
+		snapshot->StoreActorRefs(ActorRefs);
+		return snapshot;
+	}
+
+private:
+	FSPOctree Octree;
+	FSPOctreeElementIdMap ElementIds;
+
+	/** Weak references taken on the game thread when the changes were queued. */
+	TMap<const AActor*, TWeakObjectPtr<AActor>> ActorRefs;
+};
+
+void FSPOctreeQueryResults::RemoveStaleElements()
+{
+	check(IsInGameThread());
+	if (ElementActors.Num() != Elements.Num())
+	{
+		return;
+	}
+
+	// Pointers of stale actors are replaced before anything else reads them
+	int32 writeIndex = 0;
+	for (int32 queryIndex = 0; queryIndex < ResultStart.Num(); queryIndex++)
+	{
+		const int32 readStart = ResultStart[queryIndex];
+		const int32 readEnd = readStart + ResultCount[queryIndex];
+		ResultStart[queryIndex] = writeIndex;
+		for (int32 readIndex = readStart; readIndex < readEnd; readIndex++)
+		{
+			AActor* actor = ElementActors[readIndex].Get();
+			Elements[readIndex].MyActor = actor;
+			if (actor)
+			{
+				if (writeIndex != readIndex)
+				{
+					Elements[writeIndex] = Elements[readIndex];
+					ElementActors[writeIndex] = ElementActors[readIndex];
+				}
+				writeIndex++;
+			}
+		}
+		ResultCount[queryIndex] = writeIndex - ResultStart[queryIndex];
+	}
+	Elements.SetNum(writeIndex, false);
+	ElementActors.SetNum(writeIndex, false);
+}
+
+namespace SPOctreePairs
+{
+	/** Node of the Octree as seen by FPairWalker, children are linked by local index. */
+	struct FPairNode
+	{
+		TArrayView<const FSPOctreeElement> Elements;
+
+		/** Pair boxes of the elements of the node, and of every element in its subtree. Both lie within its loose bounds. */
+		FBox ElementBounds = FBox(ForceInit);
+		FBox SubtreeBounds = FBox(ForceInit);
+
+		int32 FirstChild = INDEX_NONE;
+		int32 NextSibling = INDEX_NONE;
+	};
+
+	/**
+	* Finds the overlapping pairs of a tree by walking pairs of nodes. Every subtree is paired with itself, and two
+	* subtrees are only descended into while their bounds, one grown by the threshold, intersect. Each pair of elements
+	* is tested once, from the deepest node that holds both in its subtree.
+	*/
+	class FPairWalker
+	{
+	public:
+		FPairWalker(TConstArrayView<FPairNode> inNodes, const double inThreshold, const bool inPointElements, TFunctionRef<void(const FSPOctreeElement&, const FSPOctreeElement&)> inVisitor, FSPOctreeQueryCounters& inQueryCounters)
+			: Nodes(inNodes)
+			, Threshold(inThreshold)
+			, bPointElements(inPointElements)
+			, Visitor(inVisitor)
+			, QueryCounters(inQueryCounters)
+		{
+		}
+
+		/** Reports the pairs with both elements in the subtree of a node. */
+		void VisitSubtree(const int32 inNode)
+		{
+			const FPairNode& node = Nodes[inNode];
+			QueryCounters.AddNode();
+
+			for (int32 elementIndex = 0; elementIndex < node.Elements.Num(); elementIndex++)
+			{
+				const FBox pairBox = GetPairBox(node.Elements[elementIndex]).ExpandBy(Threshold);
+				for (int32 otherIndex = elementIndex + 1; otherIndex < node.Elements.Num(); otherIndex++)
+				{
+					TestPair(node.Elements[elementIndex], pairBox, node.Elements[otherIndex]);
+				}
+			}
+
+			for (int32 child = node.FirstChild; child != INDEX_NONE; child = Nodes[child].NextSibling)
+			{
+				VisitElementsAgainstSubtree(inNode, child);
+				VisitSubtree(child);
+				for (int32 otherChild = Nodes[child].NextSibling; otherChild != INDEX_NONE; otherChild = Nodes[otherChild].NextSibling)
+				{
+					VisitSubtreePair(child, otherChild);
+				}
+			}
+		}
+
+	private:
+		/** Reports the pairs with one element in the subtree of inNodeA and the other in the subtree of inNodeB. */
+		void VisitSubtreePair(const int32 inNodeA, const int32 inNodeB)
+		{
+			if (!Nodes[inNodeA].SubtreeBounds.ExpandBy(Threshold).Intersect(Nodes[inNodeB].SubtreeBounds))
+			{
+				return;
+			}
+
+			VisitElementsAgainstSubtree(inNodeA, inNodeB);
+			for (int32 child = Nodes[inNodeA].FirstChild; child != INDEX_NONE; child = Nodes[child].NextSibling)
+			{
+				VisitSubtreePair(child, inNodeB);
+			}
+		}
+
+		/** Reports the pairs with one element of inNodeA itself and the other in the subtree of inNodeB. */
+		void VisitElementsAgainstSubtree(const int32 inNodeA, const int32 inNodeB)
+		{
+			const FPairNode& nodeA = Nodes[inNodeA];
+			const FPairNode& nodeB = Nodes[inNodeB];
+			if (nodeA.Elements.Num() == 0 || !nodeA.ElementBounds.ExpandBy(Threshold).Intersect(nodeB.SubtreeBounds))
+			{
+				return;
+			}
+
+			QueryCounters.AddNode();
+			for (const FSPOctreeElement& element : nodeA.Elements)
+			{
+				const FBox pairBox = GetPairBox(element).ExpandBy(Threshold);
+				for (const FSPOctreeElement& other : nodeB.Elements)
+				{
+					TestPair(element, pairBox, other);
+				}
+			}
+
+			for (int32 child = nodeB.FirstChild; child != INDEX_NONE; child = Nodes[child].NextSibling)
+			{
+				VisitElementsAgainstSubtree(inNodeA, child);
+			}
+		}
+
+		FORCEINLINE FBox GetPairBox(const FSPOctreeElement& Element) const
+		{
+			return bPointElements ? FBox(Element.BoxSphereBounds.Origin, Element.BoxSphereBounds.Origin) : Element.BoxSphereBounds.GetBox();
+		}
+
+		FORCEINLINE void TestPair(const FSPOctreeElement& Element, const FBox& inPairBox, const FSPOctreeElement& Other)
+		{
+			QueryCounters.AddElementsTested(1);
+			if (inPairBox.Intersect(GetPairBox(Other)))
+			{
+				QueryCounters.AddHits(1);
+				Visitor(Element, Other);
+			}
+		}
+
+		TConstArrayView<FPairNode> Nodes;
+		double Threshold;
+		bool bPointElements;
+		TFunctionRef<void(const FSPOctreeElement&, const FSPOctreeElement&)> Visitor;
+		FSPOctreeQueryCounters& QueryCounters;
+	};
+}
 
 // Sets default values
 ASPOctree::ASPOctree(const FObjectInitializer& ObjectInitializer)
@@ -11,44 +249,73 @@ ASPOctree::ASPOctree(const FObjectInitializer& ObjectInitializer)
 {
 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
 	PrimaryActorTick.bCanEverTick = true;
+	// Relocate dynamic actors once everything has moved this frame
+	PrimaryActorTick.TickGroup = TG_PostUpdateWork;
 
 	PrintLogs = false;
 	PrintTickLogs = false;
 
+	Layout = ESPOctreeLayout::Default;
 	bDrawDebugInfo = false;
 	bInitialized = false;
+	DynamicMoveTolerance = 10.0f;
+#if WITH_EDITORONLY_DATA
+	BakeExtent = 100000.0f;
+	DataLayerCellDepth = 3;
+#endif
 
-	OctreeData = new FSPOctree(FVector(0.0f, 0.0f, 0.0f), 100.0f); // const FVector & InOrigin, float InExtent
+	// Placeholder until Initialize replaces it, the class default object never needs one
+	if (!HasAnyFlags(RF_ClassDefaultObject | RF_ArchetypeObject))
+	{
+		OctreeData = MakeUnique<FSPOctree>(FVector(0.0f, 0.0f, 0.0f), 100.0f); // const FVector & InOrigin, float InExtent
+	}
 }
 
 void ASPOctree::Initialize(const FBox& inNewBounds, const bool& inDrawDebugInfo)
 {
 	bInitialized = true;
 	bDrawDebugInfo = inDrawDebugInfo;
-	OctreeData = new FSPOctree(inNewBounds.GetCenter(), inNewBounds.GetExtent().GetMax()); // const FVector & InOrigin, float InExtent
+	ResetTrackedElements();
+	OnOctreeModified();
+	OctreeData = MakeUnique<FSPOctree>(inNewBounds.GetCenter(), inNewBounds.GetExtent().GetMax(), Layout); // const FVector & InOrigin, float InExtent
 }
 
 void ASPOctree::Initialize(const float& inExtent, const bool& inDrawDebugInfo)
 {
 	bInitialized = true;
 	bDrawDebugInfo = inDrawDebugInfo;
+	ResetTrackedElements();
+	OnOctreeModified();
 
 	// The Extent is very similar to the radius of a circle
 	FVector min = FVector(-inExtent, -inExtent, -inExtent);
 	FVector max = FVector(inExtent, inExtent, inExtent);
 	FBox NewBounds = FBox(min, max);
-	OctreeData = new FSPOctree(NewBounds.GetCenter(), NewBounds.GetExtent().GetMax()); // const FVector & InOrigin, float InExtent
+	OctreeData = MakeUnique<FSPOctree>(NewBounds.GetCenter(), NewBounds.GetExtent().GetMax(), Layout); // const FVector & InOrigin, float InExtent
 }
 
 // Called when the game starts or when spawned
 void ASPOctree::BeginPlay()
 {
+	// Loaded first so the Blueprint BeginPlay already sees the baked Octree
+	if (BakedAsset && !bInitialized)
+	{
+		LoadBakedAsset(BakedAsset);
+	}
+
 	Super::BeginPlay();
 }
 
 void ASPOctree::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
-	OctreeData->Destroy();
+	if (OctreeData)
+	{
+		OctreeData->Destroy();
+	}
+	ResetTrackedElements();
+	OnOctreeModified();
+	// Running batches only hold their snapshot, their results are dropped
+	PendingAsyncQueries.Reset();
 	Super::EndPlay(EndPlayReason);
 }
 
@@ -57,6 +324,14 @@ void ASPOctree::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
+	if (bInitialized)
+	{
+		GatherMovedDynamicActors();
+		FlushDirtyActors();
+	}
+
+	DispatchCompletedQueries();
+
 	if (bInitialized && bDrawDebugInfo)
 	{
 		int nodeCount = 0;
@@ -103,7 +378,7 @@ void ASPOctree::Tick(float DeltaTime)
 void ASPOctree::AddOctreeElement(const FSPOctreeElement& inNewOctreeElement, const bool inHiddenInGame)
 {
 	check(bInitialized);
-	OctreeData->AddElement(inNewOctreeElement);
+	InsertElement(inNewOctreeElement);
 	inNewOctreeElement.MyActor->SetActorHiddenInGame(inHiddenInGame);
 	inNewOctreeElement.MyActor->SetActorEnableCollision(!inHiddenInGame);
 	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("Added element [%s] to Octree."), *(inNewOctreeElement.MyActor->GetName()));
@@ -116,127 +391,1780 @@ TArray<FSPOctreeElement> ASPOctree::GetElementsWithinBounds(const FBoxSphereBoun
 		DrawBoxSphereBounds(inBoundingBoxQuery, bSphereOnlyTest, bPersistentLines, lifeTime);
 	}
 	TArray<FSPOctreeElement> octreeElements;
-	octreeElements.Reset();
-	FBox box = inBoundingBoxQuery.GetBox();
-	FSphere sphere = inBoundingBoxQuery.GetSphere();
-	FBox sphereBox = FBox(FVector(sphere.Center.X - sphere.W, sphere.Center.Y - sphere.W, sphere.Center.Z - sphere.W),
-		FVector(sphere.Center.X + sphere.W, sphere.Center.Y + sphere.W, sphere.Center.Z + sphere.W));
+	GetElementsWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, octreeElements);
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetElementsWithinBounds octreeElements: %d"), octreeElements.Num());
+
+	return octreeElements;
+}
+
+void ASPOctree::ForEachElementWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TFunctionRef<void(const FSPOctreeElement&)> inVisitor) const
+{
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Query);
+
+	if (BakedQueryIndex.IsValid())
+	{
+		const FSPOctreeBakedIndex& bakedIndex = *BakedQueryIndex;
+		bakedIndex.ForEachElementWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, [&bakedIndex, &inVisitor](int32 ElementIndex)
+			{
+				inVisitor(bakedIndex.GetElement(ElementIndex));
+			});
+		return;
+	}
+
+	const SPOctreeQuery::FQueryShape queryShape(inBoundingBoxQuery, bSphereOnlyTest, OctreeData->HasPointElements());
+	FSPOctreeQueryCounters queryCounters;
 
 	OctreeData->FindNodesWithPredicate(
-		[&box, &sphereBox](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& NodeBounds)
+		[&queryShape](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& NodeBounds)
 		{
-			if (NodeBounds.GetBox().IsInside(box.GetCenter()) || NodeBounds.GetBox().Intersect(box) || NodeBounds.GetBox().Intersect(sphereBox))
-			{
-				return true;
-			}
-			return false;
+			return queryShape.IntersectsNode(NodeBounds);
 		},
-		[this, &octreeElements, &box, &sphere, &bSphereOnlyTest](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+		[this, &inVisitor, &queryShape, &queryCounters](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
 		{
 			TArrayView<const FSPOctreeElement> elements = OctreeData->GetElementsForNode(NodeIndex);
 			int numElements = elements.Num();
+			queryCounters.AddNode();
+			queryCounters.AddElementsTested(numElements);
 			if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetElementsWithinBounds NodeIndex: %d numElements: %i"), NodeIndex, numElements);
 
 			for (int Index = 0; Index < numElements; Index++)
 			{
-				if (
-					(!bSphereOnlyTest && (box.IsInside(elements[Index].BoxSphereBounds.GetBox()) || box.Intersect(elements[Index].BoxSphereBounds.GetBox()) || sphere.IsInside(elements[Index].MyActor->GetActorLocation())))
-					||
-					(bSphereOnlyTest && sphere.IsInside(elements[Index].MyActor->GetActorLocation()))
-					)
+				if (queryShape.ContainsElement(elements[Index]))
 				{
-					octreeElements.Add(elements[Index]);
+					queryCounters.AddHits(1);
+					inVisitor(elements[Index]);
 					if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetElementsWithinBounds elements[%i].MyActor: %s"), Index, *(elements[Index].MyActor->GetActorNameOrLabel()));
 				}
 			}
 		});
-
-	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetElementsWithinBounds octreeElements: %d"), octreeElements.Num());
-
-	return octreeElements;
 }
 
-void ASPOctree::DrawBoxSphereBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest = false, const bool bPersistentLines = false, const float lifeTime = 0.0f)
+void ASPOctree::ForEachElementInCapsule(const FVector& inStart, const FVector& inEnd, const float inRadius, TFunctionRef<void(const FSPOctreeElement&)> inVisitor) const
 {
-	DrawDebugBox(GetWorld(), inBoundingBoxQuery.Origin, inBoundingBoxQuery.BoxExtent, (bSphereOnlyTest ? FColor(128.0f, 128.0f, 128.0f, 128.0f) : FColor().Purple), bPersistentLines, lifeTime);
-	DrawDebugSphere(GetWorld(), inBoundingBoxQuery.Origin, inBoundingBoxQuery.SphereRadius, 12, (bSphereOnlyTest ? FColor().Orange : FColor().Turquoise), bPersistentLines, lifeTime, 0, (bSphereOnlyTest ? 3.0f : 0.0f));
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Query);
+
+	if (BakedQueryIndex.IsValid())
+	{
+		const FSPOctreeBakedIndex& bakedIndex = *BakedQueryIndex;
+		bakedIndex.ForEachElementInCapsule(inStart, inEnd, inRadius, [&bakedIndex, &inVisitor](int32 ElementIndex)
+			{
+				inVisitor(bakedIndex.GetElement(ElementIndex));
+			});
+		return;
+	}
+
+	const FVector direction = inEnd - inStart;
+	const double radiusSquared = FMath::Square((double)inRadius);
+	FSPOctreeQueryCounters queryCounters;
+
+	OctreeData->FindNodesWithPredicate(
+		[&inStart, &direction, inRadius](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& NodeBounds)
+		{
+			double entryTime = 0.0;
+			return SPOctreeMath::SegmentIntersectsBox(inStart, direction, NodeBounds.GetBox().ExpandBy(inRadius), entryTime);
+		},
+		[this, &inStart, &inEnd, &inVisitor, &queryCounters, radiusSquared](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			TArrayView<const FSPOctreeElement> elements = OctreeData->GetElementsForNode(NodeIndex);
+			queryCounters.AddNode();
+			queryCounters.AddElementsTested(elements.Num());
+			for (const FSPOctreeElement& element : elements)
+			{
+				if (FMath::PointDistToSegmentSquared(element.BoxSphereBounds.Origin, inStart, inEnd) <= radiusSquared)
+				{
+					queryCounters.AddHits(1);
+					inVisitor(element);
+				}
+			}
+		});
 }
 
-void ASPOctree::GetAllActorsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, TSubclassOf<AActor> ActorClass, TArray<AActor*>& OutActors, const bool bSphereOnlyTest, const bool bDrawDebug, const bool bPersistentLines, const float lifeTime)
+void ASPOctree::QueryBatch(TConstArrayView<FSPOctreeQuery> inQueries, FSPOctreeQueryResults& OutResults) const
 {
-	if (bDrawDebug)
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Query);
+
+	if (BakedQueryIndex.IsValid())
 	{
-		DrawDebugBox(GetWorld(), inBoundingBoxQuery.Origin, inBoundingBoxQuery.BoxExtent, (bSphereOnlyTest ? FColor(128.0f, 128.0f, 128.0f, 128.0f) : FColor().Red), bPersistentLines, lifeTime);
-		DrawDebugSphere(GetWorld(), inBoundingBoxQuery.Origin, inBoundingBoxQuery.SphereRadius, 12, (bSphereOnlyTest ? FColor().Cyan : FColor().Red), bPersistentLines, lifeTime, 0, (bSphereOnlyTest ? 3.0f : 0.0f));
+		BakedQueryIndex->QueryBatch(inQueries, OutResults);
+		return;
 	}
-	OutActors.Reset();
 
-	FBox box = inBoundingBoxQuery.GetBox();
-	FSphere sphere = inBoundingBoxQuery.GetSphere();
-	TArray<AActor*> foundActors;
-	foundActors.Reset();
-	UGameplayStatics::GetAllActorsOfClass(GetWorld(), ActorClass, foundActors);
-
-	int numActors = foundActors.Num();
-	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetAllActorsWithinBounds numActors: %d"), numActors);
+	const int32 numQueries = inQueries.Num();
+	TArray<SPOctreeQuery::FQueryShape, TInlineAllocator<16>> queryShapes;
+	queryShapes.Reserve(numQueries);
+	for (const FSPOctreeQuery& query : inQueries)
+	{
+		queryShapes.Emplace(query.Bounds, query.bSphereOnlyTest, OctreeData->HasPointElements());
+	}
 
-	for (int Index = 0; Index < numActors; Index++)
+	// Nodes on the path from the root to the current node, each with the range of activeQueries still overlapping it
+	struct FActiveNode
 	{
-		FBox actorBounds = foundActors[Index]->GetComponentsBoundingBox(true, true);
-		if (
-			(!bSphereOnlyTest && (box.IsInside(actorBounds) || box.Intersect(actorBounds) || sphere.IsInside(foundActors[Index]->GetActorLocation())))
-			||
-			(bSphereOnlyTest && sphere.IsInside(foundActors[Index]->GetActorLocation()))
-			)
+		FSPOctree::FNodeIndex NodeIndex;
+		int32 FirstQuery;
+		int32 NumQueries;
+	};
+	TArray<FActiveNode, TInlineAllocator<FSPOctree::MaxNodeDepth + 1>> activeNodes;
+	TArray<int32, TInlineAllocator<256>> activeQueries;
+	TArray<TPair<int32, const FSPOctreeElement*>> hits;
+	FSPOctreeQueryCounters queryCounters;
+
+	OctreeData->FindNodesWithPredicate(
+		[&queryShapes, &activeNodes, &activeQueries, numQueries](FSPOctree::FNodeIndex ParentNodeIndex, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& NodeBounds)
 		{
-			OutActors.Add(foundActors[Index]);
-		}
-		else
+			// Nodes are visited depth first, so every node still on the path past the parent has been finished
+			while (activeNodes.Num() > 0 && activeNodes.Top().NodeIndex != ParentNodeIndex)
+			{
+				activeQueries.SetNum(activeNodes.Top().FirstQuery, false);
+				activeNodes.Pop(false);
+			}
+
+			const int32 firstQuery = activeQueries.Num();
+			if (activeNodes.Num() == 0)
+			{
+				for (int32 queryIndex = 0; queryIndex < numQueries; queryIndex++)
+				{
+					if (queryShapes[queryIndex].IntersectsNode(NodeBounds))
+					{
+						activeQueries.Add(queryIndex);
+					}
+				}
+			}
+			else
+			{
+				const FActiveNode parentNode = activeNodes.Top();
+				for (int32 index = parentNode.FirstQuery; index < parentNode.FirstQuery + parentNode.NumQueries; index++)
+				{
+					if (queryShapes[activeQueries[index]].IntersectsNode(NodeBounds))
+					{
+						activeQueries.Add(activeQueries[index]);
+					}
+				}
+			}
+
+			const int32 numActiveQueries = activeQueries.Num() - firstQuery;
+			if (numActiveQueries == 0)
+			{
+				return false;
+			}
+			activeNodes.Add({ NodeIndex, firstQuery, numActiveQueries });
+			return true;
+		},
+		[this, &queryShapes, &activeNodes, &activeQueries, &hits, &queryCounters](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
 		{
-			if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetAllActorsWithinBounds: foundActors[%i]: %s NOT in bounds."), Index, *(foundActors[Index]->GetActorNameOrLabel()));
-		}
+			const FActiveNode& node = activeNodes.Top();
+			TArrayView<const FSPOctreeElement> elements = OctreeData->GetElementsForNode(NodeIndex);
+			queryCounters.AddNode();
+			queryCounters.AddElementsTested(elements.Num() * node.NumQueries);
+			for (const FSPOctreeElement& element : elements)
+			{
+				for (int32 index = node.FirstQuery; index < node.FirstQuery + node.NumQueries; index++)
+				{
+					if (queryShapes[activeQueries[index]].ContainsElement(element))
+					{
+						hits.Emplace(activeQueries[index], &element);
+					}
+				}
+			}
+		});
+
+	queryCounters.AddHits(hits.Num());
+
+	// Counting sort of the hits by query gives every query one contiguous range
+	OutResults.ResultCount.Reset(numQueries);
+	OutResults.ResultCount.AddZeroed(numQueries);
+	for (const TPair<int32, const FSPOctreeElement*>& hit : hits)
+	{
+		OutResults.ResultCount[hit.Key]++;
 	}
 
-	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetAllActorsWithinBounds OutActors: %d"), OutActors.Num());
+	OutResults.ResultStart.Reset(numQueries);
+	int32 resultStart = 0;
+	for (int32 queryIndex = 0; queryIndex < numQueries; queryIndex++)
+	{
+		OutResults.ResultStart.Add(resultStart);
+		resultStart += OutResults.ResultCount[queryIndex];
+	}
+
+	TArray<int32, TInlineAllocator<16>> writeIndices(OutResults.ResultStart);
+	OutResults.Elements.Reset(hits.Num());
+	OutResults.Elements.SetNum(hits.Num());
+	for (const TPair<int32, const FSPOctreeElement*>& hit : hits)
+	{
+		OutResults.Elements[writeIndices[hit.Key]++] = *hit.Value;
+	}
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("QueryBatch queries: %d results: %d"), numQueries, hits.Num());
 }
 
-void ASPOctree::AddActorToOctree(AActor* inActor, const bool inHiddenInGame)
+void ASPOctree::GetElementsWithinBoundsBatch(const TArray<FSPOctreeQuery>& inQueries, FSPOctreeQueryResults& OutResults)
 {
-	if (inActor)
+	QueryBatch(inQueries, OutResults);
+}
+
+void ASPOctree::FindNearestElements(const FVector& inPoint, const int32 inMaxCount, const float inMaxDistance, TSubclassOf<AActor> inClassFilter, TArray<FSPOctreeElement>& OutElements) const
+{
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Query);
+
+	OutElements.Reset();
+	if (inMaxCount <= 0)
+	{
+		return;
+	}
+
+	const double maxDistanceSquared = inMaxDistance > 0.0f ? FMath::Square((double)inMaxDistance) : TNumericLimits<double>::Max();
+	UClass* classFilter = inClassFilter.Get();
+	auto passesFilter = [classFilter](const FSPOctreeElement& Element)
 	{
-		FVector origin;
-		FVector boxExtent;
-		inActor->GetActorBounds(false, origin, boxExtent);
-		double maxExtent = boxExtent.GetMax();
+		return Element.MyActor && (classFilter == nullptr || Element.MyActor->IsA(classFilter));
+	};
 
-		if (maxExtent < OctreeData->GetRootBounds().GetBox().GetExtent().GetMax())
+	if (BakedQueryIndex.IsValid())
+	{
+		TArray<int32> elementIndices;
+		BakedQueryIndex->FindNearestElements(inPoint, inMaxCount, maxDistanceSquared, passesFilter, elementIndices);
+		OutElements.Reserve(elementIndices.Num());
+		for (int32 elementIndex : elementIndices)
 		{
-			check(bInitialized);
-			FSPOctreeElement element = FSPOctreeElement(inActor, FBoxSphereBounds(origin, boxExtent, maxExtent));
-			inActor->SetActorHiddenInGame(inHiddenInGame);
-			inActor->SetActorEnableCollision(!inHiddenInGame);
-			OctreeData->AddElement(element);
-			if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("AddActorToOctree: [%s] to Octree."), *(inActor->GetActorNameOrLabel()));
+			OutElements.Add(BakedQueryIndex->GetElement(elementIndex));
 		}
-		else
+		return;
+	}
+
+	// TOctree2 only walks depth first, so subtrees are pruned by the current k-th best distance instead of visited nearest first
+	typedef TPair<double, const FSPOctreeElement*> FCandidate;
+	auto furthestFirst = [](const FCandidate& A, const FCandidate& B) { return A.Key > B.Key; };
+	TArray<FCandidate, TInlineAllocator<16>> bestElements;
+
+	auto searchRadiusSquared = [&bestElements, inMaxCount, maxDistanceSquared]()
+	{
+		return bestElements.Num() == inMaxCount ? bestElements.HeapTop().Key : maxDistanceSquared;
+	};
+
+	OctreeData->FindNodesWithPredicate(
+		[&inPoint, &searchRadiusSquared](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& NodeBounds)
 		{
-			//for things like skysphere
-			if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("AddActorToOctree: maxExtent greater than OctreeData->GetRootBounds maxExtent!"));
-		}
+			return NodeBounds.GetBox().ComputeSquaredDistanceToPoint(inPoint) <= searchRadiusSquared();
+		},
+		[this, &inPoint, &bestElements, &searchRadiusSquared, &furthestFirst, &passesFilter, inMaxCount](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			for (const FSPOctreeElement& element : OctreeData->GetElementsForNode(NodeIndex))
+			{
+				const double distanceSquared = FVector::DistSquared(element.BoxSphereBounds.Origin, inPoint);
+				if (distanceSquared <= searchRadiusSquared() && (bestElements.Num() < inMaxCount || distanceSquared < bestElements.HeapTop().Key) && passesFilter(element))
+				{
+					bestElements.HeapPush(FCandidate(distanceSquared, &element), furthestFirst);
+					if (bestElements.Num() > inMaxCount)
+					{
+						bestElements.HeapPopDiscard(furthestFirst, false);
+					}
+				}
+			}
+		});
+
+	bestElements.Sort([](const FCandidate& A, const FCandidate& B) { return A.Key < B.Key; });
+	OutElements.Reserve(bestElements.Num());
+	for (const FCandidate& candidate : bestElements)
+	{
+		OutElements.Add(*candidate.Value);
 	}
 }
 
-void ASPOctree::GetAllActors(TArray<AActor*>& OutActors)
+AActor* ASPOctree::FindNearestActor(const FVector& inPoint, const float inMaxDistance, TSubclassOf<AActor> inClassFilter) const
 {
-	OutActors.Reset();
+	TArray<FSPOctreeElement> nearestElements;
+	FindNearestElements(inPoint, 1, inMaxDistance, inClassFilter, nearestElements);
+	return nearestElements.Num() > 0 ? nearestElements[0].MyActor.Get() : nullptr;
+}
 
-	OctreeData->FindAllElements([&OutActors](const FSPOctreeElement& octElement)
+bool ASPOctree::LineTraceElements(const FVector& inStart, const FVector& inEnd, const bool bFirstHitOnly, TArray<FSPOctreeRayHit>& OutHits) const
+{
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Query);
+
+	OutHits.Reset();
+
+	// A segment would have to pass exactly through an origin to hit a point element
+	if (OctreeData->HasPointElements())
+	{
+		UE_LOG(SPOctreeDataLayerMod, Warning, TEXT("LineTraceElements: not supported by the Point layout, use ForEachElementInCapsule."));
+		return false;
+	}
+
+	const FVector direction = inEnd - inStart;
+	const double length = direction.Size();
+	auto addHit = [&OutHits, &inStart, &direction, length](const FSPOctreeElement& Element, double EntryTime)
+	{
+		FSPOctreeRayHit& hit = OutHits.AddDefaulted_GetRef();
+		hit.Element = Element;
+		hit.Distance = EntryTime * length;
+		hit.Location = inStart + direction * EntryTime;
+	};
+
+	if (BakedQueryIndex.IsValid())
+	{
+		TArray<TPair<double, int32>> bakedHits;
+		BakedQueryIndex->LineTrace(inStart, inEnd, bFirstHitOnly, bakedHits);
+		for (const TPair<double, int32>& bakedHit : bakedHits)
 		{
-			if (octElement.MyActor)
+			addHit(BakedQueryIndex->GetElement(bakedHit.Value), bakedHit.Key);
+		}
+		return OutHits.Num() > 0;
+	}
+
+	// The live Octree is walked depth first, nodes entered after the nearest hit so far are skipped
+	typedef TPair<double, const FSPOctreeElement*> FCandidate;
+	TArray<FCandidate> hits;
+	double nearestHitTime = TNumericLimits<double>::Max();
+
+	OctreeData->FindNodesWithPredicate(
+		[&inStart, &direction, &nearestHitTime, bFirstHitOnly](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& NodeBounds)
+		{
+			double entryTime = 0.0;
+			return SPOctreeMath::SegmentIntersectsBox(inStart, direction, NodeBounds.GetBox(), entryTime) && (!bFirstHitOnly || entryTime <= nearestHitTime);
+		},
+		[this, &inStart, &direction, &nearestHitTime, &hits](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			for (const FSPOctreeElement& element : OctreeData->GetElementsForNode(NodeIndex))
 			{
-				OutActors.Add(octElement.MyActor);
+				double entryTime = 0.0;
+				if (SPOctreeMath::SegmentIntersectsBox(inStart, direction, element.BoxSphereBounds.GetBox(), entryTime))
+				{
+					hits.Add(FCandidate(entryTime, &element));
+					nearestHitTime = FMath::Min(nearestHitTime, entryTime);
+				}
 			}
 		});
+
+	hits.Sort([](const FCandidate& A, const FCandidate& B) { return A.Key < B.Key; });
+	if (bFirstHitOnly && hits.Num() > 1)
+	{
+		hits.SetNum(1);
+	}
+
+	for (const FCandidate& candidate : hits)
+	{
+		addHit(*candidate.Value, candidate.Key);
+	}
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("LineTraceElements hits: %d"), OutHits.Num());
+
+	return OutHits.Num() > 0;
+}
+
+void ASPOctree::ForEachElementInConvexVolume(const FConvexVolume& inVolume, TFunctionRef<void(const FSPOctreeElement&)> inVisitor) const
+{
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Query);
+
+	if (BakedQueryIndex.IsValid())
+	{
+		const FSPOctreeBakedIndex& bakedIndex = *BakedQueryIndex;
+		bakedIndex.ForEachElementInConvexVolume(inVolume, [&bakedIndex, &inVisitor](int32 ElementIndex)
+			{
+				inVisitor(bakedIndex.GetElement(ElementIndex));
+			});
+		return;
+	}
+
+	// Point elements are tested by their origin only
+	const bool bPointElements = OctreeData->HasPointElements();
+
+	// Nodes on the path from the root to the current node. A node inside the volume holds a subtree that is inside too.
+	struct FVisitedNode
+	{
+		FSPOctree::FNodeIndex NodeIndex;
+		bool bFullyContained;
+	};
+	TArray<FVisitedNode, TInlineAllocator<FSPOctree::MaxNodeDepth + 1>> visitedNodes;
+
+	OctreeData->FindNodesWithPredicate(
+		[&inVolume, &visitedNodes](FSPOctree::FNodeIndex ParentNodeIndex, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& NodeBounds)
+		{
+			while (visitedNodes.Num() > 0 && visitedNodes.Top().NodeIndex != ParentNodeIndex)
+			{
+				visitedNodes.Pop(false);
+			}
+
+			bool bFullyContained = visitedNodes.Num() > 0 && visitedNodes.Top().bFullyContained;
+			if (!bFullyContained)
+			{
+				const FBox nodeBox = NodeBounds.GetBox();
+				if (!inVolume.IntersectBox(nodeBox.GetCenter(), nodeBox.GetExtent(), bFullyContained))
+				{
+					return false;
+				}
+			}
+
+			visitedNodes.Add({ NodeIndex, bFullyContained });
+			return true;
+		},
+		[this, &inVolume, &inVisitor, &visitedNodes, bPointElements](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			const bool bFullyContained = visitedNodes.Top().bFullyContained;
+			for (const FSPOctreeElement& element : OctreeData->GetElementsForNode(NodeIndex))
+			{
+				if (bFullyContained || inVolume.IntersectBox(element.BoxSphereBounds.Origin, bPointElements ? FVector::ZeroVector : element.BoxSphereBounds.BoxExtent))
+				{
+					inVisitor(element);
+				}
+			}
+		});
+}
+
+void ASPOctree::GetElementsInFrustum(const FVector& inViewOrigin, const FRotator& inViewRotation, const float inFieldOfView, const float inAspectRatio, const float inNearPlane, const float inFarPlane, TArray<FSPOctreeElement>& OutElements) const
+{
+	OutElements.Reset();
+
+	// View space looks down +Z with +X right and +Y up
+	const FMatrix viewMatrix = FTranslationMatrix(-inViewOrigin) * FInverseRotationMatrix(inViewRotation) * FMatrix(
+		FPlane(0.0f, 0.0f, 1.0f, 0.0f),
+		FPlane(1.0f, 0.0f, 0.0f, 0.0f),
+		FPlane(0.0f, 1.0f, 0.0f, 0.0f),
+		FPlane(0.0f, 0.0f, 0.0f, 1.0f));
+	const FMatrix projectionMatrix = FPerspectiveMatrix(FMath::DegreesToRadians(inFieldOfView) * 0.5f, inAspectRatio, 1.0f, inNearPlane, inFarPlane);
+
+	FConvexVolume frustum;
+	GetViewFrustumBounds(frustum, viewMatrix * projectionMatrix, true);
+
+	ForEachElementInConvexVolume(frustum, [&OutElements](const FSPOctreeElement& octElement)
+		{
+			OutElements.Add(octElement);
+		});
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetElementsInFrustum OutElements: %d"), OutElements.Num());
+}
+
+void ASPOctree::ForEachOverlappingPair(const float inDistanceThreshold, TFunctionRef<void(const FSPOctreeElement&, const FSPOctreeElement&)> inVisitor)
+{
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Query);
+
+	EnsureLiveOctree();
+
+	const double threshold = FMath::Max(inDistanceThreshold, 0.0f);
+	// Point elements are only inside their node by their origin, so their pairs are measured between origins
+	const bool bPointElements = OctreeData->HasPointElements();
+
+	// Flattened copy of the non-empty nodes, with the parent of each node found from the path to it
+	TArray<SPOctreePairs::FPairNode> pairNodes;
+	TArray<int32, TInlineAllocator<FSPOctree::MaxNodeDepth + 1>> nodePath;
+	TArray<FSPOctree::FNodeIndex, TInlineAllocator<FSPOctree::MaxNodeDepth + 1>> nodePathIndices;
+	TArray<int32> parentNodes;
+
+	OctreeData->FindNodesWithPredicate(
+		[](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			return true;
+		},
+		[this, &pairNodes, &nodePath, &nodePathIndices, &parentNodes, bPointElements](FSPOctree::FNodeIndex ParentNodeIndex, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			while (nodePathIndices.Num() > 0 && nodePathIndices.Top() != ParentNodeIndex)
+			{
+				nodePathIndices.Pop(false);
+				nodePath.Pop(false);
+			}
+
+			const int32 pairNodeIndex = pairNodes.Num();
+			SPOctreePairs::FPairNode& pairNode = pairNodes.AddDefaulted_GetRef();
+			pairNode.Elements = OctreeData->GetElementsForNode(NodeIndex);
+			for (const FSPOctreeElement& element : pairNode.Elements)
+			{
+				pairNode.ElementBounds += bPointElements ? FBox(element.BoxSphereBounds.Origin, element.BoxSphereBounds.Origin) : element.BoxSphereBounds.GetBox();
+			}
+			pairNode.SubtreeBounds = pairNode.ElementBounds;
+
+			const int32 parentNode = nodePath.Num() > 0 ? nodePath.Top() : INDEX_NONE;
+			parentNodes.Add(parentNode);
+			if (parentNode != INDEX_NONE)
+			{
+				pairNode.NextSibling = pairNodes[parentNode].FirstChild;
+				pairNodes[parentNode].FirstChild = pairNodeIndex;
+			}
+
+			nodePathIndices.Add(NodeIndex);
+			nodePath.Add(pairNodeIndex);
+		});
+
+	if (pairNodes.Num() == 0)
+	{
+		return;
+	}
+
+	// Children come after their parent, so walking backwards folds every subtree into its parent
+	for (int32 pairNodeIndex = pairNodes.Num() - 1; pairNodeIndex > 0; pairNodeIndex--)
+	{
+		const int32 parentNode = parentNodes[pairNodeIndex];
+		if (parentNode != INDEX_NONE)
+		{
+			pairNodes[parentNode].SubtreeBounds += pairNodes[pairNodeIndex].SubtreeBounds;
+		}
+	}
+
+	FSPOctreeQueryCounters queryCounters;
+	SPOctreePairs::FPairWalker pairWalker(pairNodes, threshold, bPointElements, inVisitor, queryCounters);
+	pairWalker.VisitSubtree(0);
+}
+
+void ASPOctree::GetOverlappingPairs(const float inDistanceThreshold, TArray<FSPOctreeOverlapPair>& OutPairs)
+{
+	OutPairs.Reset();
+	ForEachOverlappingPair(inDistanceThreshold, [&OutPairs](const FSPOctreeElement& ElementA, const FSPOctreeElement& ElementB)
+		{
+			if (ElementA.MyActor && ElementB.MyActor)
+			{
+				OutPairs.Emplace(ElementA.MyActor, ElementB.MyActor);
+			}
+		});
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetOverlappingPairs OutPairs: %d"), OutPairs.Num());
+}
+
+void ASPOctree::GetOverlappingPairChanges(const float inDistanceThreshold, TArray<FSPOctreeOverlapPair>& OutBeganPairs, TArray<FSPOctreeOverlapPair>& OutEndedPairs)
+{
+	OutBeganPairs.Reset();
+	OutEndedPairs.Reset();
+
+	TSet<FSPOctreeOverlapPair> currentPairs;
+	currentPairs.Reserve(OverlappingPairs.Num());
+	ForEachOverlappingPair(inDistanceThreshold, [this, &currentPairs, &OutBeganPairs](const FSPOctreeElement& ElementA, const FSPOctreeElement& ElementB)
+		{
+			if (ElementA.MyActor && ElementB.MyActor)
+			{
+				const FSPOctreeOverlapPair pair(ElementA.MyActor, ElementB.MyActor);
+				currentPairs.Add(pair);
+				if (!OverlappingPairs.Contains(pair))
+				{
+					OutBeganPairs.Add(pair);
+				}
+			}
+		});
+
+	for (const FSPOctreeOverlapPair& pair : OverlappingPairs)
+	{
+		if (!currentPairs.Contains(pair))
+		{
+			OutEndedPairs.Add(pair);
+		}
+	}
+	OverlappingPairs = MoveTemp(currentPairs);
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetOverlappingPairChanges began: %d ended: %d overlapping: %d"), OutBeganPairs.Num(), OutEndedPairs.Num(), OverlappingPairs.Num());
+}
+
+void ASPOctree::ResetOverlappingPairs()
+{
+	OverlappingPairs.Reset();
+}
+
+bool ASPOctree::SaveElementDistribution(const FString& inFileName)
+{
+	EnsureLiveOctree();
+
+	FString csvString = TEXT("OriginX,OriginY,OriginZ,ExtentX,ExtentY,ExtentZ") LINE_TERMINATOR;
+	int32 numElements = 0;
+	OctreeData->FindAllElements([&csvString, &numElements](const FSPOctreeElement& octElement)
+		{
+			const FBoxSphereBounds& bounds = octElement.BoxSphereBounds;
+			csvString += FString::Printf(TEXT("%.3f,%.3f,%.3f,%.3f,%.3f,%.3f") LINE_TERMINATOR, bounds.Origin.X, bounds.Origin.Y, bounds.Origin.Z, bounds.BoxExtent.X, bounds.BoxExtent.Y, bounds.BoxExtent.Z);
+			numElements++;
+		});
+
+	const FString filePath = FPaths::ProjectSavedDir() / TEXT("SPOctreeBenchmarks") / TEXT("Captures") / inFileName;
+	if (!FFileHelper::SaveStringToFile(csvString, *filePath))
+	{
+		UE_LOG(SPOctreeDataLayerMod, Warning, TEXT("SaveElementDistribution: could not write [%s]."), *filePath);
+		return false;
+	}
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("SaveElementDistribution: %d elements written to [%s]."), numElements, *filePath);
+	return true;
+}
+
+void ASPOctree::GetElementsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TArray<FSPOctreeElement>& OutElements) const
+{
+	ForEachElementWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, [&OutElements](const FSPOctreeElement& octElement)
+		{
+			OutElements.Add(octElement);
+		});
+}
+
+void ASPOctree::GetActorsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TArray<AActor*>& OutActors) const
+{
+	ForEachElementWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, [&OutActors](const FSPOctreeElement& octElement)
+		{
+			if (octElement.MyActor)
+			{
+				OutActors.Add(octElement.MyActor);
+			}
+		});
+}
+
+void ASPOctree::DrawBoxSphereBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest = false, const bool bPersistentLines = false, const float lifeTime = 0.0f)
+{
+	DrawDebugBox(GetWorld(), inBoundingBoxQuery.Origin, inBoundingBoxQuery.BoxExtent, (bSphereOnlyTest ? FColor(128.0f, 128.0f, 128.0f, 128.0f) : FColor().Purple), bPersistentLines, lifeTime);
+	DrawDebugSphere(GetWorld(), inBoundingBoxQuery.Origin, inBoundingBoxQuery.SphereRadius, 12, (bSphereOnlyTest ? FColor().Orange : FColor().Turquoise), bPersistentLines, lifeTime, 0, (bSphereOnlyTest ? 3.0f : 0.0f));
+}
+
+void ASPOctree::GetAllActorsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, TSubclassOf<AActor> ActorClass, TArray<AActor*>& OutActors, const bool bSphereOnlyTest, const bool bDrawDebug, const bool bPersistentLines, const float lifeTime)
+{
+	if (bDrawDebug)
+	{
+		DrawDebugBox(GetWorld(), inBoundingBoxQuery.Origin, inBoundingBoxQuery.BoxExtent, (bSphereOnlyTest ? FColor(128.0f, 128.0f, 128.0f, 128.0f) : FColor().Red), bPersistentLines, lifeTime);
+		DrawDebugSphere(GetWorld(), inBoundingBoxQuery.Origin, inBoundingBoxQuery.SphereRadius, 12, (bSphereOnlyTest ? FColor().Cyan : FColor().Red), bPersistentLines, lifeTime, 0, (bSphereOnlyTest ? 3.0f : 0.0f));
+	}
+	OutActors.Reset();
+
+	ForEachActorWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, ActorClass.Get(), NAME_None, [&OutActors](AActor* Actor)
+		{
+			OutActors.Add(Actor);
+		});
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetAllActorsWithinBounds OutActors: %d"), OutActors.Num());
+}
+
+void ASPOctree::GetAllActorsWithinBoundsWithTag(const FBoxSphereBounds& inBoundingBoxQuery, TSubclassOf<AActor> ActorClass, const FName ActorTag, TArray<AActor*>& OutActors, const bool bSphereOnlyTest)
+{
+	OutActors.Reset();
+
+	ForEachActorWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, ActorClass.Get(), ActorTag, [&OutActors](AActor* Actor)
+		{
+			OutActors.Add(Actor);
+		});
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetAllActorsWithinBoundsWithTag OutActors: %d"), OutActors.Num());
+}
+
+void ASPOctree::ForEachActorWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, UClass* inActorClass, const FName& inActorTag, TFunctionRef<void(AActor*)> inVisitor)
+{
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Query);
+
+	UClass* actorClass = inActorClass != AActor::StaticClass() ? inActorClass : nullptr;
+
+	if (BakedQueryIndex.IsValid())
+	{
+		// The baked copies keep the masks they were baked with, which may lack bits given since
+		const FSPOctreeBakedIndex& bakedIndex = *BakedQueryIndex;
+		bakedIndex.ForEachElementWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, [&bakedIndex, &inVisitor, &inActorTag, actorClass](int32 ElementIndex)
+			{
+				AActor* actor = bakedIndex.GetElement(ElementIndex).MyActor;
+				if (actor && (actorClass == nullptr || actor->IsA(actorClass)) && (inActorTag.IsNone() || actor->ActorHasTag(inActorTag)))
+				{
+					inVisitor(actor);
+				}
+			});
+		return;
+	}
+
+	// A class or tag that got no bit is checked on the actors of the elements that pass the other tests
+	uint64 requiredBits = 0;
+	UClass* checkedClass = nullptr;
+	FName checkedTag = NAME_None;
+	if (actorClass)
+	{
+		const int32 classBit = GetFilterClassBit(actorClass);
+		if (classBit != INDEX_NONE)
+		{
+			requiredBits |= 1ull << classBit;
+		}
+		else
+		{
+			checkedClass = actorClass;
+		}
+	}
+	if (!inActorTag.IsNone())
+	{
+		const int32 tagBit = GetFilterTagBit(inActorTag);
+		if (tagBit != INDEX_NONE)
+		{
+			requiredBits |= 1ull << tagBit;
+		}
+		else
+		{
+			checkedTag = inActorTag;
+		}
+	}
+
+	RefreshFilterMasks();
+
+	const SPOctreeQuery::FQueryShape queryShape(inBoundingBoxQuery, bSphereOnlyTest, OctreeData->HasPointElements());
+	FSPOctreeQueryCounters queryCounters;
+
+	OctreeData->FindNodesWithPredicate(
+		[this, &queryShape, requiredBits](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& NodeBounds)
+		{
+			return (NodeFilterMasks[NodeIndex] & requiredBits) == requiredBits && queryShape.IntersectsNode(NodeBounds);
+		},
+		[this, &inVisitor, &queryShape, &queryCounters, &checkedTag, checkedClass, requiredBits](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			TArrayView<const FSPOctreeElement> elements = OctreeData->GetElementsForNode(NodeIndex);
+			queryCounters.AddNode();
+			queryCounters.AddElementsTested(elements.Num());
+			for (const FSPOctreeElement& element : elements)
+			{
+				if ((element.FilterMask & requiredBits) == requiredBits && queryShape.ContainsElement(element) && element.MyActor
+					&& (checkedClass == nullptr || element.MyActor->IsA(checkedClass))
+					&& (checkedTag.IsNone() || element.MyActor->ActorHasTag(checkedTag)))
+				{
+					queryCounters.AddHits(1);
+					inVisitor(element.MyActor);
+				}
+			}
+		});
+}
+
+int32 ASPOctree::GetFilterClassBit(UClass* inClass)
+{
+	if (const int32* classBit = FilterClassBits.Find(inClass))
+	{
+		return *classBit;
+	}
+
+	const int32 nextBit = FilterClassBits.Num() + FilterTagBits.Num();
+	if (nextBit >= SPOctreeFilter::MaxFilterBits)
+	{
+		return INDEX_NONE;
+	}
+	FilterClassBits.Add(inClass, nextBit);
+	bElementFilterMasksDirty = true;
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetFilterClassBit: [%s] filtered with bit %d."), *(inClass->GetName()), nextBit);
+	return nextBit;
+}
+
+int32 ASPOctree::GetFilterTagBit(const FName& inTag)
+{
+	if (const int32* tagBit = FilterTagBits.Find(inTag))
+	{
+		return *tagBit;
+	}
+
+	const int32 nextBit = FilterClassBits.Num() + FilterTagBits.Num();
+	if (nextBit >= SPOctreeFilter::MaxFilterBits)
+	{
+		return INDEX_NONE;
+	}
+	FilterTagBits.Add(inTag, nextBit);
+	bElementFilterMasksDirty = true;
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("GetFilterTagBit: [%s] filtered with bit %d."), *(inTag.ToString()), nextBit);
+	return nextBit;
+}
+
+uint64 ASPOctree::ComputeFilterMask(const AActor* inActor) const
+{
+	uint64 filterMask = 0;
+	if (inActor)
+	{
+		for (const TPair<TObjectPtr<UClass>, int32>& classBit : FilterClassBits)
+		{
+			if (inActor->IsA(classBit.Key))
+			{
+				filterMask |= 1ull << classBit.Value;
+			}
+		}
+		for (const TPair<FName, int32>& tagBit : FilterTagBits)
+		{
+			if (inActor->ActorHasTag(tagBit.Key))
+			{
+				filterMask |= 1ull << tagBit.Value;
+			}
+		}
+	}
+	return filterMask;
+}
+
+void ASPOctree::RefreshFilterMasks()
+{
+	if (bElementFilterMasksDirty)
+	{
+		bElementFilterMasksDirty = false;
+		bNodeFilterMasksDirty = true;
+		for (const TPair<TObjectPtr<AActor>, FOctreeElementId2>& elementId : ElementIds)
+		{
+			if (OctreeData->IsValidElementId(elementId.Value))
+			{
+				OctreeData->GetElementById(elementId.Value).FilterMask = ComputeFilterMask(elementId.Key);
+			}
+		}
+	}
+
+	if (!bNodeFilterMasksDirty)
+	{
+		return;
+	}
+	bNodeFilterMasksDirty = false;
+
+	NodeFilterMasks.Reset();
+	TArray<TPair<FSPOctree::FNodeIndex, FSPOctree::FNodeIndex>> visitedNodes;
+	OctreeData->FindNodesWithPredicate(
+		[](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			return true;
+		},
+		[this, &visitedNodes](FSPOctree::FNodeIndex ParentNodeIndex, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			uint64 nodeMask = 0;
+			for (const FSPOctreeElement& element : OctreeData->GetElementsForNode(NodeIndex))
+			{
+				nodeMask |= element.FilterMask;
+			}
+			if ((int32)NodeIndex >= NodeFilterMasks.Num())
+			{
+				NodeFilterMasks.SetNumZeroed((int32)NodeIndex + 1);
+			}
+			NodeFilterMasks[NodeIndex] = nodeMask;
+			visitedNodes.Emplace(ParentNodeIndex, NodeIndex);
+		});
+
+	// Children are visited after their parent, so walking backwards folds every subtree into its parent
+	for (int32 index = visitedNodes.Num() - 1; index > 0; index--)
+	{
+		const int32 parentIndex = (int32)visitedNodes[index].Key;
+		if (NodeFilterMasks.IsValidIndex(parentIndex))
+		{
+			NodeFilterMasks[parentIndex] |= NodeFilterMasks[visitedNodes[index].Value];
+		}
+	}
+}
+
+void ASPOctree::AddActorToOctree(AActor* inActor, const bool inHiddenInGame)
+{
+	if (inActor)
+	{
+		FBoxSphereBounds actorBounds = GetActorElementBounds(inActor);
+
+		if (actorBounds.SphereRadius < OctreeData->GetRootBounds().GetBox().GetExtent().GetMax())
+		{
+			check(bInitialized);
+			FSPOctreeElement element = FSPOctreeElement(inActor, actorBounds);
+			inActor->SetActorHiddenInGame(inHiddenInGame);
+			inActor->SetActorEnableCollision(!inHiddenInGame);
+			InsertElement(element);
+			if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("AddActorToOctree: [%s] to Octree."), *(inActor->GetActorNameOrLabel()));
+		}
+		else
+		{
+			//for things like skysphere
+			if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("AddActorToOctree: maxExtent greater than OctreeData->GetRootBounds maxExtent!"));
+		}
+	}
+}
+
+void ASPOctree::AddActorsToOctree(const TArray<AActor*>& inActors, const bool inHiddenInGame)
+{
+	check(bInitialized);
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Add);
+
+	EnsureLiveOctree();
+
+	const FBox rootBox = OctreeData->GetRootBounds().GetBox();
+	const double maxExtent = rootBox.GetExtent().GetMax();
+	const FVector mortonScale = FVector((double)SPOctreeBuild::MortonCellsPerAxis) / rootBox.GetSize();
+
+	struct FSortedElement
+	{
+		uint32 MortonCode;
+		int32 ActorIndex;
+	};
+	TArray<FSPOctreeElement> newElements;
+	TArray<FSortedElement> sortedElements;
+	newElements.SetNum(inActors.Num());
+	sortedElements.SetNumUninitialized(inActors.Num());
+
+	// Nothing moves the actors while the game thread waits here, so their bounds can be read from any thread
+	ParallelFor(inActors.Num(), [this, &inActors, &newElements, &sortedElements, &rootBox, &mortonScale](int32 ActorIndex)
+		{
+			AActor* actor = inActors[ActorIndex];
+			sortedElements[ActorIndex].ActorIndex = ActorIndex;
+			sortedElements[ActorIndex].MortonCode = 0;
+			if (IsValid(actor))
+			{
+				FSPOctreeElement& element = newElements[ActorIndex];
+				element = FSPOctreeElement(actor, GetActorElementBounds(actor));
+				element.FilterMask = ComputeFilterMask(actor);
+
+				const FVector cell = ((element.BoxSphereBounds.Origin - rootBox.Min) * mortonScale).BoundToBox(FVector::ZeroVector, FVector(SPOctreeBuild::MortonCellsPerAxis - 1));
+				sortedElements[ActorIndex].MortonCode = FMath::MortonCode3((uint32)cell.X) | (FMath::MortonCode3((uint32)cell.Y) << 1) | (FMath::MortonCode3((uint32)cell.Z) << 2);
+			}
+		});
+
+	sortedElements.Sort([](const FSortedElement& A, const FSortedElement& B) { return A.MortonCode < B.MortonCode; });
+
+	FBox changedBounds(ForceInit);
+	TArray<AActor*> addedActors;
+	addedActors.Reserve(inActors.Num());
+	for (const FSortedElement& sortedElement : sortedElements)
+	{
+		FSPOctreeElement& element = newElements[sortedElement.ActorIndex];
+		if (element.MyActor == nullptr)
+		{
+			continue;
+		}
+
+		if (element.BoxSphereBounds.SphereRadius >= maxExtent)
+		{
+			//for things like skysphere
+			if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("AddActorsToOctree: [%s] maxExtent greater than OctreeData->GetRootBounds maxExtent!"), *(element.MyActor->GetActorNameOrLabel()));
+			continue;
+		}
+
+		if (ElementIds.Contains(element.MyActor))
+		{
+			UpdateElementBounds(element.MyActor, element.BoxSphereBounds);
+		}
+		else
+		{
+			// Its current bounds replace the baked ones of a waiting element
+			if (UnresolvedBakedElements.Num() > 0)
+			{
+				UnresolvedBakedElements.Remove(FSoftObjectPath(element.MyActor));
+			}
+			element.ElementIds = &ElementIds;
+			OctreeData->AddElement(element);
+			RecordSnapshotChange(element.MyActor, element.BoxSphereBounds);
+			changedBounds += element.BoxSphereBounds.GetBox();
+		}
+		addedActors.Add(element.MyActor);
+	}
+
+	if (changedBounds.IsValid)
+	{
+		OnOctreeModified(changedBounds);
+	}
+
+	// Hidden state is applied once the Octree is built, and only to actors not already in that state
+	for (AActor* actor : addedActors)
+	{
+		if (actor->IsHidden() != inHiddenInGame)
+		{
+			actor->SetActorHiddenInGame(inHiddenInGame);
+		}
+		if (actor->GetActorEnableCollision() == inHiddenInGame)
+		{
+			actor->SetActorEnableCollision(!inHiddenInGame);
+		}
+	}
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("AddActorsToOctree: %d of %d actors added to Octree."), addedActors.Num(), inActors.Num());
+}
+
+void ASPOctree::BuildFromWorld(TSubclassOf<AActor> inActorClass, const bool inHiddenInGame)
+{
+	TArray<AActor*> worldActors;
+	for (TActorIterator<AActor> actorIt(GetWorld(), inActorClass.Get() ? inActorClass.Get() : AActor::StaticClass()); actorIt; ++actorIt)
+	{
+		if (!actorIt->IsA<ASPOctree>())
+		{
+			worldActors.Add(*actorIt);
+		}
+	}
+	AddActorsToOctree(worldActors, inHiddenInGame);
+}
+
+void ASPOctree::GetAllActors(TArray<AActor*>& OutActors)
+{
+	OutActors.Reset();
+	EnsureLiveOctree();
+
+	OctreeData->FindAllElements([&OutActors](const FSPOctreeElement& octElement)
+		{
+			if (octElement.MyActor)
+			{
+				OutActors.Add(octElement.MyActor);
+			}
+		});
+}
+
+bool ASPOctree::RemoveActorFromOctree(AActor* inActor)
+{
+	EnsureLiveOctree();
+	ResolveBakedElement(inActor);
+
+	FOctreeElementId2 elementId;
+	if (inActor && DynamicActors.Remove(inActor) > 0)
+	{
+		inActor->OnDestroyed.RemoveDynamic(this, &ASPOctree::OnIndexedActorDestroyed);
+		inActor->OnEndPlay.RemoveDynamic(this, &ASPOctree::OnIndexedActorEndPlay);
+	}
+	if (inActor)
+	{
+		DirtyActors.Remove(inActor);
+	}
+
+	if (inActor && ElementIds.RemoveAndCopyValue(inActor, elementId) && OctreeData->IsValidElementId(elementId))
+	{
+		const FBoxSphereBounds removedBounds = OctreeData->GetElementById(elementId).BoxSphereBounds;
+		OctreeData->RemoveElement(elementId);
+		RecordSnapshotChange(inActor, removedBounds, true);
+		OnOctreeModified(removedBounds.GetBox());
+		if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("RemoveActorFromOctree: [%s] removed from Octree."), *(inActor->GetActorNameOrLabel()));
+		return true;
+	}
+	return false;
+}
+
+bool ASPOctree::UpdateActorBounds(AActor* inActor)
+{
+	EnsureLiveOctree();
+	ResolveBakedElement(inActor);
+	if (inActor && ElementIds.Contains(inActor))
+	{
+		return UpdateElementBounds(inActor, GetActorElementBounds(inActor));
+	}
+	return false;
+}
+
+bool ASPOctree::UpdateElementBounds(AActor* inActor, const FBoxSphereBounds& inNewBounds)
+{
+	EnsureLiveOctree();
+	ResolveBakedElement(inActor);
+
+	const FOctreeElementId2* foundId = inActor ? ElementIds.Find(inActor) : nullptr;
+	if (foundId == nullptr || !OctreeData->IsValidElementId(*foundId))
+	{
+		return false;
+	}
+
+	// Copy the id, the map entry is rewritten by SetElementId while the element moves.
+	const FOctreeElementId2 elementId = *foundId;
+	FSPOctreeElement& element = OctreeData->GetElementById(elementId);
+	const FBox changedBounds = element.BoxSphereBounds.GetBox() + inNewBounds.GetBox();
+	RecordSnapshotChange(inActor, inNewBounds);
+
+	// The node that holds the old bounds also holds anything inside them, so no relocation is needed.
+	if (OctreeData->CanUpdateInPlace(element.BoxSphereBounds, inNewBounds))
+	{
+		element.BoxSphereBounds = inNewBounds;
+		OnOctreeModified(changedBounds);
+		return true;
+	}
+
+	FSPOctreeElement movedElement = element;
+	movedElement.BoxSphereBounds = inNewBounds;
+	OctreeData->RemoveElement(elementId);
+	OctreeData->AddElement(movedElement);
+	OnOctreeModified(changedBounds);
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("UpdateElementBounds: [%s] relocated."), *(inActor->GetActorNameOrLabel()));
+	return true;
+}
+
+bool ASPOctree::ContainsActor(AActor* inActor) const
+{
+	if (bLiveOctreePending)
+	{
+		return BakedQueryIndex->ContainsActor(inActor);
+	}
+	if (inActor && UnresolvedBakedElements.Num() > 0 && UnresolvedBakedElements.Contains(FSoftObjectPath(inActor)))
+	{
+		return true;
+	}
+	return inActor && ElementIds.Contains(inActor);
+}
+
+void ASPOctree::InsertElement(FSPOctreeElement inElement)
+{
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Add);
+
+	EnsureLiveOctree();
+	ResolveBakedElement(inElement.MyActor);
+
+	if (ContainsActor(inElement.MyActor))
+	{
+		UpdateElementBounds(inElement.MyActor, inElement.BoxSphereBounds);
+		return;
+	}
+
+	inElement.ElementIds = &ElementIds;
+	inElement.FilterMask = ComputeFilterMask(inElement.MyActor);
+	OctreeData->AddElement(inElement);
+	RecordSnapshotChange(inElement.MyActor, inElement.BoxSphereBounds);
+	OnOctreeModified(inElement.BoxSphereBounds.GetBox());
+}
+
+void ASPOctree::AddDynamicActorToOctree(AActor* inActor, const bool inHiddenInGame)
+{
+	AddActorToOctree(inActor, inHiddenInGame);
+	SetActorDynamic(inActor, true);
+}
+
+void ASPOctree::SetActorDynamic(AActor* inActor, const bool bDynamic)
+{
+	EnsureLiveOctree();
+	ResolveBakedElement(inActor);
+
+	if (!ContainsActor(inActor))
+	{
+		return;
+	}
+
+	if (bDynamic)
+	{
+		if (!DynamicActors.Contains(inActor))
+		{
+			DynamicActors.Add(inActor, inActor->GetActorLocation());
+			// Streaming levels and World Partition cells unload their actors without destroying them
+			inActor->OnDestroyed.AddUniqueDynamic(this, &ASPOctree::OnIndexedActorDestroyed);
+			inActor->OnEndPlay.AddUniqueDynamic(this, &ASPOctree::OnIndexedActorEndPlay);
+		}
+	}
+	else if (DynamicActors.Remove(inActor) > 0)
+	{
+		inActor->OnDestroyed.RemoveDynamic(this, &ASPOctree::OnIndexedActorDestroyed);
+		inActor->OnEndPlay.RemoveDynamic(this, &ASPOctree::OnIndexedActorEndPlay);
+	}
+}
+
+void ASPOctree::MarkActorDirty(AActor* inActor)
+{
+	EnsureLiveOctree();
+	ResolveBakedElement(inActor);
+
+	if (ContainsActor(inActor))
+	{
+		DirtyActors.Add(inActor);
+	}
+}
+
+void ASPOctree::GatherMovedDynamicActors()
+{
+	const double toleranceSquared = FMath::Square(DynamicMoveTolerance);
+
+	for (TMap<TWeakObjectPtr<AActor>, FVector>::TIterator dynamicActorIt = DynamicActors.CreateIterator(); dynamicActorIt; ++dynamicActorIt)
+	{
+		// Actors that went away without EndPlay reaching us are dropped
+		const AActor* actor = dynamicActorIt.Key().Get();
+		if (actor == nullptr)
+		{
+			dynamicActorIt.RemoveCurrent();
+			continue;
+		}
+
+		if (FVector::DistSquared(actor->GetActorLocation(), dynamicActorIt.Value()) > toleranceSquared)
+		{
+			DirtyActors.Add(dynamicActorIt.Key());
+		}
+	}
+}
+
+void ASPOctree::FlushDirtyActors()
+{
+	if (DirtyActors.IsEmpty())
+	{
+		return;
+	}
+
+	RelocatedElements.Reset();
+	FBox changedBounds(ForceInit);
+
+	for (const TWeakObjectPtr<AActor>& dirtyActor : DirtyActors)
+	{
+		AActor* actor = dirtyActor.Get();
+		const FOctreeElementId2* elementId = actor ? ElementIds.Find(actor) : nullptr;
+		if (elementId == nullptr || !OctreeData->IsValidElementId(*elementId))
+		{
+			continue;
+		}
+
+		const FBoxSphereBounds newBounds = GetActorElementBounds(actor);
+		FSPOctreeElement& element = OctreeData->GetElementById(*elementId);
+		changedBounds += element.BoxSphereBounds.GetBox();
+		changedBounds += newBounds.GetBox();
+		RecordSnapshotChange(actor, newBounds);
+
+		if (OctreeData->CanUpdateInPlace(element.BoxSphereBounds, newBounds))
+		{
+			element.BoxSphereBounds = newBounds;
+		}
+		else
+		{
+			FSPOctreeElement& movedElement = RelocatedElements.Add_GetRef(element);
+			movedElement.BoxSphereBounds = newBounds;
+		}
+
+		if (FVector* indexedLocation = DynamicActors.Find(dirtyActor))
+		{
+			*indexedLocation = actor->GetActorLocation();
+		}
+	}
+
+	// Take every moved element out before adding any back, so leaves are collapsed and split
+	// once for the whole batch instead of once per actor.
+	for (const FSPOctreeElement& element : RelocatedElements)
+	{
+		FOctreeElementId2 elementId;
+		if (ElementIds.RemoveAndCopyValue(element.MyActor, elementId))
+		{
+			OctreeData->RemoveElement(elementId);
+		}
+	}
+
+	for (const FSPOctreeElement& element : RelocatedElements)
+	{
+		OctreeData->AddElement(element);
+	}
+
+	if (changedBounds.IsValid)
+	{
+		OnOctreeModified(changedBounds);
+	}
+
+	if (PrintTickLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("FlushDirtyActors: dirty: %d relocated: %d"), DirtyActors.Num(), RelocatedElements.Num());
+
+	DirtyActors.Reset();
+	RelocatedElements.Reset();
+}
+
+void ASPOctree::BakeQueryIndex()
+{
+	check(bInitialized);
+	EnsureLiveOctree();
+	TSharedPtr<FSPOctreeBakedIndex, ESPMode::ThreadSafe> bakedIndex = MakeShared<FSPOctreeBakedIndex, ESPMode::ThreadSafe>();
+	bakedIndex->Build(*OctreeData);
+	BakedQueryIndex = bakedIndex;
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("BakeQueryIndex: nodes: %d elements: %d bytes: %llu"), bakedIndex->GetNumNodes(), bakedIndex->GetNumElements(), (uint64)bakedIndex->GetAllocatedSize());
+}
+
+void ASPOctree::ReleaseQueryIndex()
+{
+	EnsureLiveOctree();
+	BakedQueryIndex.Reset();
+}
+
+bool ASPOctree::HasBakedQueryIndex() const
+{
+	return BakedQueryIndex.IsValid();
+}
+
+void ASPOctree::OnOctreeModified(const FBox& inChangedBounds)
+{
+	ContentVersion++;
+	bNodeFilterMasksDirty = true;
+
+	// Copies of a tree that was replaced or emptied must not be handed out while the next one is built
+	if (!inChangedBounds.IsValid)
+	{
+		QuerySnapshot.Reset();
+		PendingQuerySnapshot.Reset();
+		SnapshotSource.Reset();
+		SnapshotChanges.Reset();
+	}
+
+	if (RecentChanges.Num() == SPOctreeChanges::MaxRecentChanges)
+	{
+		RecentChanges.RemoveAt(0, 1, false);
+	}
+	RecentChanges.Add({ ContentVersion, inChangedBounds });
+
+	if (BakedQueryIndex.IsValid())
+	{
+		// The baked copy no longer matches the Octree
+		if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("OnOctreeModified: Octree changed, releasing the baked query index."));
+		ReleaseQueryIndex();
+	}
+}
+
+uint32 ASPOctree::GetContentVersion() const
+{
+	return ContentVersion;
+}
+
+uint32 ASPOctree::GetQuerySnapshotVersion() const
+{
+	return BakedQueryIndex.IsValid() ? ContentVersion : QuerySnapshotVersion;
+}
+
+bool ASPOctree::HasChangedNear(const FBox& inRegion, const uint32 inSinceVersion) const
+{
+	if (inSinceVersion == ContentVersion)
+	{
+		return false;
+	}
+
+	// Changes older than the history are unknown, they may have touched the region
+	if (RecentChanges.IsEmpty() || RecentChanges[0].Version > inSinceVersion + 1)
+	{
+		return true;
+	}
+
+	for (int index = RecentChanges.Num() - 1; index >= 0 && RecentChanges[index].Version > inSinceVersion; index--)
+	{
+		const FBox& changedBounds = RecentChanges[index].Bounds;
+		if (!changedBounds.IsValid || changedBounds.Intersect(inRegion))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+FBox ASPOctree::GetLeafBoundsAt(const FVector& inPoint) const
+{
+	if (BakedQueryIndex.IsValid())
+	{
+		return BakedQueryIndex->GetLeafBoundsAt(inPoint);
+	}
+
+	// Node bounds are loose and overlap, the deepest node containing the point is kept
+	TArray<FSPOctree::FNodeIndex, TInlineAllocator<FSPOctree::MaxNodeDepth + 1>> visitedNodes;
+	FBox leafBounds(ForceInit);
+	int32 leafDepth = 0;
+
+	OctreeData->FindNodesWithPredicate(
+		[&inPoint, &visitedNodes, &leafBounds, &leafDepth](FSPOctree::FNodeIndex ParentNodeIndex, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& NodeBounds)
+		{
+			const FBox nodeBox = NodeBounds.GetBox();
+			if (!nodeBox.IsInside(inPoint))
+			{
+				return false;
+			}
+
+			while (visitedNodes.Num() > 0 && visitedNodes.Top() != ParentNodeIndex)
+			{
+				visitedNodes.Pop(false);
+			}
+			visitedNodes.Add(NodeIndex);
+
+			if (visitedNodes.Num() > leafDepth)
+			{
+				leafDepth = visitedNodes.Num();
+				leafBounds = nodeBox;
+			}
+			return true;
+		},
+		[](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+		});
+
+	return leafBounds;
+}
+
+TSharedRef<const FSPOctreeBakedIndex, ESPMode::ThreadSafe> ASPOctree::GetQuerySnapshot()
+{
+	check(bInitialized);
+	if (BakedQueryIndex.IsValid())
+	{
+		// Other threads must not resolve actors, so a loaded index resolves them all before it is shared
+		BakedQueryIndex->ResolveAllActors();
+		return BakedQueryIndex.ToSharedRef();
+	}
+
+	auto adoptPendingSnapshot = [this]()
+	{
+		QuerySnapshot = PendingQuerySnapshot.Get();
+		QuerySnapshotVersion = PendingQuerySnapshotVersion;
+		PendingQuerySnapshot.Reset();
+	};
+
+	if (PendingQuerySnapshot.IsValid() && PendingQuerySnapshot.IsReady())
+	{
+		adoptPendingSnapshot();
+	}
+
+	// One build at a time, changes made while it runs are picked up by the next one
+	if (!PendingQuerySnapshot.IsValid() && (!QuerySnapshot.IsValid() || QuerySnapshotVersion != ContentVersion))
+	{
+		StartQuerySnapshotBuild();
+	}
+
+	// Only the first copy is waited for, later ones are served from the previous version until they are ready
+	if (!QuerySnapshot.IsValid())
+	{
+		adoptPendingSnapshot();
+	}
+	return QuerySnapshot.ToSharedRef();
+}
+
+void ASPOctree::StartQuerySnapshotBuild()
+{
+	// The whole Octree is only copied for the first build after a reset, later builds get the changes since the previous one
+	if (!SnapshotSource.IsValid())
+	{
+		SnapshotSource = MakeShared<FSPOctreeSnapshotSource, ESPMode::ThreadSafe>(OctreeData->GetRootBounds(), OctreeData->GetLayout());
+		SnapshotChanges.Reset(ElementIds.Num());
+		OctreeData->FindAllElements([this](const FSPOctreeElement& octElement)
+			{
+				SnapshotChanges.Add({ octElement.MyActor.Get(), octElement.MyActor.Get(), octElement.BoxSphereBounds, false });
+			});
+	}
+
+	const int32 numChanges = SnapshotChanges.Num();
+	PendingQuerySnapshotVersion = ContentVersion;
+	PendingQuerySnapshot = Async(EAsyncExecution::TaskGraph, [source = SnapshotSource, changes = MoveTemp(SnapshotChanges)]()
+		{
+			source->ApplyChanges(changes);
+			return source->BuildSnapshot();
+		});
+	SnapshotChanges.Reset();
+
+	if (PrintTickLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("StartQuerySnapshotBuild: version: %u changes: %d elements: %d"), ContentVersion, numChanges, ElementIds.Num());
+}
+
+void ASPOctree::RecordSnapshotChange(AActor* inActor, const FBoxSphereBounds& inBounds, const bool bRemoved)
+{
+	if (!SnapshotSource.IsValid())
+	{
+		return;
+	}
+
+	// Past one change per element, copying the Octree again is cheaper than replaying them
+	if (SnapshotChanges.Num() >= FMath::Max(ElementIds.Num(), 1))
+	{
+		SnapshotSource.Reset();
+		SnapshotChanges.Reset();
+		return;
+	}
+	SnapshotChanges.Add({ inActor, inActor, inBounds, bRemoved });
+}
+
+TFuture<FSPOctreeQueryResults> ASPOctree::QueryAsync(TArray<FSPOctreeQuery> inQueries)
+{
+	TSharedRef<const FSPOctreeBakedIndex, ESPMode::ThreadSafe> snapshot = GetQuerySnapshot();
+	const uint32 snapshotVersion = GetQuerySnapshotVersion();
+	return Async(EAsyncExecution::TaskGraph, [snapshot, snapshotVersion, queries = MoveTemp(inQueries)]()
+		{
+			FSPOctreeQueryResults results;
+			snapshot->QueryBatch(queries, results);
+			results.ContentVersion = snapshotVersion;
+			return results;
+		});
+}
+
+void ASPOctree::QueryAsyncWithCallback(const TArray<FSPOctreeQuery>& inQueries, FSPOctreeQueryCompleteDelegate inOnComplete)
+{
+	FPendingAsyncQuery& pendingQuery = PendingAsyncQueries.AddDefaulted_GetRef();
+	pendingQuery.Results = QueryAsync(inQueries);
+	pendingQuery.OnComplete = inOnComplete;
+}
+
+void ASPOctree::DispatchCompletedQueries()
+{
+	for (int index = 0; index < PendingAsyncQueries.Num(); index++)
+	{
+		if (PendingAsyncQueries[index].Results.IsReady())
+		{
+			FPendingAsyncQuery completedQuery = MoveTemp(PendingAsyncQueries[index]);
+			PendingAsyncQueries.RemoveAt(index);
+			index--;
+
+			// Actors destroyed or unloaded since the snapshot are dropped before the delegate can read them
+			FSPOctreeQueryResults results = completedQuery.Results.Get();
+			results.RemoveStaleElements();
+
+			// Called after removal, the delegate may start another batch
+			completedQuery.OnComplete.ExecuteIfBound(results);
+		}
+	}
+}
+
+void ASPOctree::OnIndexedActorDestroyed(AActor* inDestroyedActor)
+{
+	RemoveActorFromOctree(inDestroyedActor);
+}
+
+void ASPOctree::OnIndexedActorEndPlay(AActor* inActor, EEndPlayReason::Type /*inEndPlayReason*/)
+{
+	RemoveActorFromOctree(inActor);
+}
+
+void ASPOctree::ResetTrackedElements()
+{
+	ElementIds.Reset();
+	DynamicActors.Reset();
+	DirtyActors.Reset();
+	bLiveOctreePending = false;
+	UnresolvedBakedElements.Reset();
+	if (LevelAddedToWorldHandle.IsValid())
+	{
+		FWorldDelegates::LevelAddedToWorld.Remove(LevelAddedToWorldHandle);
+		LevelAddedToWorldHandle.Reset();
+	}
+	bNodeFilterMasksDirty = true;
+}
+
+bool ASPOctree::LoadBakedAsset(USPOctreeBakedAsset* inAsset)
+{
+	if (inAsset == nullptr || !inAsset->RootBounds.IsValid)
+	{
+		UE_LOG(SPOctreeDataLayerMod, Warning, TEXT("LoadBakedAsset: asset is missing or was never baked."));
+		return false;
+	}
+
+	Initialize(inAsset->RootBounds, bDrawDebugInfo);
+
+	TSharedRef<FSPOctreeBakedIndex, ESPMode::ThreadSafe> bakedIndex = inAsset->CreateQueryIndex();
+#if WITH_EDITOR
+	if (GetWorld()->IsPlayInEditor())
+	{
+		bakedIndex->FixupActorPathsForPIE(GetOutermost()->GetPIEInstanceID());
+	}
+#endif
+	BakedQueryIndex = bakedIndex;
+	bLiveOctreePending = true;
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("LoadBakedAsset: [%s] nodes: %d elements: %d"), *(inAsset->GetName()), bakedIndex->GetNumNodes(), bakedIndex->GetNumElements());
+	return true;
+}
+
+void ASPOctree::EnsureLiveOctree()
+{
+	if (!bLiveOctreePending)
+	{
+		return;
+	}
+	bLiveOctreePending = false;
+
+	const FSPOctreeBakedIndex& bakedIndex = *BakedQueryIndex;
+	for (int32 elementIndex = 0; elementIndex < bakedIndex.GetNumElements(); elementIndex++)
+	{
+		FSPOctreeElement element = bakedIndex.GetElement(elementIndex);
+		if (element.MyActor)
+		{
+			element.ElementIds = &ElementIds;
+			element.FilterMask = ComputeFilterMask(element.MyActor);
+			OctreeData->AddElement(element);
+		}
+		else if (!bakedIndex.GetElementActorPath(elementIndex).IsNull())
+		{
+			// Its streaming level or World Partition cell is not loaded yet
+			UnresolvedBakedElements.Add(bakedIndex.GetElementActorPath(elementIndex), element.BoxSphereBounds);
+		}
+	}
+
+	if (UnresolvedBakedElements.Num() > 0 && !LevelAddedToWorldHandle.IsValid())
+	{
+		LevelAddedToWorldHandle = FWorldDelegates::LevelAddedToWorld.AddUObject(this, &ASPOctree::OnLevelAddedToWorld);
+	}
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("EnsureLiveOctree: %d baked elements added to the Octree, %d wait for their actor to load."), ElementIds.Num(), UnresolvedBakedElements.Num());
+}
+
+void ASPOctree::ResolveBakedElements()
+{
+	FBox changedBounds(ForceInit);
+	int32 numResolved = 0;
+	for (TMap<FSoftObjectPath, FBoxSphereBounds>::TIterator unresolvedIt = UnresolvedBakedElements.CreateIterator(); unresolvedIt; ++unresolvedIt)
+	{
+		AActor* actor = Cast<AActor>(unresolvedIt.Key().ResolveObject());
+		if (actor)
+		{
+			AddResolvedBakedElement(actor, unresolvedIt.Value(), changedBounds);
+			unresolvedIt.RemoveCurrent();
+			numResolved++;
+		}
+	}
+
+	if (changedBounds.IsValid)
+	{
+		OnOctreeModified(changedBounds);
+	}
+
+	if (UnresolvedBakedElements.Num() == 0 && LevelAddedToWorldHandle.IsValid())
+	{
+		FWorldDelegates::LevelAddedToWorld.Remove(LevelAddedToWorldHandle);
+		LevelAddedToWorldHandle.Reset();
+	}
+
+	if (PrintLogs && numResolved > 0) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("ResolveBakedElements: %d baked elements added to the Octree, %d still wait for their actor."), numResolved, UnresolvedBakedElements.Num());
+}
+
+void ASPOctree::ResolveBakedElement(AActor* inActor)
+{
+	if (inActor == nullptr || UnresolvedBakedElements.Num() == 0)
+	{
+		return;
+	}
+
+	FBoxSphereBounds bakedBounds;
+	if (UnresolvedBakedElements.RemoveAndCopyValue(FSoftObjectPath(inActor), bakedBounds))
+	{
+		FBox changedBounds(ForceInit);
+		AddResolvedBakedElement(inActor, bakedBounds, changedBounds);
+		OnOctreeModified(changedBounds);
+	}
+}
+
+void ASPOctree::AddResolvedBakedElement(AActor* inActor, const FBoxSphereBounds& inBounds, FBox& InOutChangedBounds)
+{
+	// Actors added again since the Octree went live already have their element
+	if (ElementIds.Contains(inActor))
+	{
+		return;
+	}
+
+	FSPOctreeElement element(inActor, inBounds);
+	element.ElementIds = &ElementIds;
+	element.FilterMask = ComputeFilterMask(inActor);
+	OctreeData->AddElement(element);
+	RecordSnapshotChange(inActor, inBounds);
+	InOutChangedBounds += inBounds.GetBox();
+}
+
+void ASPOctree::OnLevelAddedToWorld(ULevel* /*inLevel*/, UWorld* inWorld)
+{
+	if (inWorld == GetWorld() && OctreeData)
+	{
+		ResolveBakedElements();
+	}
+}
+
+#if WITH_EDITOR
+void ASPOctree::BakeToAsset()
+{
+	if (BakedAsset == nullptr)
+	{
+		UE_LOG(SPOctreeDataLayerMod, Error, TEXT("BakeToAsset: BakedAsset is not set."));
+		return;
+	}
+
+	TArray<AActor*> bakeActors;
+	GatherBakeActors(bakeActors);
+
+	FSPOctree bakedOctree(GetBakeRootBounds().GetCenter(), BakeExtent, Layout);
+	for (AActor* actor : bakeActors)
+	{
+		bakedOctree.AddElement(FSPOctreeElement(actor, GetActorElementBounds(actor)));
+	}
+
+	BakedAsset->Bake(bakedOctree);
+	BakedAsset->MarkPackageDirty();
+
+	UE_LOG(SPOctreeDataLayerMod, Log, TEXT("BakeToAsset: %d actors baked into [%s]."), bakeActors.Num(), *(BakedAsset->GetName()));
+}
+
+void ASPOctree::BuildDataLayerCells()
+{
+	UDataLayerEditorSubsystem* dataLayerSystem = FModuleManager::GetModuleChecked<FSPOctreeDataLayerModule>("SPOctreeDataLayer").GetDataLayerSystem();
+	if (dataLayerSystem == nullptr)
+	{
+		UE_LOG(SPOctreeDataLayerMod, Error, TEXT("BuildDataLayerCells: the Data Layer editor subsystem is not available."));
+		return;
+	}
+
+	TArray<AActor*> bakeActors;
+	GatherBakeActors(bakeActors);
+
+	// The nodes at a given depth of an Octree split its root bounds into a regular grid
+	const FBox rootBounds = GetBakeRootBounds();
+	const int32 cellsPerAxis = 1 << FMath::Clamp(DataLayerCellDepth, 0, (int32)FSPOctree::MaxNodeDepth);
+	const FVector cellSize = rootBounds.GetSize() / cellsPerAxis;
+
+	TMap<FIntVector, TArray<AActor*>> cellActors;
+	for (AActor* actor : bakeActors)
+	{
+		const FVector cellPosition = (GetActorElementBounds(actor).Origin - rootBounds.Min) / cellSize;
+		const FIntVector cellCoordinates = FIntVector(
+			FMath::Clamp(FMath::FloorToInt(cellPosition.X), 0, cellsPerAxis - 1),
+			FMath::Clamp(FMath::FloorToInt(cellPosition.Y), 0, cellsPerAxis - 1),
+			FMath::Clamp(FMath::FloorToInt(cellPosition.Z), 0, cellsPerAxis - 1));
+		cellActors.FindOrAdd(cellCoordinates).Add(actor);
+	}
+
+	Modify();
+	DataLayerCells.Reset();
+
+	// Cells of the previous run are emptied, so actors that moved or are no longer baked leave their old cell
+	const FString cellLabelPrefix = FString::Printf(TEXT("%s_Cell_"), *GetActorNameOrLabel());
+	TArray<TWeakObjectPtr<UDataLayer>> dataLayers;
+	dataLayerSystem->AddAllDataLayersTo(dataLayers);
+	TArray<UDataLayer*> oldCellLayers;
+	for (const TWeakObjectPtr<UDataLayer>& dataLayer : dataLayers)
+	{
+		if (dataLayer.IsValid() && dataLayer->GetDataLayerLabel().ToString().StartsWith(cellLabelPrefix))
+		{
+			oldCellLayers.Add(dataLayer.Get());
+		}
+	}
+	for (UDataLayer* oldCellLayer : oldCellLayers)
+	{
+		TArray<AActor*> oldCellActors;
+		for (TActorIterator<AActor> actorIt(GetWorld()); actorIt; ++actorIt)
+		{
+			if (actorIt->ContainsDataLayer(oldCellLayer))
+			{
+				oldCellActors.Add(*actorIt);
+			}
+		}
+		dataLayerSystem->RemoveActorsFromDataLayer(oldCellActors, oldCellLayer);
+	}
+
+	TSet<UDataLayer*> usedCellLayers;
+	for (const TPair<FIntVector, TArray<AActor*>>& cell : cellActors)
+	{
+		const FName dataLayerLabel = *FString::Printf(TEXT("%s%d_%d_%d"), *cellLabelPrefix, cell.Key.X, cell.Key.Y, cell.Key.Z);
+		UDataLayer* dataLayer = dataLayerSystem->GetDataLayerFromLabel(dataLayerLabel);
+		if (dataLayer == nullptr)
+		{
+			dataLayer = dataLayerSystem->CreateDataLayer();
+			dataLayerSystem->RenameDataLayer(dataLayer, dataLayerLabel);
+		}
+		dataLayer->SetIsRuntime(true);
+		dataLayerSystem->AddActorsToDataLayer(cell.Value, dataLayer);
+		usedCellLayers.Add(dataLayer);
+
+		FSPOctreeDataLayerCell& dataLayerCell = DataLayerCells.AddDefaulted_GetRef();
+		const FVector cellMin = rootBounds.Min + cellSize * FVector(cell.Key);
+		dataLayerCell.Bounds = FBox(cellMin, cellMin + cellSize);
+		dataLayerCell.DataLayerLabel = dataLayer->GetDataLayerLabel();
+	}
+
+	int32 numDeletedCells = 0;
+	for (UDataLayer* oldCellLayer : oldCellLayers)
+	{
+		if (!usedCellLayers.Contains(oldCellLayer))
+		{
+			dataLayerSystem->DeleteDataLayer(oldCellLayer);
+			numDeletedCells++;
+		}
+	}
+
+	UE_LOG(SPOctreeDataLayerMod, Log, TEXT("BuildDataLayerCells: %d actors moved into %d Data Layer cells, %d empty cells deleted."), bakeActors.Num(), DataLayerCells.Num(), numDeletedCells);
+}
+
+void ASPOctree::GatherBakeActors(TArray<AActor*>& OutActors) const
+{
+	OutActors.Reset();
+	const FBox bakeRootBounds = GetBakeRootBounds();
+
+	for (TActorIterator<AActor> actorIt(GetWorld(), BakeActorClass ? BakeActorClass.Get() : AActor::StaticClass()); actorIt; ++actorIt)
+	{
+		AActor* actor = *actorIt;
+		if (actor == this || actor->IsEditorOnly() || (!BakeActorTag.IsNone() && !actor->ActorHasTag(BakeActorTag)))
+		{
+			continue;
+		}
+
+		// Same rule as AddActorToOctree, things like the sky sphere are left out
+		const FBoxSphereBounds actorBounds = GetActorElementBounds(actor);
+		if (actorBounds.SphereRadius < BakeExtent && bakeRootBounds.IsInsideOrOn(actorBounds.Origin))
+		{
+			OutActors.Add(actor);
+		}
+	}
+}
+
+FBox ASPOctree::GetBakeRootBounds() const
+{
+	return FBox(GetActorLocation() - FVector(BakeExtent), GetActorLocation() + FVector(BakeExtent));
+}
+#endif
+
+void ASPOctree::ForEachDataLayerCellWithinDistance(const FVector& inPoint, const float inDistance, TFunctionRef<void(const FSPOctreeDataLayerCell&, const float)> inVisitor) const
+{
+	const double distanceSquared = FMath::Square((double)inDistance);
+	for (const FSPOctreeDataLayerCell& cell : DataLayerCells)
+	{
+		const double cellDistanceSquared = cell.Bounds.ComputeSquaredDistanceToPoint(inPoint);
+		if (cellDistanceSquared <= distanceSquared)
+		{
+			inVisitor(cell, FMath::Sqrt(cellDistanceSquared));
+		}
+	}
+}
+
+FBoxSphereBounds ASPOctree::GetActorElementBounds(AActor* inActor)
+{
+	FVector origin;
+	FVector boxExtent;
+	inActor->GetActorBounds(false, origin, boxExtent);
+	return FBoxSphereBounds(origin, boxExtent, boxExtent.GetMax());
 }
 
 void ASPOctree::DrawOctreeBounds()
@@ -0,0 +1,29 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SPOctreeBakedAsset.h"
+
+void USPOctreeBakedAsset::Serialize(FArchive& Ar)
+{
+	Super::Serialize(Ar);
+
+	BakedIndex.Serialize(Ar);
+}
+
+#if WITH_EDITOR
+void USPOctreeBakedAsset::Bake(const FSPOctree& inOctree)
+{
+	Modify();
+
+	BakedIndex.Build(inOctree);
+	BakedIndex.StoreActorPaths();
+
+	RootBounds = inOctree.GetRootBounds().GetBox();
+	NumNodes = BakedIndex.GetNumNodes();
+	NumElements = BakedIndex.GetNumElements();
+}
+#endif
+
+TSharedRef<FSPOctreeBakedIndex, ESPMode::ThreadSafe> USPOctreeBakedAsset::CreateQueryIndex() const
+{
+	return MakeShared<FSPOctreeBakedIndex, ESPMode::ThreadSafe>(BakedIndex);
+}
@@ -0,0 +1,778 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SPOctreeBakedIndex.h"
+#include "SPOctreeDataLayer.h"
+#include "SPOctreeStats.h"
+#include "ConvexVolume.h"
+#include "Serialization/CustomVersion.h"
+
+namespace SPOctreeBakedIndex
+{
+	/** Extent given to subtrees without elements, fails every bounds test. */
+	static constexpr float EmptyNodeExtent = -1.0e30f;
+
+	/** Extra floats after the last element so a group of four never reads past the allocation. */
+	static constexpr int32 ElementPadding = 3;
+
+	enum EVersion : int32
+	{
+		InitialVersion = 1,
+		LatestVersion = InitialVersion
+	};
+
+	static const FGuid VersionGuid(0x5B3F1C27, 0x8E4A4D19, 0xA2D60F73, 0x4C91E8B5);
+	static FCustomVersionRegistration GRegisterVersion(VersionGuid, LatestVersion, TEXT("SPOctreeBakedIndex"));
+}
+
+void FSPOctreeBakedIndex::Build(const FSPOctree& inOctree)
+{
+	Reset();
+
+	Origin = inOctree.GetRootBounds().Center;
+
+	// Point elements are baked as their origin, so every query of the index matches them the way the live Octree does
+	const bool bPointElements = inOctree.HasPointElements();
+
+	TArray<int32> parentNodes;
+	TArray<FBox> subtreeBounds;
+	TMap<FSPOctree::FNodeIndex, int32> flatNodeIndices;
+
+	// FindNodesWithPredicate visits parents before their children, which is the depth first order of the flat layout
+	inOctree.FindNodesWithPredicate(
+		[](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			return true;
+		},
+		[this, &inOctree, &parentNodes, &subtreeBounds, &flatNodeIndices, bPointElements](FSPOctree::FNodeIndex ParentNodeIndex, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+		{
+			const int32* parentFlatIndex = flatNodeIndices.Find(ParentNodeIndex);
+			flatNodeIndices.Add(NodeIndex, parentNodes.Num());
+			parentNodes.Add(parentFlatIndex ? *parentFlatIndex : INDEX_NONE);
+
+			TArrayView<const FSPOctreeElement> nodeElements = inOctree.GetElementsForNode(NodeIndex);
+			NodeFirstElement.Add(Elements.Num());
+			NodeNumElements.Add(nodeElements.Num());
+
+			FBox& bounds = subtreeBounds.Add_GetRef(FBox(ForceInit));
+			for (const FSPOctreeElement& element : nodeElements)
+			{
+				Elements.Add(element);
+				bounds += bPointElements ? FBox(element.BoxSphereBounds.Origin, element.BoxSphereBounds.Origin) : element.BoxSphereBounds.GetBox();
+			}
+		});
+
+	const int32 numNodes = parentNodes.Num();
+	NodeSubtreeEnd.SetNumUninitialized(numNodes);
+	for (int32 nodeIndex = 0; nodeIndex < numNodes; nodeIndex++)
+	{
+		NodeSubtreeEnd[nodeIndex] = nodeIndex + 1;
+	}
+
+	// Walking backwards finishes every subtree before its parent is reached
+	for (int32 nodeIndex = numNodes - 1; nodeIndex > 0; nodeIndex--)
+	{
+		const int32 parentIndex = parentNodes[nodeIndex];
+		NodeSubtreeEnd[parentIndex] = FMath::Max(NodeSubtreeEnd[parentIndex], NodeSubtreeEnd[nodeIndex]);
+		if (subtreeBounds[nodeIndex].IsValid)
+		{
+			subtreeBounds[parentIndex] += subtreeBounds[nodeIndex];
+		}
+	}
+
+	NodeCenterX.Reserve(numNodes);
+	NodeCenterY.Reserve(numNodes);
+	NodeCenterZ.Reserve(numNodes);
+	NodeExtentX.Reserve(numNodes);
+	NodeExtentY.Reserve(numNodes);
+	NodeExtentZ.Reserve(numNodes);
+
+	for (int32 nodeIndex = 0; nodeIndex < numNodes; nodeIndex++)
+	{
+		const FBox& bounds = subtreeBounds[nodeIndex];
+		const FVector center = bounds.IsValid ? bounds.GetCenter() - Origin : FVector::ZeroVector;
+		const FVector extent = bounds.IsValid ? bounds.GetExtent() : FVector(SPOctreeBakedIndex::EmptyNodeExtent);
+		NodeCenterX.Add(center.X);
+		NodeCenterY.Add(center.Y);
+		NodeCenterZ.Add(center.Z);
+		NodeExtentX.Add(extent.X);
+		NodeExtentY.Add(extent.Y);
+		NodeExtentZ.Add(extent.Z);
+	}
+
+	const int32 numElements = Elements.Num();
+	ElementCenterX.Reserve(numElements + SPOctreeBakedIndex::ElementPadding);
+	ElementCenterY.Reserve(numElements + SPOctreeBakedIndex::ElementPadding);
+	ElementCenterZ.Reserve(numElements + SPOctreeBakedIndex::ElementPadding);
+	ElementExtentX.Reserve(numElements + SPOctreeBakedIndex::ElementPadding);
+	ElementExtentY.Reserve(numElements + SPOctreeBakedIndex::ElementPadding);
+	ElementExtentZ.Reserve(numElements + SPOctreeBakedIndex::ElementPadding);
+
+	for (const FSPOctreeElement& element : Elements)
+	{
+		const FVector center = element.BoxSphereBounds.Origin - Origin;
+		ElementCenterX.Add(center.X);
+		ElementCenterY.Add(center.Y);
+		ElementCenterZ.Add(center.Z);
+		const FVector extent = bPointElements ? FVector::ZeroVector : element.BoxSphereBounds.BoxExtent;
+		ElementExtentX.Add(extent.X);
+		ElementExtentY.Add(extent.Y);
+		ElementExtentZ.Add(extent.Z);
+	}
+
+	ElementCenterX.AddZeroed(SPOctreeBakedIndex::ElementPadding);
+	ElementCenterY.AddZeroed(SPOctreeBakedIndex::ElementPadding);
+	ElementCenterZ.AddZeroed(SPOctreeBakedIndex::ElementPadding);
+	ElementExtentX.AddZeroed(SPOctreeBakedIndex::ElementPadding);
+	ElementExtentY.AddZeroed(SPOctreeBakedIndex::ElementPadding);
+	ElementExtentZ.AddZeroed(SPOctreeBakedIndex::ElementPadding);
+}
+
+void FSPOctreeBakedIndex::Reset()
+{
+	Origin = FVector::ZeroVector;
+
+	NodeCenterX.Reset();
+	NodeCenterY.Reset();
+	NodeCenterZ.Reset();
+	NodeExtentX.Reset();
+	NodeExtentY.Reset();
+	NodeExtentZ.Reset();
+	NodeSubtreeEnd.Reset();
+	NodeFirstElement.Reset();
+	NodeNumElements.Reset();
+
+	ElementCenterX.Reset();
+	ElementCenterY.Reset();
+	ElementCenterZ.Reset();
+	ElementExtentX.Reset();
+	ElementExtentY.Reset();
+	ElementExtentZ.Reset();
+	Elements.Reset();
+	ElementActorRefs.Reset();
+	ElementActorPaths.Reset();
+	ElementActorPathIndices.Reset();
+	bHasUnresolvedActors = false;
+}
+
+void FSPOctreeBakedIndex::Serialize(FArchive& Ar)
+{
+	Ar.UsingCustomVersion(SPOctreeBakedIndex::VersionGuid);
+
+	Ar << Origin;
+
+	NodeCenterX.BulkSerialize(Ar);
+	NodeCenterY.BulkSerialize(Ar);
+	NodeCenterZ.BulkSerialize(Ar);
+	NodeExtentX.BulkSerialize(Ar);
+	NodeExtentY.BulkSerialize(Ar);
+	NodeExtentZ.BulkSerialize(Ar);
+	NodeSubtreeEnd.BulkSerialize(Ar);
+	NodeFirstElement.BulkSerialize(Ar);
+	NodeNumElements.BulkSerialize(Ar);
+
+	ElementCenterX.BulkSerialize(Ar);
+	ElementCenterY.BulkSerialize(Ar);
+	ElementCenterZ.BulkSerialize(Ar);
+	ElementExtentX.BulkSerialize(Ar);
+	ElementExtentY.BulkSerialize(Ar);
+	ElementExtentZ.BulkSerialize(Ar);
+
+	int32 numElements = Elements.Num();
+	Ar << numElements;
+	if (Ar.IsLoading())
+	{
+		Elements.Reset(numElements);
+		Elements.AddDefaulted(numElements);
+	}
+	for (FSPOctreeElement& element : Elements)
+	{
+		Ar << element.BoxSphereBounds;
+	}
+
+	Ar << ElementActorPaths;
+
+	if (Ar.IsLoading())
+	{
+		if (ElementActorPaths.Num() != numElements)
+		{
+			UE_LOG(SPOctreeDataLayerMod, Warning, TEXT("FSPOctreeBakedIndex: %d actor paths for %d elements, actors will not be resolved."), ElementActorPaths.Num(), numElements);
+			ElementActorPaths.Reset();
+		}
+		bHasUnresolvedActors = ElementActorPaths.Num() > 0;
+		BuildActorPathIndices();
+	}
+}
+
+void FSPOctreeBakedIndex::StoreActorPaths()
+{
+	ElementActorPaths.Reset(Elements.Num());
+	for (FSPOctreeElement& element : Elements)
+	{
+		ElementActorPaths.Emplace(element.MyActor.Get());
+		element.MyActor = nullptr;
+	}
+	bHasUnresolvedActors = ElementActorPaths.Num() > 0;
+	BuildActorPathIndices();
+}
+
+void FSPOctreeBakedIndex::BuildActorPathIndices()
+{
+	ElementActorPathIndices.Reset();
+	ElementActorPathIndices.Reserve(ElementActorPaths.Num());
+	for (int32 elementIndex = 0; elementIndex < ElementActorPaths.Num(); elementIndex++)
+	{
+		ElementActorPathIndices.Add(ElementActorPaths[elementIndex], elementIndex);
+	}
+}
+
+#if WITH_EDITOR
+void FSPOctreeBakedIndex::FixupActorPathsForPIE(int32 inPIEInstanceID)
+{
+	for (FSoftObjectPath& actorPath : ElementActorPaths)
+	{
+		actorPath.FixupForPIE(inPIEInstanceID);
+	}
+	BuildActorPathIndices();
+}
+#endif
+
+void FSPOctreeBakedIndex::ResolveAllActors() const
+{
+	check(IsInGameThread());
+
+	bool bActorsChanged = ElementActorRefs.Num() != Elements.Num();
+	if (bHasUnresolvedActors)
+	{
+		// Actors in levels or cells that are not loaded yet stay unresolved and are tried again on the next call
+		bHasUnresolvedActors = false;
+		for (int32 elementIndex = 0; elementIndex < Elements.Num(); elementIndex++)
+		{
+			if (Elements[elementIndex].MyActor == nullptr && !ElementActorPaths[elementIndex].IsNull())
+			{
+				bActorsChanged |= ResolveElement(elementIndex).MyActor != nullptr;
+				bHasUnresolvedActors |= Elements[elementIndex].MyActor == nullptr;
+			}
+		}
+	}
+
+	if (bActorsChanged)
+	{
+		ElementActorRefs.Reset(Elements.Num());
+		for (const FSPOctreeElement& element : Elements)
+		{
+			ElementActorRefs.Emplace(element.MyActor.Get());
+		}
+	}
+}
+
+void FSPOctreeBakedIndex::StoreActorRefs(const TMap<const AActor*, TWeakObjectPtr<AActor>>& inActorRefs)
+{
+	ElementActorRefs.Reset(Elements.Num());
+	for (const FSPOctreeElement& element : Elements)
+	{
+		const TWeakObjectPtr<AActor>* actorRef = inActorRefs.Find(element.MyActor.Get());
+		ElementActorRefs.Add(actorRef ? *actorRef : TWeakObjectPtr<AActor>());
+	}
+}
+
+bool FSPOctreeBakedIndex::ContainsActor(const AActor* inActor) const
+{
+	if (inActor == nullptr)
+	{
+		return false;
+	}
+
+	// Saved and loaded indices answer from their paths, resolved or not
+	if (ElementActorPathIndices.Num() > 0)
+	{
+		return ElementActorPathIndices.Contains(FSoftObjectPath(inActor));
+	}
+	return Elements.ContainsByPredicate([inActor](const FSPOctreeElement& Element) { return Element.MyActor == inActor; });
+}
+
+const FSoftObjectPath& FSPOctreeBakedIndex::GetElementActorPath(int32 inElementIndex) const
+{
+	static const FSoftObjectPath noActorPath;
+	return ElementActorPaths.IsValidIndex(inElementIndex) ? ElementActorPaths[inElementIndex] : noActorPath;
+}
+
+const FSPOctreeElement& FSPOctreeBakedIndex::ResolveElement(int32 inElementIndex) const
+{
+	// Worker threads only read, they see actors resolved before the index was handed to them
+	FSPOctreeElement& element = Elements[inElementIndex];
+	if (IsInGameThread())
+	{
+		element.MyActor = Cast<AActor>(ElementActorPaths[inElementIndex].ResolveObject());
+	}
+	return element;
+}
+
+void FSPOctreeBakedIndex::ForEachElementWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TFunctionRef<void(int32)> inVisitor) const
+{
+	const FVector3f queryCenter = FVector3f(inBoundingBoxQuery.Origin - Origin);
+	const FVector3f queryExtent = FVector3f(inBoundingBoxQuery.BoxExtent);
+	const float sphereRadius = inBoundingBoxQuery.SphereRadius;
+
+	// Every match lies inside the box around the query sphere, or inside the query box when it is tested too
+	const FVector3f regionExtent = bSphereOnlyTest ? FVector3f(sphereRadius) : FVector3f(sphereRadius).ComponentMax(queryExtent);
+
+	FSPOctreeQueryCounters queryCounters;
+	const int32 numNodes = NodeSubtreeEnd.Num();
+	int32 nodeIndex = 0;
+	while (nodeIndex < numNodes)
+	{
+		if (FMath::Abs(NodeCenterX[nodeIndex] - queryCenter.X) > NodeExtentX[nodeIndex] + regionExtent.X
+			|| FMath::Abs(NodeCenterY[nodeIndex] - queryCenter.Y) > NodeExtentY[nodeIndex] + regionExtent.Y
+			|| FMath::Abs(NodeCenterZ[nodeIndex] - queryCenter.Z) > NodeExtentZ[nodeIndex] + regionExtent.Z)
+		{
+			nodeIndex = NodeSubtreeEnd[nodeIndex];
+			continue;
+		}
+
+		queryCounters.AddNode();
+		if (NodeNumElements[nodeIndex] > 0)
+		{
+			TestElements(NodeFirstElement[nodeIndex], NodeNumElements[nodeIndex], queryCenter, queryExtent, sphereRadius, bSphereOnlyTest, queryCounters, inVisitor);
+		}
+		nodeIndex++;
+	}
+}
+
+void FSPOctreeBakedIndex::ForEachElementInCapsule(const FVector& inStart, const FVector& inEnd, const float inRadius, TFunctionRef<void(int32)> inVisitor) const
+{
+	const FVector start = inStart - Origin;
+	const FVector end = inEnd - Origin;
+	const FVector direction = end - start;
+	const double radiusSquared = FMath::Square((double)inRadius);
+
+	FSPOctreeQueryCounters queryCounters;
+	const int32 numNodes = NodeSubtreeEnd.Num();
+	int32 nodeIndex = 0;
+	while (nodeIndex < numNodes)
+	{
+		// The capsule touches a node only if the segment crosses the node box grown by the radius
+		const FVector nodeCenter = FVector(NodeCenterX[nodeIndex], NodeCenterY[nodeIndex], NodeCenterZ[nodeIndex]);
+		const FVector nodeExtent = FVector(NodeExtentX[nodeIndex], NodeExtentY[nodeIndex], NodeExtentZ[nodeIndex]) + FVector(inRadius);
+		double entryTime = 0.0;
+		if (IsNodeEmpty(nodeIndex) || !SPOctreeMath::SegmentIntersectsBox(start, direction, FBox(nodeCenter - nodeExtent, nodeCenter + nodeExtent), entryTime))
+		{
+			nodeIndex = NodeSubtreeEnd[nodeIndex];
+			continue;
+		}
+
+		queryCounters.AddNode();
+		queryCounters.AddElementsTested(NodeNumElements[nodeIndex]);
+		const int32 endElement = NodeFirstElement[nodeIndex] + NodeNumElements[nodeIndex];
+		for (int32 elementIndex = NodeFirstElement[nodeIndex]; elementIndex < endElement; elementIndex++)
+		{
+			const FVector elementCenter = FVector(ElementCenterX[elementIndex], ElementCenterY[elementIndex], ElementCenterZ[elementIndex]);
+			if (FMath::PointDistToSegmentSquared(elementCenter, start, end) <= radiusSquared)
+			{
+				queryCounters.AddHits(1);
+				inVisitor(elementIndex);
+			}
+		}
+		nodeIndex++;
+	}
+}
+
+FBox FSPOctreeBakedIndex::GetLeafBoundsAt(const FVector& inPoint) const
+{
+	const int32 numNodes = NodeSubtreeEnd.Num();
+	if (numNodes == 0 || IsNodeEmpty(0) || !GetNodeBox(0).IsInside(inPoint))
+	{
+		return FBox(ForceInit);
+	}
+
+	// Step down into the first child containing the point until none does
+	int32 nodeIndex = 0;
+	int32 childIndex = 1;
+	while (childIndex < NodeSubtreeEnd[nodeIndex])
+	{
+		if (!IsNodeEmpty(childIndex) && GetNodeBox(childIndex).IsInside(inPoint))
+		{
+			nodeIndex = childIndex;
+			childIndex = nodeIndex + 1;
+		}
+		else
+		{
+			childIndex = NodeSubtreeEnd[childIndex];
+		}
+	}
+	return GetNodeBox(nodeIndex);
+}
+
+void FSPOctreeBakedIndex::QueryBatch(TConstArrayView<FSPOctreeQuery> inQueries, FSPOctreeQueryResults& OutResults) const
+{
+	const int32 numQueries = inQueries.Num();
+
+	struct FBakedQuery
+	{
+		FVector3f Center;
+		FVector3f Extent;
+		FVector3f RegionExtent;
+		float SphereRadius;
+		bool bSphereOnlyTest;
+	};
+	TArray<FBakedQuery, TInlineAllocator<16>> bakedQueries;
+	bakedQueries.Reserve(numQueries);
+	for (const FSPOctreeQuery& query : inQueries)
+	{
+		const float sphereRadius = query.Bounds.SphereRadius;
+		const FVector3f queryExtent = FVector3f(query.Bounds.BoxExtent);
+		bakedQueries.Add({ FVector3f(query.Bounds.Origin - Origin), queryExtent,
+			query.bSphereOnlyTest ? FVector3f(sphereRadius) : FVector3f(sphereRadius).ComponentMax(queryExtent), sphereRadius, query.bSphereOnlyTest });
+	}
+
+	auto intersectsNode = [this, &bakedQueries](int32 QueryIndex, int32 NodeIndex)
+	{
+		const FBakedQuery& query = bakedQueries[QueryIndex];
+		return FMath::Abs(NodeCenterX[NodeIndex] - query.Center.X) <= NodeExtentX[NodeIndex] + query.RegionExtent.X
+			&& FMath::Abs(NodeCenterY[NodeIndex] - query.Center.Y) <= NodeExtentY[NodeIndex] + query.RegionExtent.Y
+			&& FMath::Abs(NodeCenterZ[NodeIndex] - query.Center.Z) <= NodeExtentZ[NodeIndex] + query.RegionExtent.Z;
+	};
+
+	// Nodes on the path from the root to the current node, each with the range of activeQueries still overlapping it
+	struct FActiveLevel
+	{
+		int32 SubtreeEnd;
+		int32 FirstQuery;
+		int32 NumQueries;
+	};
+	TArray<FActiveLevel, TInlineAllocator<FSPOctree::MaxNodeDepth + 1>> activeLevels;
+	TArray<int32, TInlineAllocator<256>> activeQueries;
+	TArray<TPair<int32, int32>> hits;
+	FSPOctreeQueryCounters queryCounters;
+
+	const int32 numNodes = NodeSubtreeEnd.Num();
+	int32 nodeIndex = 0;
+	while (nodeIndex < numNodes)
+	{
+		// Levels whose subtree ends here are finished, the depth first layout never comes back to them
+		while (activeLevels.Num() > 0 && activeLevels.Top().SubtreeEnd <= nodeIndex)
+		{
+			activeQueries.SetNum(activeLevels.Top().FirstQuery, false);
+			activeLevels.Pop(false);
+		}
+
+		const int32 firstQuery = activeQueries.Num();
+		if (activeLevels.Num() == 0)
+		{
+			for (int32 queryIndex = 0; queryIndex < numQueries; queryIndex++)
+			{
+				if (intersectsNode(queryIndex, nodeIndex))
+				{
+					activeQueries.Add(queryIndex);
+				}
+			}
+		}
+		else
+		{
+			const FActiveLevel parentLevel = activeLevels.Top();
+			for (int32 index = parentLevel.FirstQuery; index < parentLevel.FirstQuery + parentLevel.NumQueries; index++)
+			{
+				if (intersectsNode(activeQueries[index], nodeIndex))
+				{
+					activeQueries.Add(activeQueries[index]);
+				}
+			}
+		}
+
+		const int32 numActiveQueries = activeQueries.Num() - firstQuery;
+		if (numActiveQueries == 0)
+		{
+			nodeIndex = NodeSubtreeEnd[nodeIndex];
+			continue;
+		}
+		activeLevels.Add({ NodeSubtreeEnd[nodeIndex], firstQuery, numActiveQueries });
+
+		queryCounters.AddNode();
+		if (NodeNumElements[nodeIndex] > 0)
+		{
+			for (int32 index = firstQuery; index < firstQuery + numActiveQueries; index++)
+			{
+				const int32 queryIndex = activeQueries[index];
+				const FBakedQuery& query = bakedQueries[queryIndex];
+				TestElements(NodeFirstElement[nodeIndex], NodeNumElements[nodeIndex], query.Center, query.Extent, query.SphereRadius, query.bSphereOnlyTest, queryCounters,
+					[&hits, queryIndex](int32 ElementIndex)
+					{
+						hits.Emplace(queryIndex, ElementIndex);
+					});
+			}
+		}
+		nodeIndex++;
+	}
+
+	// Counting sort of the hits by query gives every query one contiguous range
+	OutResults.ResultCount.Reset(numQueries);
+	OutResults.ResultCount.AddZeroed(numQueries);
+	for (const TPair<int32, int32>& hit : hits)
+	{
+		OutResults.ResultCount[hit.Key]++;
+	}
+
+	OutResults.ResultStart.Reset(numQueries);
+	int32 resultStart = 0;
+	for (int32 queryIndex = 0; queryIndex < numQueries; queryIndex++)
+	{
+		OutResults.ResultStart.Add(resultStart);
+		resultStart += OutResults.ResultCount[queryIndex];
+	}
+
+	// Weak references travel with the results when the index has them, so stale actors can be dropped on the game thread
+	const bool bHasActorRefs = ElementActorRefs.Num() == Elements.Num();
+	TArray<int32, TInlineAllocator<16>> writeIndices(OutResults.ResultStart);
+	OutResults.Elements.Reset(hits.Num());
+	OutResults.Elements.SetNum(hits.Num());
+	OutResults.ElementActors.Reset(bHasActorRefs ? hits.Num() : 0);
+	OutResults.ElementActors.SetNum(bHasActorRefs ? hits.Num() : 0);
+	for (const TPair<int32, int32>& hit : hits)
+	{
+		const int32 writeIndex = writeIndices[hit.Key]++;
+		OutResults.Elements[writeIndex] = GetElement(hit.Value);
+		if (bHasActorRefs)
+		{
+			OutResults.ElementActors[writeIndex] = ElementActorRefs[hit.Value];
+		}
+	}
+}
+
+void FSPOctreeBakedIndex::FindNearestElements(const FVector& inPoint, const int32 inMaxCount, const double inMaxDistanceSquared, TFunctionRef<bool(const FSPOctreeElement&)> inFilter, TArray<int32>& OutElementIndices) const
+{
+	OutElementIndices.Reset();
+	if (inMaxCount <= 0 || NodeSubtreeEnd.Num() == 0)
+	{
+		return;
+	}
+
+	struct FCandidate
+	{
+		float DistanceSquared;
+		int32 Index;
+	};
+	auto nearestFirst = [](const FCandidate& A, const FCandidate& B) { return A.DistanceSquared < B.DistanceSquared; };
+	auto furthestFirst = [](const FCandidate& A, const FCandidate& B) { return A.DistanceSquared > B.DistanceSquared; };
+
+	const FVector3f point = FVector3f(inPoint - Origin);
+	const float maxDistanceSquared = (float)FMath::Min(inMaxDistanceSquared, (double)MAX_flt);
+
+	auto nodeDistanceSquared = [this, &point](int32 NodeIndex)
+	{
+		const float deltaX = FMath::Max(FMath::Abs(NodeCenterX[NodeIndex] - point.X) - NodeExtentX[NodeIndex], 0.0f);
+		const float deltaY = FMath::Max(FMath::Abs(NodeCenterY[NodeIndex] - point.Y) - NodeExtentY[NodeIndex], 0.0f);
+		const float deltaZ = FMath::Max(FMath::Abs(NodeCenterZ[NodeIndex] - point.Z) - NodeExtentZ[NodeIndex], 0.0f);
+		return deltaX * deltaX + deltaY * deltaY + deltaZ * deltaZ;
+	};
+
+	TArray<FCandidate, TInlineAllocator<64>> nodeQueue;
+	// Max-heap of the best elements so far, the worst of them on top
+	TArray<FCandidate, TInlineAllocator<16>> bestElements;
+
+	auto searchRadiusSquared = [&bestElements, inMaxCount, maxDistanceSquared]()
+	{
+		return bestElements.Num() == inMaxCount ? bestElements.HeapTop().DistanceSquared : maxDistanceSquared;
+	};
+
+	nodeQueue.HeapPush({ nodeDistanceSquared(0), 0 }, nearestFirst);
+	while (nodeQueue.Num() > 0)
+	{
+		FCandidate node;
+		nodeQueue.HeapPop(node, nearestFirst, false);
+
+		// Every node left in the queue is at least this far away
+		if (node.DistanceSquared > searchRadiusSquared())
+		{
+			break;
+		}
+
+		const int32 endElement = NodeFirstElement[node.Index] + NodeNumElements[node.Index];
+		for (int32 elementIndex = NodeFirstElement[node.Index]; elementIndex < endElement; elementIndex++)
+		{
+			const float deltaX = ElementCenterX[elementIndex] - point.X;
+			const float deltaY = ElementCenterY[elementIndex] - point.Y;
+			const float deltaZ = ElementCenterZ[elementIndex] - point.Z;
+			const float distanceSquared = deltaX * deltaX + deltaY * deltaY + deltaZ * deltaZ;
+
+			if (distanceSquared <= searchRadiusSquared() && (bestElements.Num() < inMaxCount || distanceSquared < bestElements.HeapTop().DistanceSquared) && inFilter(GetElement(elementIndex)))
+			{
+				bestElements.HeapPush({ distanceSquared, elementIndex }, furthestFirst);
+				if (bestElements.Num() > inMaxCount)
+				{
+					bestElements.HeapPopDiscard(furthestFirst, false);
+				}
+			}
+		}
+
+		// Children follow their parent, each sibling starts where the subtree of the previous one ends
+		for (int32 childIndex = node.Index + 1; childIndex < NodeSubtreeEnd[node.Index]; childIndex = NodeSubtreeEnd[childIndex])
+		{
+			const float childDistanceSquared = nodeDistanceSquared(childIndex);
+			if (childDistanceSquared <= searchRadiusSquared())
+			{
+				nodeQueue.HeapPush({ childDistanceSquared, childIndex }, nearestFirst);
+			}
+		}
+	}
+
+	bestElements.Sort(nearestFirst);
+	OutElementIndices.Reserve(bestElements.Num());
+	for (const FCandidate& candidate : bestElements)
+	{
+		OutElementIndices.Add(candidate.Index);
+	}
+}
+
+void FSPOctreeBakedIndex::LineTrace(const FVector& inStart, const FVector& inEnd, const bool bFirstHitOnly, TArray<TPair<double, int32>>& OutHits) const
+{
+	OutHits.Reset();
+	if (NodeSubtreeEnd.Num() == 0)
+	{
+		return;
+	}
+
+	typedef TPair<double, int32> FCandidate;
+	auto earliestFirst = [](const FCandidate& A, const FCandidate& B) { return A.Key < B.Key; };
+
+	const FVector direction = inEnd - inStart;
+	double nearestHitTime = TNumericLimits<double>::Max();
+
+	TArray<FCandidate, TInlineAllocator<64>> nodeQueue;
+	double rootEntryTime = 0.0;
+	if (!IsNodeEmpty(0) && SPOctreeMath::SegmentIntersectsBox(inStart, direction, GetNodeBox(0), rootEntryTime))
+	{
+		nodeQueue.HeapPush(FCandidate(rootEntryTime, 0), earliestFirst);
+	}
+
+	while (nodeQueue.Num() > 0)
+	{
+		FCandidate node;
+		nodeQueue.HeapPop(node, earliestFirst, false);
+
+		// Every node left in the queue is entered after the nearest hit
+		if (bFirstHitOnly && node.Key > nearestHitTime)
+		{
+			break;
+		}
+
+		const int32 endElement = NodeFirstElement[node.Value] + NodeNumElements[node.Value];
+		for (int32 elementIndex = NodeFirstElement[node.Value]; elementIndex < endElement; elementIndex++)
+		{
+			const FVector center = Origin + FVector(ElementCenterX[elementIndex], ElementCenterY[elementIndex], ElementCenterZ[elementIndex]);
+			const FVector extent = FVector(ElementExtentX[elementIndex], ElementExtentY[elementIndex], ElementExtentZ[elementIndex]);
+			double entryTime = 0.0;
+			if (SPOctreeMath::SegmentIntersectsBox(inStart, direction, FBox(center - extent, center + extent), entryTime))
+			{
+				OutHits.Add(FCandidate(entryTime, elementIndex));
+				nearestHitTime = FMath::Min(nearestHitTime, entryTime);
+			}
+		}
+
+		for (int32 childIndex = node.Value + 1; childIndex < NodeSubtreeEnd[node.Value]; childIndex = NodeSubtreeEnd[childIndex])
+		{
+			double entryTime = 0.0;
+			if (!IsNodeEmpty(childIndex) && SPOctreeMath::SegmentIntersectsBox(inStart, direction, GetNodeBox(childIndex), entryTime) && (!bFirstHitOnly || entryTime <= nearestHitTime))
+			{
+				nodeQueue.HeapPush(FCandidate(entryTime, childIndex), earliestFirst);
+			}
+		}
+	}
+
+	OutHits.Sort(earliestFirst);
+	if (bFirstHitOnly && OutHits.Num() > 1)
+	{
+		OutHits.SetNum(1);
+	}
+}
+
+void FSPOctreeBakedIndex::ForEachElementInConvexVolume(const FConvexVolume& inVolume, TFunctionRef<void(int32)> inVisitor) const
+{
+	const int32 numNodes = NodeSubtreeEnd.Num();
+	int32 nodeIndex = 0;
+	while (nodeIndex < numNodes)
+	{
+		bool bFullyContained = false;
+		const FVector nodeCenter = Origin + FVector(NodeCenterX[nodeIndex], NodeCenterY[nodeIndex], NodeCenterZ[nodeIndex]);
+		const FVector nodeExtent = FVector(NodeExtentX[nodeIndex], NodeExtentY[nodeIndex], NodeExtentZ[nodeIndex]);
+		if (IsNodeEmpty(nodeIndex) || !inVolume.IntersectBox(nodeCenter, nodeExtent, bFullyContained))
+		{
+			nodeIndex = NodeSubtreeEnd[nodeIndex];
+			continue;
+		}
+
+		if (bFullyContained)
+		{
+			const int32 subtreeEnd = NodeSubtreeEnd[nodeIndex];
+			const int32 endElement = subtreeEnd < numNodes ? NodeFirstElement[subtreeEnd] : Elements.Num();
+			for (int32 elementIndex = NodeFirstElement[nodeIndex]; elementIndex < endElement; elementIndex++)
+			{
+				inVisitor(elementIndex);
+			}
+			nodeIndex = subtreeEnd;
+			continue;
+		}
+
+		const int32 endElement = NodeFirstElement[nodeIndex] + NodeNumElements[nodeIndex];
+		for (int32 elementIndex = NodeFirstElement[nodeIndex]; elementIndex < endElement; elementIndex++)
+		{
+			const FVector center = Origin + FVector(ElementCenterX[elementIndex], ElementCenterY[elementIndex], ElementCenterZ[elementIndex]);
+			const FVector extent = FVector(ElementExtentX[elementIndex], ElementExtentY[elementIndex], ElementExtentZ[elementIndex]);
+			if (inVolume.IntersectBox(center, extent))
+			{
+				inVisitor(elementIndex);
+			}
+		}
+		nodeIndex++;
+	}
+}
+
+void FSPOctreeBakedIndex::TestElements(int32 inFirstElement, int32 inNumElements, const FVector3f& inQueryCenter, const FVector3f& inQueryExtent, const float inSphereRadius, const bool bSphereOnlyTest, FSPOctreeQueryCounters& inCounters, TFunctionRef<void(int32)> inVisitor) const
+{
+	inCounters.AddElementsTested(inNumElements);
+
+	const VectorRegister4Float queryCenterX = VectorSetFloat1(inQueryCenter.X);
+	const VectorRegister4Float queryCenterY = VectorSetFloat1(inQueryCenter.Y);
+	const VectorRegister4Float queryCenterZ = VectorSetFloat1(inQueryCenter.Z);
+	const VectorRegister4Float queryExtentX = VectorSetFloat1(inQueryExtent.X);
+	const VectorRegister4Float queryExtentY = VectorSetFloat1(inQueryExtent.Y);
+	const VectorRegister4Float queryExtentZ = VectorSetFloat1(inQueryExtent.Z);
+	const VectorRegister4Float radiusSquared = VectorSetFloat1(inSphereRadius * inSphereRadius);
+
+	const int32 endElement = inFirstElement + inNumElements;
+	for (int32 groupStart = inFirstElement; groupStart < endElement; groupStart += 4)
+	{
+		const VectorRegister4Float deltaX = VectorSubtract(VectorLoad(ElementCenterX.GetData() + groupStart), queryCenterX);
+		const VectorRegister4Float deltaY = VectorSubtract(VectorLoad(ElementCenterY.GetData() + groupStart), queryCenterY);
+		const VectorRegister4Float deltaZ = VectorSubtract(VectorLoad(ElementCenterZ.GetData() + groupStart), queryCenterZ);
+
+		const VectorRegister4Float distanceSquared = VectorMultiplyAdd(deltaX, deltaX, VectorMultiplyAdd(deltaY, deltaY, VectorMultiply(deltaZ, deltaZ)));
+		VectorRegister4Float hits = VectorCompareLE(distanceSquared, radiusSquared);
+
+		if (!bSphereOnlyTest)
+		{
+			const VectorRegister4Float overlapX = VectorCompareLE(VectorAbs(deltaX), VectorAdd(VectorLoad(ElementExtentX.GetData() + groupStart), queryExtentX));
+			const VectorRegister4Float overlapY = VectorCompareLE(VectorAbs(deltaY), VectorAdd(VectorLoad(ElementExtentY.GetData() + groupStart), queryExtentY));
+			const VectorRegister4Float overlapZ = VectorCompareLE(VectorAbs(deltaZ), VectorAdd(VectorLoad(ElementExtentZ.GetData() + groupStart), queryExtentZ));
+			hits = VectorBitwiseOr(hits, VectorBitwiseAnd(overlapX, VectorBitwiseAnd(overlapY, overlapZ)));
+		}
+
+		// Lanes past the end of the node belong to the next node or the padding
+		const uint32 laneMask = (1u << FMath::Min(endElement - groupStart, 4)) - 1u;
+		uint32 hitMask = (uint32)VectorMaskBits(hits) & laneMask;
+		inCounters.AddHits(FMath::CountBits(hitMask));
+		while (hitMask != 0)
+		{
+			inVisitor(groupStart + (int32)FMath::CountTrailingZeros(hitMask));
+			hitMask &= hitMask - 1;
+		}
+	}
+}
+
+SIZE_T FSPOctreeBakedIndex::GetAllocatedSize() const
+{
+	return NodeCenterX.GetAllocatedSize() + NodeCenterY.GetAllocatedSize() + NodeCenterZ.GetAllocatedSize()
+		+ NodeExtentX.GetAllocatedSize() + NodeExtentY.GetAllocatedSize() + NodeExtentZ.GetAllocatedSize()
+		+ NodeSubtreeEnd.GetAllocatedSize() + NodeFirstElement.GetAllocatedSize() + NodeNumElements.GetAllocatedSize()
+		+ ElementCenterX.GetAllocatedSize() + ElementCenterY.GetAllocatedSize() + ElementCenterZ.GetAllocatedSize()
+		+ ElementExtentX.GetAllocatedSize() + ElementExtentY.GetAllocatedSize() + ElementExtentZ.GetAllocatedSize()
+		+ Elements.GetAllocatedSize() + ElementActorRefs.GetAllocatedSize() + ElementActorPaths.GetAllocatedSize() + ElementActorPathIndices.GetAllocatedSize();
+}
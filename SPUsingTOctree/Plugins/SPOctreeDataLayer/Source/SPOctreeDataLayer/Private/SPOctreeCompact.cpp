@@ -0,0 +1,100 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SPOctreeCompact.h"
+
+FSPOctreeCompactFrame::FSPOctreeCompactFrame(const FVector& inOrigin, const double inRootExtent)
+{
+	Origin = inOrigin;
+	Extent = inRootExtent * 2.0;
+	QuantizationStep = (Extent * 2.0) / MAX_uint16;
+	InverseQuantizationStep = 1.0 / QuantizationStep;
+}
+
+bool FSPOctreeCompactFrame::Contains(const FBox& inBox) const
+{
+	return FBox(Origin - FVector(Extent), Origin + FVector(Extent)).IsInside(inBox);
+}
+
+int32 FSPOctreeActorRegistry::Add(AActor* inActor)
+{
+	if (inActor)
+	{
+		if (const int32* existingIndex = ActorIndices.Find(inActor))
+		{
+			return *existingIndex;
+		}
+	}
+
+	int32 index;
+	if (FreeIndices.Num() > 0)
+	{
+		index = FreeIndices.Pop(false);
+		Actors[index] = inActor;
+		ElementIds[index] = FOctreeElementId2();
+	}
+	else
+	{
+		index = Actors.Add(inActor);
+		ElementIds.AddDefaulted();
+	}
+
+	if (inActor)
+	{
+		ActorIndices.Add(inActor, index);
+	}
+	return index;
+}
+
+bool FSPOctreeActorRegistry::Remove(const AActor* inActor)
+{
+	const int32 index = Find(inActor);
+	if (index == INDEX_NONE)
+	{
+		return false;
+	}
+	RemoveAt(index);
+	return true;
+}
+
+void FSPOctreeActorRegistry::RemoveAt(const int32 inIndex)
+{
+	if (!Actors.IsValidIndex(inIndex))
+	{
+		return;
+	}
+
+	ActorIndices.Remove(Actors[inIndex]);
+	Actors[inIndex] = TObjectKey<AActor>();
+	ElementIds[inIndex] = FOctreeElementId2();
+	FreeIndices.Add(inIndex);
+}
+
+int32 FSPOctreeActorRegistry::Find(const AActor* inActor) const
+{
+	const int32* index = inActor ? ActorIndices.Find(inActor) : nullptr;
+	return index ? *index : INDEX_NONE;
+}
+
+int32 FSPOctreeActorRegistry::Num() const
+{
+	return Actors.Num() - FreeIndices.Num();
+}
+
+SIZE_T FSPOctreeActorRegistry::GetAllocatedSize() const
+{
+	return Actors.GetAllocatedSize() + ElementIds.GetAllocatedSize() + FreeIndices.GetAllocatedSize() + ActorIndices.GetAllocatedSize();
+}
+
+void FSPOctreeActorRegistry::Reset()
+{
+	Actors.Reset();
+	ElementIds.Reset();
+	FreeIndices.Reset();
+	ActorIndices.Reset();
+}
+
+FSPOctreeCompactContext*& FSPOctreeCompactContext::Current()
+{
+	static thread_local FSPOctreeCompactContext* CurrentContext = nullptr;
+	return CurrentContext;
+}
@@ -1,8 +1,22 @@
 #include "SPOctreeDataLayer.h"
+#include "SPOctreeStats.h"
 
 #define LOCTEXT_NAMESPACE "FSPOctreeDataLayerModule"
 DEFINE_LOG_CATEGORY(SPOctreeDataLayerMod);
 
+DEFINE_STAT(STAT_SPOctree_Add);
+DEFINE_STAT(STAT_SPOctree_Query);
+DEFINE_STAT(STAT_SPOctree_StreamingDiff);
+DEFINE_STAT(STAT_SPOctree_StreamingTransitions);
+DEFINE_STAT(STAT_SPOctree_NodesVisited);
+DEFINE_STAT(STAT_SPOctree_ElementsTested);
+DEFINE_STAT(STAT_SPOctree_Hits);
+DEFINE_STAT(STAT_SPOctree_Transitions);
+
+CSV_DEFINE_CATEGORY_MODULE(SPOCTREEDATALAYER_API, SPOctree, true);
+
+UE_TRACE_CHANNEL_DEFINE(SPOctreeChannel);
+
 void FSPOctreeDataLayerModule::StartupModule()
 {
 }
@@ -0,0 +1,322 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SPOctreeGrid.h"
+#include "SPOctreeDataLayer.h"
+#include "Engine/World.h"
+
+ASPOctreeGrid::ASPOctreeGrid(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	PrimaryActorTick.bCanEverTick = false;
+
+	PrintLogs = false;
+	CellExtent = 100000.0f;
+	bDrawDebugInfo = false;
+}
+
+void ASPOctreeGrid::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	for (const TPair<FIntVector, TObjectPtr<ASPOctree>>& cell : Cells)
+	{
+		if (IsValid(cell.Value))
+		{
+			cell.Value->Destroy();
+		}
+	}
+	Cells.Reset();
+	ActorCells.Reset();
+	OverflowElements.Reset();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void ASPOctreeGrid::AddActorToOctree(AActor* inActor, const bool inHiddenInGame)
+{
+	if (inActor == nullptr)
+	{
+		return;
+	}
+
+	// An actor already in the grid only has its bounds re-read, which moves it if it left its cell
+	if (ContainsActor(inActor))
+	{
+		inActor->SetActorHiddenInGame(inHiddenInGame);
+		inActor->SetActorEnableCollision(!inHiddenInGame);
+		UpdateActorBounds(inActor);
+		return;
+	}
+
+	const FBoxSphereBounds actorBounds = ASPOctree::GetActorElementBounds(inActor);
+	if (IsOversized(actorBounds))
+	{
+		OverflowElements.Add(FSPOctreeElement(inActor, actorBounds));
+		inActor->SetActorHiddenInGame(inHiddenInGame);
+		inActor->SetActorEnableCollision(!inHiddenInGame);
+		if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("ASPOctreeGrid::AddActorToOctree: [%s] larger than a cell, added to the overflow list."), *(inActor->GetActorNameOrLabel()));
+		return;
+	}
+
+	const FIntVector cellCoordinates = GetCellCoordinates(actorBounds.Origin);
+	if (ASPOctree* cell = FindOrCreateCell(cellCoordinates))
+	{
+		cell->AddActorToOctree(inActor, inHiddenInGame);
+		ActorCells.Add(inActor, cellCoordinates);
+	}
+}
+
+void ASPOctreeGrid::AddActorsToOctree(const TArray<AActor*>& inActors, const bool inHiddenInGame)
+{
+	TMap<FIntVector, TArray<AActor*>> cellActors;
+	for (AActor* actor : inActors)
+	{
+		if (actor == nullptr)
+		{
+			continue;
+		}
+
+		const FBoxSphereBounds actorBounds = ASPOctree::GetActorElementBounds(actor);
+		if (IsOversized(actorBounds) || ContainsActor(actor))
+		{
+			AddActorToOctree(actor, inHiddenInGame);
+			continue;
+		}
+		cellActors.FindOrAdd(GetCellCoordinates(actorBounds.Origin)).Add(actor);
+	}
+
+	for (const TPair<FIntVector, TArray<AActor*>>& batch : cellActors)
+	{
+		if (ASPOctree* cell = FindOrCreateCell(batch.Key))
+		{
+			cell->AddActorsToOctree(batch.Value, inHiddenInGame);
+			for (AActor* actor : batch.Value)
+			{
+				ActorCells.Add(actor, batch.Key);
+			}
+		}
+	}
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("ASPOctreeGrid::AddActorsToOctree: %d actors in %d cells, cells: %d overflow: %d"), inActors.Num(), cellActors.Num(), Cells.Num(), OverflowElements.Num());
+}
+
+bool ASPOctreeGrid::RemoveActorFromOctree(AActor* inActor)
+{
+	if (inActor == nullptr)
+	{
+		return false;
+	}
+
+	FIntVector cellCoordinates;
+	if (ActorCells.RemoveAndCopyValue(inActor, cellCoordinates))
+	{
+		const TObjectPtr<ASPOctree>* cell = Cells.Find(cellCoordinates);
+		return cell && IsValid(*cell) && (*cell)->RemoveActorFromOctree(inActor);
+	}
+
+	return OverflowElements.RemoveAll([inActor](const FSPOctreeElement& Element) { return Element.MyActor == inActor; }) > 0;
+}
+
+bool ASPOctreeGrid::UpdateActorBounds(AActor* inActor)
+{
+	if (!ContainsActor(inActor))
+	{
+		return false;
+	}
+
+	const FBoxSphereBounds actorBounds = ASPOctree::GetActorElementBounds(inActor);
+	const FIntVector* cellCoordinates = ActorCells.Find(inActor);
+	if (cellCoordinates && !IsOversized(actorBounds) && *cellCoordinates == GetCellCoordinates(actorBounds.Origin))
+	{
+		return Cells.FindChecked(*cellCoordinates)->UpdateActorBounds(inActor);
+	}
+
+	if (cellCoordinates == nullptr && IsOversized(actorBounds))
+	{
+		for (FSPOctreeElement& element : OverflowElements)
+		{
+			if (element.MyActor == inActor)
+			{
+				element.BoxSphereBounds = actorBounds;
+			}
+		}
+		return true;
+	}
+
+	// The actor changed cell, or moved between a cell and the overflow list
+	const bool bHidden = inActor->IsHidden();
+	RemoveActorFromOctree(inActor);
+	AddActorToOctree(inActor, bHidden);
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("ASPOctreeGrid::UpdateActorBounds: [%s] moved to another cell."), *(inActor->GetActorNameOrLabel()));
+	return true;
+}
+
+bool ASPOctreeGrid::ContainsActor(AActor* inActor) const
+{
+	return inActor && (ActorCells.Contains(inActor) || OverflowElements.ContainsByPredicate([inActor](const FSPOctreeElement& Element) { return Element.MyActor == inActor; }));
+}
+
+void ASPOctreeGrid::ForEachElementWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TFunctionRef<void(const FSPOctreeElement&)> inVisitor) const
+{
+	const FBox queryBox = inBoundingBoxQuery.GetBox();
+	const FSphere querySphere = inBoundingBoxQuery.GetSphere();
+	const FBox sphereBox = FBox(querySphere.Center - FVector(querySphere.W), querySphere.Center + FVector(querySphere.W));
+
+	ForEachCellInRegion(bSphereOnlyTest ? sphereBox : queryBox + sphereBox, [&inBoundingBoxQuery, &inVisitor, bSphereOnlyTest](ASPOctree& Cell)
+		{
+			Cell.ForEachElementWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, inVisitor);
+		});
+
+	for (const FSPOctreeElement& element : OverflowElements)
+	{
+		if (querySphere.IsInside(element.BoxSphereBounds.Origin) || (!bSphereOnlyTest && queryBox.Intersect(element.BoxSphereBounds.GetBox())))
+		{
+			inVisitor(element);
+		}
+	}
+}
+
+void ASPOctreeGrid::GetElementsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TArray<FSPOctreeElement>& OutElements) const
+{
+	OutElements.Reset();
+	ForEachElementWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, [&OutElements](const FSPOctreeElement& octElement)
+		{
+			OutElements.Add(octElement);
+		});
+}
+
+void ASPOctreeGrid::GetAllActorsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, TSubclassOf<AActor> ActorClass, TArray<AActor*>& OutActors, const bool bSphereOnlyTest)
+{
+	OutActors.Reset();
+
+	const FBox queryBox = inBoundingBoxQuery.GetBox();
+	const FSphere querySphere = inBoundingBoxQuery.GetSphere();
+	const FBox sphereBox = FBox(querySphere.Center - FVector(querySphere.W), querySphere.Center + FVector(querySphere.W));
+	UClass* actorClass = ActorClass.Get();
+
+	ForEachCellInRegion(bSphereOnlyTest ? sphereBox : queryBox + sphereBox, [&inBoundingBoxQuery, &OutActors, actorClass, bSphereOnlyTest](ASPOctree& Cell)
+		{
+			Cell.ForEachActorWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, actorClass, NAME_None, [&OutActors](AActor* Actor)
+				{
+					OutActors.Add(Actor);
+				});
+		});
+
+	for (const FSPOctreeElement& element : OverflowElements)
+	{
+		if (element.MyActor && (actorClass == nullptr || element.MyActor->IsA(actorClass))
+			&& (querySphere.IsInside(element.BoxSphereBounds.Origin) || (!bSphereOnlyTest && queryBox.Intersect(element.BoxSphereBounds.GetBox()))))
+		{
+			OutActors.Add(element.MyActor);
+		}
+	}
+
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("ASPOctreeGrid::GetAllActorsWithinBounds OutActors: %d"), OutActors.Num());
+}
+
+void ASPOctreeGrid::GetCellOctrees(TArray<ASPOctree*>& OutCells) const
+{
+	OutCells.Reset(Cells.Num());
+	for (const TPair<FIntVector, TObjectPtr<ASPOctree>>& cell : Cells)
+	{
+		OutCells.Add(cell.Value);
+	}
+}
+
+ASPOctree* ASPOctreeGrid::GetCellOctreeAt(const FVector& inPoint) const
+{
+	const TObjectPtr<ASPOctree>* cell = Cells.Find(GetCellCoordinates(inPoint));
+	return cell ? cell->Get() : nullptr;
+}
+
+int32 ASPOctreeGrid::GetNumOverflowElements() const
+{
+	return OverflowElements.Num();
+}
+
+FIntVector ASPOctreeGrid::GetCellCoordinates(const FVector& inPoint) const
+{
+	const double cellSize = CellExtent * 2.0;
+	return FIntVector(FMath::FloorToInt(inPoint.X / cellSize), FMath::FloorToInt(inPoint.Y / cellSize), FMath::FloorToInt(inPoint.Z / cellSize));
+}
+
+FBox ASPOctreeGrid::GetCellOctreeBounds(const FIntVector& inCell) const
+{
+	const double cellSize = CellExtent * 2.0;
+	const FVector cellCenter = (FVector(inCell) + FVector(0.5)) * cellSize;
+	return FBox(cellCenter - FVector(cellSize), cellCenter + FVector(cellSize));
+}
+
+ASPOctree* ASPOctreeGrid::FindOrCreateCell(const FIntVector& inCell)
+{
+	if (const TObjectPtr<ASPOctree>* cell = Cells.Find(inCell))
+	{
+		return *cell;
+	}
+
+	UWorld* world = GetWorld();
+	if (world == nullptr)
+	{
+		return nullptr;
+	}
+
+	const FBox cellBounds = GetCellOctreeBounds(inCell);
+	FActorSpawnParameters spawnParameters;
+	spawnParameters.Owner = this;
+	spawnParameters.ObjectFlags |= RF_Transient;
+	ASPOctree* cell = world->SpawnActor<ASPOctree>(ASPOctree::StaticClass(), cellBounds.GetCenter(), FRotator::ZeroRotator, spawnParameters);
+	if (cell == nullptr)
+	{
+		return nullptr;
+	}
+
+	cell->PrintLogs = PrintLogs;
+	cell->Initialize(cellBounds, bDrawDebugInfo);
+	Cells.Add(inCell, cell);
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("ASPOctreeGrid::FindOrCreateCell: cell (%d, %d, %d) created, cells: %d"), inCell.X, inCell.Y, inCell.Z, Cells.Num());
+
+	OnCellCreated.Broadcast(cell);
+	return cell;
+}
+
+bool ASPOctreeGrid::IsOversized(const FBoxSphereBounds& inBounds) const
+{
+	return inBounds.BoxExtent.GetMax() > CellExtent;
+}
+
+void ASPOctreeGrid::ForEachCellInRegion(const FBox& inRegion, TFunctionRef<void(ASPOctree&)> inVisitor) const
+{
+	const FBox region = inRegion.ExpandBy(CellExtent);
+	const FIntVector minCell = GetCellCoordinates(region.Min);
+	const FIntVector maxCell = GetCellCoordinates(region.Max);
+	const int64 numRegionCells = (int64)(maxCell.X - minCell.X + 1) * (maxCell.Y - minCell.Y + 1) * (maxCell.Z - minCell.Z + 1);
+
+	// Small regions look their cells up, large ones scan the cells that exist
+	if (numRegionCells <= Cells.Num())
+	{
+		for (int32 z = minCell.Z; z <= maxCell.Z; z++)
+		{
+			for (int32 y = minCell.Y; y <= maxCell.Y; y++)
+			{
+				for (int32 x = minCell.X; x <= maxCell.X; x++)
+				{
+					const TObjectPtr<ASPOctree>* cell = Cells.Find(FIntVector(x, y, z));
+					if (cell && IsValid(*cell))
+					{
+						inVisitor(**cell);
+					}
+				}
+			}
+		}
+		return;
+	}
+
+	for (const TPair<FIntVector, TObjectPtr<ASPOctree>>& cell : Cells)
+	{
+		if (IsValid(cell.Value)
+			&& cell.Key.X >= minCell.X && cell.Key.X <= maxCell.X
+			&& cell.Key.Y >= minCell.Y && cell.Key.Y <= maxCell.Y
+			&& cell.Key.Z >= minCell.Z && cell.Key.Z <= maxCell.Z)
+		{
+			inVisitor(*cell.Value);
+		}
+	}
+}
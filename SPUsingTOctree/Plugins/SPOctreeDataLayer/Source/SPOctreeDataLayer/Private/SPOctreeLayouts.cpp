@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SPOctree.h"
+
+FSPOctree::FSPOctree(const FVector& inOrigin, const FVector::FReal inExtent, const ESPOctreeLayout inLayout)
+	: Layout(inLayout)
+{
+	switch (inLayout)
+	{
+	case ESPOctreeLayout::Dense:
+		Tree = MakeUnique<TSPOctreeLayoutTree<FSPOctreeDenseSemantics>>(inOrigin, inExtent);
+		break;
+	case ESPOctreeLayout::Sparse:
+		Tree = MakeUnique<TSPOctreeLayoutTree<FSPOctreeSparseSemantics>>(inOrigin, inExtent);
+		break;
+	case ESPOctreeLayout::Point:
+		Tree = MakeUnique<TSPOctreeLayoutTree<FSPOctreePointSemantics>>(inOrigin, inExtent);
+		break;
+	default:
+		Layout = ESPOctreeLayout::Default;
+		Tree = MakeUnique<TSPOctreeLayoutTree<FSPOctreeSematics>>(inOrigin, inExtent);
+		break;
+	}
+}
+
+FSPOctree::~FSPOctree()
+{
+}
+
+void FSPOctree::AddElement(const FSPOctreeElement& inElement)
+{
+	Tree->AddElement(inElement);
+}
+
+void FSPOctree::RemoveElement(FOctreeElementId2 inElementId)
+{
+	Tree->RemoveElement(inElementId);
+}
+
+bool FSPOctree::IsValidElementId(FOctreeElementId2 inElementId) const
+{
+	return Tree->IsValidElementId(inElementId);
+}
+
+FSPOctreeElement& FSPOctree::GetElementById(FOctreeElementId2 inElementId)
+{
+	return Tree->GetElementById(inElementId);
+}
+
+const FSPOctreeElement& FSPOctree::GetElementById(FOctreeElementId2 inElementId) const
+{
+	return Tree->GetElementById(inElementId);
+}
+
+FBoxCenterAndExtent FSPOctree::GetRootBounds() const
+{
+	return Tree->GetRootBounds();
+}
+
+SIZE_T FSPOctree::GetSizeBytes() const
+{
+	return sizeof(*this) + Tree->GetSizeBytes();
+}
+
+void FSPOctree::Destroy()
+{
+	Tree->Destroy();
+}
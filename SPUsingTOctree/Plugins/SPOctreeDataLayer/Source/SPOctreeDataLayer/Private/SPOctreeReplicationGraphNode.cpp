@@ -0,0 +1,251 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SPOctreeReplicationGraphNode.h"
+#include "SPOctreeDataLayer.h"
+#include "SPOctreeStats.h"
+
+USPOctreeReplicationGraphNode::USPOctreeReplicationGraphNode()
+{
+	PrintLogs = false;
+	CullDistance = 15000.0f;
+	RootExtent = HALF_WORLD_MAX;
+	RelocationTolerance = 100.0f;
+	ViewerMoveTolerance = 100.0f;
+	MaxTrackedChanges = 1024;
+}
+
+void USPOctreeReplicationGraphNode::NotifyAddNetworkActor(const FNewReplicatedActorInfo& ActorInfo)
+{
+	AActor* actor = ActorInfo.Actor;
+	if (actor == nullptr || IndexedLocations.Contains(actor))
+	{
+		return;
+	}
+
+	IndexActor(actor, actor->GetActorLocation());
+	if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("USPOctreeReplicationGraphNode::NotifyAddNetworkActor: [%s] actors: %d"), *(actor->GetName()), IndexedLocations.Num());
+}
+
+bool USPOctreeReplicationGraphNode::NotifyRemoveNetworkActor(const FNewReplicatedActorInfo& ActorInfo, bool bWarnIfNotFound)
+{
+	AActor* actor = ActorInfo.Actor;
+	FVector indexedLocation;
+	if (actor == nullptr || !IndexedLocations.RemoveAndCopyValue(actor, indexedLocation))
+	{
+		if (bWarnIfNotFound) UE_LOG(SPOctreeDataLayerMod, Warning, TEXT("USPOctreeReplicationGraphNode::NotifyRemoveNetworkActor: [%s] is not in the node."), *GetNameSafe(actor));
+		return false;
+	}
+
+	FOctreeElementId2 elementId;
+	if (ElementIds.RemoveAndCopyValue(actor, elementId) && OctreeData->IsValidElementId(elementId))
+	{
+		OctreeData->RemoveElement(elementId);
+	}
+	AddChange(indexedLocation);
+	return true;
+}
+
+void USPOctreeReplicationGraphNode::NotifyResetAllNetworkActors()
+{
+	OctreeData.Reset();
+	ElementIds.Reset();
+	IndexedLocations.Reset();
+	ConnectionCaches.Reset();
+	RecentChanges.Reset();
+	ContentVersion++;
+}
+
+void USPOctreeReplicationGraphNode::PrepareForReplication()
+{
+	const double relocationToleranceSquared = FMath::Square((double)RelocationTolerance);
+	TArray<TPair<AActor*, FVector>, TInlineAllocator<64>> movedActors;
+	for (const TPair<TObjectPtr<AActor>, FVector>& indexedActor : IndexedLocations)
+	{
+		if (IsValid(indexedActor.Key) && FVector::DistSquared(indexedActor.Key->GetActorLocation(), indexedActor.Value) > relocationToleranceSquared)
+		{
+			movedActors.Emplace(indexedActor.Key, indexedActor.Value);
+		}
+	}
+
+	for (const TPair<AActor*, FVector>& movedActor : movedActors)
+	{
+		FOctreeElementId2 elementId;
+		if (ElementIds.RemoveAndCopyValue(movedActor.Key, elementId) && OctreeData->IsValidElementId(elementId))
+		{
+			OctreeData->RemoveElement(elementId);
+		}
+		AddChange(movedActor.Value);
+		IndexActor(movedActor.Key, movedActor.Key->GetActorLocation());
+	}
+
+	// Caches older than the oldest change kept query again, see IsCacheValid
+	if (RecentChanges.Num() > MaxTrackedChanges)
+	{
+		RecentChanges.RemoveAt(0, RecentChanges.Num() - MaxTrackedChanges, false);
+	}
+
+	for (auto connectionCache = ConnectionCaches.CreateIterator(); connectionCache; ++connectionCache)
+	{
+		if (!connectionCache.Key().IsValid())
+		{
+			connectionCache.RemoveCurrent();
+		}
+	}
+
+	if (PrintLogs && movedActors.Num() > 0) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("USPOctreeReplicationGraphNode::PrepareForReplication: %d actors relocated."), movedActors.Num());
+}
+
+void USPOctreeReplicationGraphNode::GatherActorListsForConnection(const FConnectionGatherActorListParameters& Params)
+{
+	TArray<FVector, TInlineAllocator<2>> viewLocations;
+	for (const FNetViewer& viewer : Params.Viewers)
+	{
+		viewLocations.Add(viewer.ViewLocation);
+	}
+
+	const FActorRepListRefView& relevantActors = GetRelevantActors(&Params.ConnectionManager, viewLocations);
+	if (relevantActors.Num() > 0)
+	{
+		Params.OutGatheredReplicationLists.AddReplicationActorList(relevantActors);
+	}
+}
+
+const FActorRepListRefView& USPOctreeReplicationGraphNode::GetRelevantActors(const UObject* inConnection, TConstArrayView<FVector> inViewLocations)
+{
+	FConnectionCache& cache = ConnectionCaches.FindOrAdd(inConnection);
+	if (IsCacheValid(cache, inViewLocations))
+	{
+		CacheHits++;
+		return cache.RelevantActors;
+	}
+	CacheMisses++;
+
+	SPOCTREE_SCOPE_CYCLE_COUNTER(Query);
+
+	cache.ViewLocations.Reset();
+	cache.ViewLocations.Append(inViewLocations.GetData(), inViewLocations.Num());
+	cache.GatheredVersion = ContentVersion;
+	cache.bGathered = true;
+	cache.RelevantActors.Reset();
+	if (!OctreeData)
+	{
+		return cache.RelevantActors;
+	}
+
+	const double cullDistanceSquared = FMath::Square((double)CullDistance);
+	FSPOctreeQueryCounters queryCounters;
+	GatheredActors.Reset();
+	for (const FVector& viewLocation : inViewLocations)
+	{
+		OctreeData->FindNodesWithPredicate(
+			[&viewLocation, cullDistanceSquared](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& NodeBounds)
+			{
+				return NodeBounds.GetBox().ComputeSquaredDistanceToPoint(viewLocation) <= cullDistanceSquared;
+			},
+			[this, &cache, &viewLocation, &queryCounters, &inViewLocations, cullDistanceSquared](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+			{
+				TArrayView<const FSPOctreeElement> elements = OctreeData->GetElementsForNode(NodeIndex);
+				queryCounters.AddNode();
+				queryCounters.AddElementsTested(elements.Num());
+				for (const FSPOctreeElement& element : elements)
+				{
+					if (FVector::DistSquared(element.BoxSphereBounds.Origin, viewLocation) <= cullDistanceSquared)
+					{
+						// Only several viewers can find the same actor twice
+						bool bAlreadyGathered = false;
+						if (inViewLocations.Num() > 1)
+						{
+							GatheredActors.Add(element.MyActor.Get(), &bAlreadyGathered);
+						}
+						if (!bAlreadyGathered)
+						{
+							queryCounters.AddHits(1);
+							cache.RelevantActors.Add(element.MyActor.Get());
+						}
+					}
+				}
+			});
+	}
+
+	return cache.RelevantActors;
+}
+
+bool USPOctreeReplicationGraphNode::IsCacheValid(const FConnectionCache& inCache, TConstArrayView<FVector> inViewLocations) const
+{
+	if (!inCache.bGathered || inCache.ViewLocations.Num() != inViewLocations.Num())
+	{
+		return false;
+	}
+
+	const double viewerMoveToleranceSquared = FMath::Square((double)ViewerMoveTolerance);
+	for (int32 viewerIndex = 0; viewerIndex < inViewLocations.Num(); viewerIndex++)
+	{
+		if (FVector::DistSquared(inCache.ViewLocations[viewerIndex], inViewLocations[viewerIndex]) > viewerMoveToleranceSquared)
+		{
+			return false;
+		}
+	}
+
+	if (inCache.GatheredVersion == ContentVersion)
+	{
+		return true;
+	}
+
+	// Changes the cache has not seen were trimmed
+	if (RecentChanges.Num() == 0 || RecentChanges[0].Version > inCache.GatheredVersion + 1)
+	{
+		return false;
+	}
+
+	const double reachSquared = FMath::Square((double)CullDistance + ViewerMoveTolerance);
+	for (int32 changeIndex = RecentChanges.Num() - 1; changeIndex >= 0 && RecentChanges[changeIndex].Version > inCache.GatheredVersion; changeIndex--)
+	{
+		for (const FVector& viewLocation : inCache.ViewLocations)
+		{
+			if (FVector::DistSquared(RecentChanges[changeIndex].Location, viewLocation) <= reachSquared)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void USPOctreeReplicationGraphNode::LogNode(FReplicationGraphDebugInfo& DebugInfo, const FString& NodeName) const
+{
+	DebugInfo.Log(NodeName);
+	DebugInfo.PushIndent();
+	DebugInfo.Log(FString::Printf(TEXT("Actors: %d Connections: %d CullDistance: %.0f CacheHits: %d CacheMisses: %d"), IndexedLocations.Num(), ConnectionCaches.Num(), CullDistance, CacheHits, CacheMisses));
+	DebugInfo.PopIndent();
+}
+
+void USPOctreeReplicationGraphNode::GetCacheStats(int32& OutCacheHits, int32& OutCacheMisses) const
+{
+	OutCacheHits = CacheHits;
+	OutCacheMisses = CacheMisses;
+}
+
+int32 USPOctreeReplicationGraphNode::GetNumActors() const
+{
+	return IndexedLocations.Num();
+}
+
+void USPOctreeReplicationGraphNode::IndexActor(AActor* inActor, const FVector& inLocation)
+{
+	if (!OctreeData)
+	{
+		OctreeData = MakeUnique<FSPOctree>(FVector::ZeroVector, RootExtent, ESPOctreeLayout::Point);
+	}
+
+	FSPOctreeElement element(inActor, FBoxSphereBounds(inLocation, FVector::ZeroVector, 0.0f));
+	element.ElementIds = &ElementIds;
+	OctreeData->AddElement(element);
+	IndexedLocations.Add(inActor, inLocation);
+	AddChange(inLocation);
+}
+
+void USPOctreeReplicationGraphNode::AddChange(const FVector& inLocation)
+{
+	ContentVersion++;
+	RecentChanges.Add({ ContentVersion, inLocation });
+}
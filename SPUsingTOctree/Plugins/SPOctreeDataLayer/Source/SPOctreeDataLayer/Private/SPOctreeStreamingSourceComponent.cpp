@@ -3,19 +3,42 @@
 
 #include "SPOctreeStreamingSourceComponent.h"
 #include "SPOctreeDataLayer.h"
+#include "SPOctreeStats.h"
 #include "SPOctree.h"
+#include "SPOctreeGrid.h"
+#include "SPOctreeStreamingSubsystem.h"
+#include "Components/SplineComponent.h"
+#include "DrawDebugHelpers.h"
+
+namespace SPOctreeStreamingPrediction
+{
+	/** Number of segments a predicted spline path is split into. */
+	static constexpr int32 PathSteps = 4;
+}
 
 // Sets default values for this component's properties
 USPOctreeStreamingSourceComponent::USPOctreeStreamingSourceComponent()
 {
-	// Set this component to be initialized when the game starts, and to be ticked every frame.  You can turn these features
-	// off to improve performance if you don't need them.
-	PrimaryComponentTick.bCanEverTick = true;
+	// Set this component to be initialized when the game starts. It does not tick, USPOctreeStreamingSubsystem
+	// updates every source of the world in one pass per frame.
+	PrimaryComponentTick.bCanEverTick = false;
 	bWantsInitializeComponent = true;
 	
 	PrintLogs = false;
 	DistanceCheck = 1500;
 	PrintLogsInterval = 1;
+
+	bPredictiveStreaming = false;
+	PredictionTime = 2.0f;
+	PredictionRadius = 0.0f;
+	PredictionSignificance = ESPOctreeSignificance::VisibleOnly;
+
+	DataLayerLoadDistance = 0.0f;
+	DataLayerActivateDistance = 0.0f;
+
+	bGatedQueries = false;
+	RequeryDistance = 100.0f;
+	MaxUpdateInterval = 0.0f;
 }
 
 
@@ -23,9 +46,21 @@ USPOctreeStreamingSourceComponent::USPOctreeStreamingSourceComponent()
 void USPOctreeStreamingSourceComponent::BeginPlay()
 {
 	Super::BeginPlay();
-	
-	// ...
-	
+
+	if (USPOctreeStreamingSubsystem* streamingSubsystem = GetWorld()->GetSubsystem<USPOctreeStreamingSubsystem>())
+	{
+		streamingSubsystem->RegisterSource(this);
+	}
+}
+
+void USPOctreeStreamingSourceComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (USPOctreeStreamingSubsystem* streamingSubsystem = GetWorld()->GetSubsystem<USPOctreeStreamingSubsystem>())
+	{
+		streamingSubsystem->UnregisterSource(this);
+	}
+
+	Super::EndPlay(EndPlayReason);
 }
 
 void USPOctreeStreamingSourceComponent::InitializeComponent()
@@ -49,60 +84,151 @@ void USPOctreeStreamingSourceComponent::UninitializeComponent()
 
 	Super::UninitializeComponent();
 }
-// Called every frame
-void USPOctreeStreamingSourceComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
-{
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
+// Called every frame by USPOctreeStreamingSubsystem
+void USPOctreeStreamingSourceComponent::UpdateStreaming(USPOctreeStreamingSubsystem& inSubsystem)
+{
 	if (GetWorld() && GetWorld()->IsGameWorld() && Owner)
 	{
-		if (!octrees.IsEmpty())
+		float worldTime = GetWorld()->GetTimeSeconds();
+		if (!octrees.IsEmpty() && worldTime >= nextUpdateTime)
 		{
-			float worldTime = GetWorld()->GetTimeSeconds();
 			FVector origin;
 			FVector boxExtent;
 			Owner->GetActorBounds(false, origin, boxExtent);
-			FBoxSphereBounds ownerBounds = FBoxSphereBounds(origin, boxExtent, DistanceCheck);
-			TArray<FSPOctreeElement> foundElements;
+
+			// Update often enough that the owner never moves more than RequeryDistance between two updates
+			if (MaxUpdateInterval > 0.0f)
+			{
+				const float speed = Owner->GetVelocity().Size();
+				const float updateInterval = speed > KINDA_SMALL_NUMBER ? FMath::Min(MaxUpdateInterval, RequeryDistance / speed) : MaxUpdateInterval;
+				nextUpdateTime = worldTime + updateInterval;
+			}
+
+			// One query covering the outermost tier, the elements found are then sorted into tiers by distance
+			float queryDistance = Tiers.IsEmpty() ? DistanceCheck : 0.0f;
+			for (const FSPOctreeStreamingTier& tier : Tiers)
+			{
+				queryDistance = FMath::Max(queryDistance, tier.Distance);
+			}
+			FBoxSphereBounds ownerBounds = FBoxSphereBounds(origin, boxExtent, queryDistance);
+
+			if (bPredictiveStreaming)
+			{
+				GetPredictedPath(origin, predictedPath);
+			}
+			else
+			{
+				predictedPath.Reset();
+			}
+			const FVector predictedEnd = predictedPath.Num() > 0 ? predictedPath.Last() : origin;
+
+			// Data Layer cells reach further than the actor tiers, so they are checked on their own movement
+			if (DataLayerLoadDistance > 0.0f || DataLayerActivateDistance > 0.0f || !trackedDataLayers.IsEmpty())
+			{
+				if (!bGatedQueries || !CanSkipDataLayerUpdate(origin))
+				{
+					UpdateDataLayers(inSubsystem, origin);
+					RecordDataLayerUpdate(origin);
+				}
+			}
+
+			if (bGatedQueries && CanSkipQuery(origin, predictedEnd))
+			{
+				return;
+			}
+
+			// Reset keeps the allocation from the previous tick
+			foundActors.Reset();
 
 			for (int index = 0; index < octrees.Num(); index++)
 			{
-				foundElements = octrees[index]->GetElementsWithinBounds(ownerBounds, true, DrawDebug, false, 0);
+				if (DrawDebug)
+				{
+					octrees[index]->DrawBoxSphereBounds(ownerBounds, true, false, 0);
+				}
 
-				if (PrintLogs && nextPrintLogTime < worldTime) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("USPOctreeStreamingSourceComponent: foundElements: %i"), foundElements.Num());
+				octrees[index]->ForEachElementWithinBounds(ownerBounds, true, [this, &origin](const FSPOctreeElement& octElement)
+					{
+						AddFoundActor(octElement.MyActor, GetSignificanceAtDistance(FVector::Dist(origin, octElement.BoxSphereBounds.Origin)));
+					});
+			}
+
+			FBox queryRegion = FBox(origin - FVector(queryDistance), origin + FVector(queryDistance));
 
-				for (int found = 0; found < foundElements.Num(); found++)
+			if (bPredictiveStreaming)
+			{
+				// Actors already in a tier keep it, the ones only ahead of the owner get PredictionSignificance
+				const float predictionRadius = PredictionRadius > 0.0f ? PredictionRadius : queryDistance;
+
+				for (int pointIndex = 1; pointIndex < predictedPath.Num(); pointIndex++)
 				{
-					if (foundElements[found].MyActor)
+					queryRegion += FBox(predictedPath[pointIndex] - FVector(predictionRadius), predictedPath[pointIndex] + FVector(predictionRadius));
+
+					if (DrawDebug)
 					{
-						foundElements[found].MyActor->SetActorHiddenInGame(false);
-						foundElements[found].MyActor->SetActorTickEnabled(foundElements[found].MyActor->PrimaryActorTick.bStartWithTickEnabled);
-						if (trackedElements.Find(foundElements[found]) == INDEX_NONE)
-						{
-							trackedElements.Add(foundElements[found]);
-						}
+						DrawDebugLine(GetWorld(), predictedPath[pointIndex - 1], predictedPath[pointIndex], FColor().Cyan, false, 0.0f);
+						DrawDebugSphere(GetWorld(), predictedPath[pointIndex], predictionRadius, 12, FColor().Cyan, false, 0.0f);
+					}
+
+					for (int index = 0; index < octrees.Num(); index++)
+					{
+						octrees[index]->ForEachElementInCapsule(predictedPath[pointIndex - 1], predictedPath[pointIndex], predictionRadius, [this](const FSPOctreeElement& octElement)
+							{
+								AddFoundActor(octElement.MyActor, PredictionSignificance);
+							});
 					}
 				}
+			}
+
+			SPOCTREE_SCOPE_CYCLE_COUNTER(StreamingDiff);
+
+			int enteredCount = 0;
+			int changedCount = 0;
+			int exitedCount = 0;
 
-				if (PrintLogs && nextPrintLogTime < worldTime) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("USPOctreeStreamingSourceComponent: Current trackedElements: %i"), trackedElements.Num());
+			for (const TPair<TWeakObjectPtr<AActor>, ESPOctreeSignificance>& foundActor : foundActors)
+			{
+				AActor* actor = foundActor.Key.Get();
+				const ESPOctreeSignificance* trackedSignificance = trackedActors.Find(foundActor.Key);
+				if (actor && trackedSignificance == nullptr)
+				{
+					inSubsystem.AddActorReference(actor, foundActor.Value);
+					OnActorEnterRange.Broadcast(actor);
+					enteredCount++;
+				}
+				else if (actor && *trackedSignificance != foundActor.Value)
+				{
+					// Added before the old tier is removed so the actor is never seen out of range
+					inSubsystem.AddActorReference(actor, foundActor.Value);
+					inSubsystem.RemoveActorReference(foundActor.Key, *trackedSignificance);
+					changedCount++;
+				}
+			}
 
-				for (int i = 0; i < trackedElements.Num(); i++)
+			for (const TPair<TWeakObjectPtr<AActor>, ESPOctreeSignificance>& trackedActor : trackedActors)
+			{
+				if (!foundActors.Contains(trackedActor.Key))
 				{
-					if (!trackedElements[i].MyActor || foundElements.Find(trackedElements[i]) == INDEX_NONE)
+					inSubsystem.RemoveActorReference(trackedActor.Key, trackedActor.Value);
+					if (AActor* actor = trackedActor.Key.Get())
 					{
-						if (trackedElements[i].MyActor)
-						{
-							trackedElements[i].MyActor->SetActorHiddenInGame(true);
-							trackedElements[i].MyActor->SetActorTickEnabled(false);
-						}
-						trackedElements.RemoveAt(i);
-						i--;
+						OnActorExitRange.Broadcast(actor);
 					}
+					exitedCount++;
 				}
+			}
+
+			// The actors found this tick are the ones tracked next tick
+			Swap(trackedActors, foundActors);
 
-				if (PrintLogs && nextPrintLogTime < worldTime) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("USPOctreeStreamingSourceComponent: Still in range trackedElements: %i"), trackedElements.Num());
+			if (bGatedQueries)
+			{
+				RecordQuery(origin, predictedEnd, queryRegion);
 			}
 
+			if (PrintLogs && nextPrintLogTime < worldTime) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("USPOctreeStreamingSourceComponent: trackedActors: %i entered: %i changed tier: %i exited: %i"), trackedActors.Num(), enteredCount, changedCount, exitedCount);
+
 			if (PrintLogs && nextPrintLogTime < worldTime)
 			{
 				nextPrintLogTime = GetWorld()->GetTimeSeconds() + 1;
@@ -111,12 +237,261 @@ void USPOctreeStreamingSourceComponent::TickComponent(float DeltaTime, ELevelTic
 	}
 }
 
+void USPOctreeStreamingSourceComponent::ReleaseTrackedActors(USPOctreeStreamingSubsystem& inSubsystem)
+{
+	for (const TPair<TWeakObjectPtr<AActor>, ESPOctreeSignificance>& trackedActor : trackedActors)
+	{
+		inSubsystem.RemoveActorReference(trackedActor.Key, trackedActor.Value);
+	}
+	trackedActors.Reset();
+
+	for (const TPair<FName, EDataLayerRuntimeState>& trackedDataLayer : trackedDataLayers)
+	{
+		inSubsystem.RemoveDataLayerReference(trackedDataLayer.Key, trackedDataLayer.Value);
+	}
+	trackedDataLayers.Reset();
+}
+
+void USPOctreeStreamingSourceComponent::UpdateDataLayers(USPOctreeStreamingSubsystem& inSubsystem, const FVector& inOrigin)
+{
+	foundDataLayers.Reset();
+
+	const float dataLayerDistance = FMath::Max(DataLayerLoadDistance, DataLayerActivateDistance);
+	for (int index = 0; index < octrees.Num(); index++)
+	{
+		octrees[index]->ForEachDataLayerCellWithinDistance(inOrigin, dataLayerDistance, [this](const FSPOctreeDataLayerCell& Cell, const float Distance)
+			{
+				const EDataLayerRuntimeState state = Distance <= DataLayerActivateDistance ? EDataLayerRuntimeState::Activated : EDataLayerRuntimeState::Loaded;
+				if (EDataLayerRuntimeState* foundState = foundDataLayers.Find(Cell.DataLayerLabel))
+				{
+					*foundState = FMath::Max(*foundState, state);
+				}
+				else
+				{
+					foundDataLayers.Add(Cell.DataLayerLabel, state);
+				}
+			});
+	}
+
+	for (const TPair<FName, EDataLayerRuntimeState>& foundDataLayer : foundDataLayers)
+	{
+		const EDataLayerRuntimeState* trackedState = trackedDataLayers.Find(foundDataLayer.Key);
+		if (trackedState == nullptr || *trackedState != foundDataLayer.Value)
+		{
+			// Added before the old state is removed so the cell is never unloaded on the way
+			inSubsystem.AddDataLayerReference(foundDataLayer.Key, foundDataLayer.Value);
+			if (trackedState)
+			{
+				inSubsystem.RemoveDataLayerReference(foundDataLayer.Key, *trackedState);
+			}
+		}
+	}
+
+	for (const TPair<FName, EDataLayerRuntimeState>& trackedDataLayer : trackedDataLayers)
+	{
+		if (!foundDataLayers.Contains(trackedDataLayer.Key))
+		{
+			inSubsystem.RemoveDataLayerReference(trackedDataLayer.Key, trackedDataLayer.Value);
+		}
+	}
+
+	Swap(trackedDataLayers, foundDataLayers);
+}
+
+bool USPOctreeStreamingSourceComponent::CanSkipQuery(const FVector& inOrigin, const FVector& inPredictedEnd) const
+{
+	if (bQueryInvalidated || octreeQueryStates.Num() != octrees.Num())
+	{
+		return false;
+	}
+
+	const double requeryDistanceSquared = FMath::Square(RequeryDistance);
+	if (FVector::DistSquared(inOrigin, lastQueryOrigin) > requeryDistanceSquared || FVector::DistSquared(inPredictedEnd, lastPredictedEnd) > requeryDistanceSquared)
+	{
+		return false;
+	}
+
+	for (int index = 0; index < octrees.Num(); index++)
+	{
+		const FOctreeQueryState& queryState = octreeQueryStates[index];
+		if (octrees[index] == nullptr
+			|| (queryState.CellBounds.IsValid && !queryState.CellBounds.IsInside(inOrigin))
+			|| octrees[index]->HasChangedNear(lastQueryRegion, queryState.ContentVersion))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void USPOctreeStreamingSourceComponent::RecordQuery(const FVector& inOrigin, const FVector& inPredictedEnd, const FBox& inQueryRegion)
+{
+	lastQueryOrigin = inOrigin;
+	lastPredictedEnd = inPredictedEnd;
+	lastQueryRegion = inQueryRegion;
+	bQueryInvalidated = false;
+
+	octreeQueryStates.SetNum(octrees.Num());
+	for (int index = 0; index < octrees.Num(); index++)
+	{
+		if (octrees[index])
+		{
+			octreeQueryStates[index].ContentVersion = octrees[index]->GetContentVersion();
+			octreeQueryStates[index].CellBounds = octrees[index]->GetLeafBoundsAt(inOrigin);
+		}
+	}
+}
+
+bool USPOctreeStreamingSourceComponent::CanSkipDataLayerUpdate(const FVector& inOrigin) const
+{
+	if (bDataLayersInvalidated || dataLayerContentVersions.Num() != octrees.Num())
+	{
+		return false;
+	}
+
+	if (FVector::DistSquared(inOrigin, lastDataLayerOrigin) > FMath::Square(RequeryDistance))
+	{
+		return false;
+	}
+
+	const float dataLayerDistance = FMath::Max(DataLayerLoadDistance, DataLayerActivateDistance);
+	const FBox dataLayerRegion = FBox(lastDataLayerOrigin - FVector(dataLayerDistance), lastDataLayerOrigin + FVector(dataLayerDistance));
+	for (int index = 0; index < octrees.Num(); index++)
+	{
+		if (octrees[index] == nullptr || octrees[index]->HasChangedNear(dataLayerRegion, dataLayerContentVersions[index]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void USPOctreeStreamingSourceComponent::RecordDataLayerUpdate(const FVector& inOrigin)
+{
+	lastDataLayerOrigin = inOrigin;
+	bDataLayersInvalidated = false;
+
+	dataLayerContentVersions.SetNum(octrees.Num());
+	for (int index = 0; index < octrees.Num(); index++)
+	{
+		dataLayerContentVersions[index] = octrees[index] ? octrees[index]->GetContentVersion() : 0;
+	}
+}
+
+void USPOctreeStreamingSourceComponent::AddFoundActor(AActor* inActor, const ESPOctreeSignificance inSignificance)
+{
+	if (inActor == nullptr || inSignificance == ESPOctreeSignificance::Hidden)
+	{
+		return;
+	}
+
+	if (ESPOctreeSignificance* foundSignificance = foundActors.Find(inActor))
+	{
+		*foundSignificance = FMath::Min(*foundSignificance, inSignificance);
+	}
+	else
+	{
+		foundActors.Add(inActor, inSignificance);
+	}
+}
+
+void USPOctreeStreamingSourceComponent::GetPredictedPath(const FVector& inOrigin, TArray<FVector>& OutPoints) const
+{
+	OutPoints.Reset();
+
+	const FVector velocity = Owner->GetVelocity();
+	const float lookAheadDistance = velocity.Size() * PredictionTime;
+	if (lookAheadDistance <= KINDA_SMALL_NUMBER)
+	{
+		return;
+	}
+
+	OutPoints.Add(inOrigin);
+
+	if (PredictionPath == nullptr)
+	{
+		OutPoints.Add(inOrigin + velocity * PredictionTime);
+		return;
+	}
+
+	// Follow the spline from the point nearest the owner, in the direction the owner is moving along it
+	const float inputKey = PredictionPath->FindInputKeyClosestToWorldLocation(inOrigin);
+	const float startDistance = PredictionPath->GetDistanceAlongSplineAtSplineInputKey(inputKey);
+	const float splineLength = PredictionPath->GetSplineLength();
+	const FVector splineDirection = PredictionPath->GetDirectionAtSplineInputKey(inputKey, ESplineCoordinateSpace::World);
+	const float stepDistance = (FVector::DotProduct(splineDirection, velocity) >= 0.0f ? lookAheadDistance : -lookAheadDistance) / SPOctreeStreamingPrediction::PathSteps;
+
+	for (int32 step = 1; step <= SPOctreeStreamingPrediction::PathSteps; step++)
+	{
+		float distance = startDistance + stepDistance * step;
+		if (PredictionPath->IsClosedLoop() && splineLength > 0.0f)
+		{
+			distance = FMath::Fmod(distance, splineLength);
+			distance = distance < 0.0f ? distance + splineLength : distance;
+		}
+		else
+		{
+			distance = FMath::Clamp(distance, 0.0f, splineLength);
+		}
+		OutPoints.Add(PredictionPath->GetLocationAtDistanceAlongSpline(distance, ESplineCoordinateSpace::World));
+	}
+}
+
+ESPOctreeSignificance USPOctreeStreamingSourceComponent::GetSignificanceAtDistance(const double inDistance) const
+{
+	if (Tiers.IsEmpty())
+	{
+		return inDistance <= DistanceCheck ? ESPOctreeSignificance::Full : ESPOctreeSignificance::Hidden;
+	}
+
+	// The nearest tier containing the distance wins, whatever order the tiers are listed in
+	const FSPOctreeStreamingTier* nearestTier = nullptr;
+	for (const FSPOctreeStreamingTier& tier : Tiers)
+	{
+		if (inDistance <= tier.Distance && (nearestTier == nullptr || tier.Distance < nearestTier->Distance))
+		{
+			nearestTier = &tier;
+		}
+	}
+	return nearestTier ? nearestTier->Significance : ESPOctreeSignificance::Hidden;
+}
+
 void USPOctreeStreamingSourceComponent::addOctree(ASPOctree* inOctree)
 {
 	octrees.Add(inOctree);
+	bQueryInvalidated = true;
+	bDataLayersInvalidated = true;
+	nextUpdateTime = 0.0f;
 }
 
 void USPOctreeStreamingSourceComponent::removeOctree(ASPOctree* inOctree)
 {
 	octrees.Remove(inOctree);
+	bQueryInvalidated = true;
+	bDataLayersInvalidated = true;
+	nextUpdateTime = 0.0f;
+}
+
+void USPOctreeStreamingSourceComponent::addOctreeGrid(ASPOctreeGrid* inGrid)
+{
+	if (inGrid == nullptr)
+	{
+		return;
+	}
+
+	TArray<ASPOctree*> cells;
+	inGrid->GetCellOctrees(cells);
+	for (ASPOctree* cell : cells)
+	{
+		addOctree(cell);
+	}
+	inGrid->OnCellCreated.AddUniqueDynamic(this, &USPOctreeStreamingSourceComponent::OnGridCellCreated);
+}
+
+void USPOctreeStreamingSourceComponent::OnGridCellCreated(ASPOctree* inCell)
+{
+	if (inCell && !octrees.Contains(inCell))
+	{
+		addOctree(inCell);
+	}
 }
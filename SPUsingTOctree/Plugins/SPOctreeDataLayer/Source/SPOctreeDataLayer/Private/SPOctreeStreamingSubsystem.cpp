@@ -0,0 +1,306 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "SPOctreeStreamingSubsystem.h"
+#include "SPOctreeDataLayer.h"
+#include "SPOctreeStats.h"
+#include "SPOctreeStreamingSourceComponent.h"
+
+bool USPOctreeStreamingSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	const UWorld* world = Cast<UWorld>(Outer);
+	return world && world->IsGameWorld() && Super::ShouldCreateSubsystem(Outer);
+}
+
+void USPOctreeStreamingSubsystem::Deinitialize()
+{
+	Sources.Reset();
+	ActorRefCounts.Reset();
+	AppliedSignificance.Reset();
+	ChangedActors.Reset();
+	DataLayerRefCounts.Reset();
+	ChangedDataLayers.Reset();
+	PendingTransitions.Reset();
+	NumAppliedTransitions = 0;
+
+	Super::Deinitialize();
+}
+
+void USPOctreeStreamingSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	for (int index = 0; index < Sources.Num(); index++)
+	{
+		if (Sources[index])
+		{
+			Sources[index]->UpdateStreaming(*this);
+		}
+	}
+
+	ApplyVisibilityTransitions();
+	ApplyDataLayerStates();
+}
+
+TStatId USPOctreeStreamingSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(USPOctreeStreamingSubsystem, STATGROUP_Tickables);
+}
+
+void USPOctreeStreamingSubsystem::RegisterSource(USPOctreeStreamingSourceComponent* inSource)
+{
+	if (inSource)
+	{
+		Sources.AddUnique(inSource);
+	}
+}
+
+void USPOctreeStreamingSubsystem::UnregisterSource(USPOctreeStreamingSourceComponent* inSource)
+{
+	if (inSource && Sources.Remove(inSource) > 0)
+	{
+		// Give back the references of the source, the actors only it kept significant are downgraded next Tick
+		inSource->ReleaseTrackedActors(*this);
+	}
+}
+
+void USPOctreeStreamingSubsystem::AddActorReference(AActor* inActor, const ESPOctreeSignificance inSignificance)
+{
+	if (inSignificance == ESPOctreeSignificance::Hidden)
+	{
+		return;
+	}
+
+	TWeakObjectPtr<AActor> actorKey(inActor);
+	FSignificanceRefCounts& refCounts = ActorRefCounts.FindOrAdd(actorKey);
+	const ESPOctreeSignificance previousSignificance = refCounts.GetSignificance();
+	refCounts.Counts[(int32)inSignificance]++;
+	if (refCounts.GetSignificance() != previousSignificance)
+	{
+		ChangedActors.Add(actorKey);
+	}
+}
+
+void USPOctreeStreamingSubsystem::RemoveActorReference(const TWeakObjectPtr<AActor>& inActor, const ESPOctreeSignificance inSignificance)
+{
+	FSignificanceRefCounts* refCounts = ActorRefCounts.Find(inActor);
+	if (refCounts == nullptr || inSignificance == ESPOctreeSignificance::Hidden || refCounts->Counts[(int32)inSignificance] <= 0)
+	{
+		return;
+	}
+
+	const ESPOctreeSignificance previousSignificance = refCounts->GetSignificance();
+	refCounts->Counts[(int32)inSignificance]--;
+	if (refCounts->GetSignificance() != previousSignificance)
+	{
+		ChangedActors.Add(inActor);
+	}
+	if (refCounts->GetTotal() == 0)
+	{
+		ActorRefCounts.Remove(inActor);
+	}
+}
+
+void USPOctreeStreamingSubsystem::AddDataLayerReference(const FName& inDataLayerLabel, const EDataLayerRuntimeState inState)
+{
+	if (inState == EDataLayerRuntimeState::Unloaded)
+	{
+		return;
+	}
+
+	FDataLayerRefCounts& refCounts = DataLayerRefCounts.FindOrAdd(inDataLayerLabel);
+	const EDataLayerRuntimeState previousState = refCounts.GetState();
+	(inState == EDataLayerRuntimeState::Activated ? refCounts.Activated : refCounts.Loaded)++;
+	if (refCounts.GetState() != previousState)
+	{
+		ChangedDataLayers.Add(inDataLayerLabel);
+	}
+}
+
+void USPOctreeStreamingSubsystem::RemoveDataLayerReference(const FName& inDataLayerLabel, const EDataLayerRuntimeState inState)
+{
+	FDataLayerRefCounts* refCounts = DataLayerRefCounts.Find(inDataLayerLabel);
+	if (refCounts == nullptr || inState == EDataLayerRuntimeState::Unloaded)
+	{
+		return;
+	}
+
+	int32& refCount = inState == EDataLayerRuntimeState::Activated ? refCounts->Activated : refCounts->Loaded;
+	if (refCount <= 0)
+	{
+		return;
+	}
+
+	const EDataLayerRuntimeState previousState = refCounts->GetState();
+	refCount--;
+	if (refCounts->GetState() != previousState)
+	{
+		ChangedDataLayers.Add(inDataLayerLabel);
+	}
+	if (refCounts->Loaded == 0 && refCounts->Activated == 0)
+	{
+		DataLayerRefCounts.Remove(inDataLayerLabel);
+	}
+}
+
+EDataLayerRuntimeState USPOctreeStreamingSubsystem::GetRequestedDataLayerState(FName inDataLayerLabel) const
+{
+	const FDataLayerRefCounts* refCounts = DataLayerRefCounts.Find(inDataLayerLabel);
+	return refCounts ? refCounts->GetState() : EDataLayerRuntimeState::Unloaded;
+}
+
+int32 USPOctreeStreamingSubsystem::GetActorRefCount(AActor* inActor) const
+{
+	const FSignificanceRefCounts* refCounts = ActorRefCounts.Find(inActor);
+	return refCounts ? refCounts->GetTotal() : 0;
+}
+
+ESPOctreeSignificance USPOctreeStreamingSubsystem::GetActorSignificance(AActor* inActor) const
+{
+	const FSignificanceRefCounts* refCounts = ActorRefCounts.Find(inActor);
+	return refCounts ? refCounts->GetSignificance() : ESPOctreeSignificance::Hidden;
+}
+
+void USPOctreeStreamingSubsystem::GetPendingTransitions(TArray<FSPOctreeStreamingTransition>& OutTransitions) const
+{
+	OutTransitions.Reset();
+	for (int index = NumAppliedTransitions; index < PendingTransitions.Num(); index++)
+	{
+		if (PendingTransitions[index].Actor.IsValid())
+		{
+			OutTransitions.Add(PendingTransitions[index]);
+		}
+	}
+}
+
+int32 USPOctreeStreamingSubsystem::GetNumPendingTransitions() const
+{
+	return ChangedActors.Num();
+}
+
+void USPOctreeStreamingSubsystem::ApplyVisibilityTransitions()
+{
+	SPOCTREE_SCOPE_CYCLE_COUNTER(StreamingTransitions);
+
+	const double startTime = FPlatformTime::Seconds();
+
+	SourceLocations.Reset();
+	for (const USPOctreeStreamingSourceComponent* source : Sources)
+	{
+		if (source && source->GetOwner())
+		{
+			SourceLocations.Add(source->GetOwner()->GetActorLocation());
+		}
+	}
+
+	// Drop what is gone or already in the right state, and rank the rest by distance to the nearest source
+	PendingTransitions.Reset();
+	for (TSet<TWeakObjectPtr<AActor>>::TIterator changedIt = ChangedActors.CreateIterator(); changedIt; ++changedIt)
+	{
+		AActor* actor = changedIt->Get();
+		if (actor == nullptr)
+		{
+			AppliedSignificance.Remove(*changedIt);
+			changedIt.RemoveCurrent();
+			continue;
+		}
+
+		// An actor that left one tier and entered the same tier of another source keeps its state
+		const ESPOctreeSignificance targetSignificance = GetActorSignificance(actor);
+		const ESPOctreeSignificance* appliedSignificance = AppliedSignificance.Find(*changedIt);
+		if (targetSignificance == (appliedSignificance ? *appliedSignificance : ESPOctreeSignificance::Hidden))
+		{
+			changedIt.RemoveCurrent();
+			continue;
+		}
+
+		double distanceSquared = TNumericLimits<double>::Max();
+		for (const FVector& sourceLocation : SourceLocations)
+		{
+			distanceSquared = FMath::Min(distanceSquared, FVector::DistSquared(sourceLocation, actor->GetActorLocation()));
+		}
+
+		FSPOctreeStreamingTransition& transition = PendingTransitions.AddDefaulted_GetRef();
+		transition.Actor = actor;
+		transition.Significance = targetSignificance;
+		transition.Distance = FMath::Sqrt(distanceSquared);
+	}
+
+	const bool bCountLimited = MaxTransitionsPerFrame > 0;
+	const bool bTimeLimited = TransitionBudgetMs > 0.0f;
+	if (bCountLimited || bTimeLimited)
+	{
+		PendingTransitions.Sort([](const FSPOctreeStreamingTransition& A, const FSPOctreeStreamingTransition& B) { return A.Distance < B.Distance; });
+	}
+
+	const double endTime = startTime + TransitionBudgetMs * 0.001;
+
+	for (NumAppliedTransitions = 0; NumAppliedTransitions < PendingTransitions.Num(); NumAppliedTransitions++)
+	{
+		// The first transition always goes through so the queue drains whatever the budget
+		if (NumAppliedTransitions > 0 && ((bCountLimited && NumAppliedTransitions >= MaxTransitionsPerFrame) || (bTimeLimited && FPlatformTime::Seconds() >= endTime)))
+		{
+			break;
+		}
+
+		const FSPOctreeStreamingTransition& transition = PendingTransitions[NumAppliedTransitions];
+		ApplySignificance(transition.Actor.Get(), transition.Significance);
+		if (transition.Significance == ESPOctreeSignificance::Hidden)
+		{
+			AppliedSignificance.Remove(transition.Actor);
+		}
+		else
+		{
+			AppliedSignificance.Add(transition.Actor, transition.Significance);
+		}
+		ChangedActors.Remove(transition.Actor);
+	}
+
+	LastTransitionCount = NumAppliedTransitions;
+	INC_DWORD_STAT_BY(STAT_SPOctree_Transitions, NumAppliedTransitions);
+	CSV_CUSTOM_STAT(SPOctree, Transitions, NumAppliedTransitions, ECsvCustomStatOp::Set);
+	LastTransitionTimeMs = (float)((FPlatformTime::Seconds() - startTime) * 1000.0);
+
+	if (PrintLogs && LastTransitionCount > 0) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("USPOctreeStreamingSubsystem: transitions: %i pending: %i visible: %i time: %.3fms"), LastTransitionCount, ChangedActors.Num(), AppliedSignificance.Num(), LastTransitionTimeMs);
+}
+
+void USPOctreeStreamingSubsystem::ApplyDataLayerStates()
+{
+	if (ChangedDataLayers.IsEmpty())
+	{
+		return;
+	}
+
+	UDataLayerSubsystem* dataLayerSubsystem = GetWorld()->GetSubsystem<UDataLayerSubsystem>();
+	if (dataLayerSubsystem == nullptr)
+	{
+		ChangedDataLayers.Reset();
+		return;
+	}
+
+	// World Partition streams the cells in and out over the next frames, only the requests are made here
+	for (const FName& dataLayerLabel : ChangedDataLayers)
+	{
+		const EDataLayerRuntimeState state = GetRequestedDataLayerState(dataLayerLabel);
+		dataLayerSubsystem->SetDataLayerRuntimeStateByLabel(dataLayerLabel, state);
+		if (PrintLogs) UE_LOG(SPOctreeDataLayerMod, Log, TEXT("USPOctreeStreamingSubsystem: Data Layer [%s] set to %s"), *dataLayerLabel.ToString(), GetDataLayerRuntimeStateName(state));
+	}
+
+	ChangedDataLayers.Reset();
+}
+
+void USPOctreeStreamingSubsystem::ApplySignificance(AActor* inActor, const ESPOctreeSignificance inSignificance) const
+{
+	const bool bVisible = inSignificance != ESPOctreeSignificance::Hidden;
+	const bool bActive = inSignificance == ESPOctreeSignificance::Full || inSignificance == ESPOctreeSignificance::ReducedTick;
+
+	inActor->SetActorHiddenInGame(!bVisible);
+	inActor->SetActorEnableCollision(bActive);
+	inActor->SetActorTickEnabled(bActive && inActor->PrimaryActorTick.bStartWithTickEnabled);
+
+	if (bActive)
+	{
+		// Full restores the tick interval the actor class was authored with
+		const float tickInterval = inSignificance == ESPOctreeSignificance::ReducedTick ? ReducedTickInterval : inActor->GetClass()->GetDefaultObject<AActor>()->PrimaryActorTick.TickInterval;
+		inActor->SetActorTickInterval(tickInterval);
+	}
+}
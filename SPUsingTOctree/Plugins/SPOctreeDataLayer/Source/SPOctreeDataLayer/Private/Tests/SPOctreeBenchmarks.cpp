@@ -0,0 +1,620 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "SPOctree.h"
+#include "SPOctreeBakedIndex.h"
+#include "SPOctreeCompact.h"
+#include "SPOctreeTestHelpers.h"
+#include "Dom/JsonObject.h"
+#include "Serialization/JsonSerializer.h"
+#include "Misc/App.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "HAL/FileManager.h"
+
+/**
+* Benchmarks of the Octree data structures on synthetic scenes.
+*
+* Elements are generated without actors so a million of them fit in a test, which exercises FSPOctree and
+* FSPOctreeBakedIndex directly. Every case appends a row to Saved/SPOctreeBenchmarks/SPOctreeBenchmarks.csv
+* and writes a JSON file next to it, so runs on the same machine can be compared over time.
+*/
+namespace SPOctreeBenchmark
+{
+	static constexpr float SceneExtent = 500000.0f;
+
+	static constexpr int32 NumQueries = 1000;
+	static constexpr float QueryRadius = 5000.0f;
+
+	/** Queries checked against a brute force scan, on scenes small enough for it. */
+	static constexpr int32 NumValidatedQueries = 16;
+	static constexpr int32 MaxValidatedElements = 100000;
+
+	static constexpr int32 NumClusters = 64;
+	static constexpr float ClusterRadius = 20000.0f;
+
+	static constexpr int32 NumStreamingSources = 8;
+	static constexpr int32 NumStreamingSteps = 300;
+	static constexpr float StreamingRadius = 20000.0f;
+	static constexpr float StreamingStep = 2000.0f;
+
+	enum class EDistribution : uint8
+	{
+		/** Elements spread evenly over the whole scene. */
+		Uniform,
+		/** Elements packed around a few dense centers, with most of the scene empty. */
+		Clustered,
+		/** Elements stacked on one spot past MaxNodeDepth, plus large elements stuck at the root. */
+		Pathological,
+	};
+
+	static const TCHAR* DistributionNames[] = { TEXT("Uniform"), TEXT("Clustered"), TEXT("Pathological") };
+	static const int32 SceneSizes[] = { 10000, 100000, 1000000 };
+
+	static FBoxSphereBounds MakeBounds(const FVector& inOrigin, const FVector& inExtent)
+	{
+		return FBoxSphereBounds(inOrigin, inExtent, inExtent.Size());
+	}
+
+	static FVector RandomExtent(FRandomStream& inRandom, const float inMin, const float inMax)
+	{
+		return FVector(inRandom.FRandRange(inMin, inMax), inRandom.FRandRange(inMin, inMax), inRandom.FRandRange(inMin, inMax));
+	}
+
+	static void GenerateScene(const EDistribution inDistribution, const int32 inNumElements, TArray<FSPOctreeElement>& OutElements)
+	{
+		FRandomStream random(SPOctreeTest::RandomSeed);
+		const FBox sceneBox(FVector(-SceneExtent), FVector(SceneExtent));
+
+		OutElements.Reset(inNumElements);
+		switch (inDistribution)
+		{
+		case EDistribution::Uniform:
+			for (int32 index = 0; index < inNumElements; index++)
+			{
+				OutElements.Emplace(nullptr, MakeBounds(random.RandPointInBox(sceneBox), RandomExtent(random, 50.0f, 500.0f)));
+			}
+			break;
+
+		case EDistribution::Clustered:
+		{
+			TArray<FVector> clusterCenters;
+			for (int32 index = 0; index < NumClusters; index++)
+			{
+				clusterCenters.Add(random.RandPointInBox(sceneBox.ExpandBy(-ClusterRadius)));
+			}
+			for (int32 index = 0; index < inNumElements; index++)
+			{
+				// Squaring the distance packs the elements towards the center of their cluster
+				const FVector offset = random.GetUnitVector() * FMath::Square(random.FRand()) * ClusterRadius;
+				OutElements.Emplace(nullptr, MakeBounds(clusterCenters[random.RandHelper(NumClusters)] + offset, RandomExtent(random, 50.0f, 500.0f)));
+			}
+			break;
+		}
+
+		case EDistribution::Pathological:
+		{
+			const FVector stackCenter = FVector(SceneExtent * 0.5f);
+			for (int32 index = 0; index < inNumElements; index++)
+			{
+				if (index % 4 == 0)
+				{
+					// Straddles the center of the root, so it can never be pushed down to a child
+					OutElements.Emplace(nullptr, MakeBounds(random.RandPointInBox(FBox(FVector(-1000.0f), FVector(1000.0f))), RandomExtent(random, 10000.0f, SceneExtent * 0.25f)));
+				}
+				else
+				{
+					OutElements.Emplace(nullptr, MakeBounds(stackCenter + random.GetUnitVector() * random.FRand(), FVector(1.0f)));
+				}
+			}
+			break;
+		}
+		}
+	}
+
+	/** Same rule as the bounds queries of ASPOctree, see FSPOctreeBakedIndex::ForEachElementWithinBounds. */
+	static int32 CountElementsBruteForce(const TArray<FSPOctreeElement>& inElements, const FBoxSphereBounds& inQuery)
+	{
+		const FBox queryBox = inQuery.GetBox();
+		const FSphere querySphere = inQuery.GetSphere();
+		int32 count = 0;
+		for (const FSPOctreeElement& element : inElements)
+		{
+			if (queryBox.Intersect(element.BoxSphereBounds.GetBox()) || querySphere.IsInside(element.BoxSphereBounds.Origin))
+			{
+				count++;
+			}
+		}
+		return count;
+	}
+
+	/** Counts the nodes of an Octree and the most elements held by a single node. */
+	static void CountNodes(const FSPOctree& inOctree, int32& OutNumNodes, int32& OutMaxNodeElements)
+	{
+		OutNumNodes = 0;
+		OutMaxNodeElements = 0;
+		inOctree.FindNodesWithPredicate(
+			[](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& /*NodeBounds*/)
+			{
+				return true;
+			},
+			[&inOctree, &OutNumNodes, &OutMaxNodeElements](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+			{
+				OutNumNodes++;
+				OutMaxNodeElements = FMath::Max(OutMaxNodeElements, inOctree.GetElementsForNode(NodeIndex).Num());
+			});
+	}
+
+	/** Statistics of a set of timings, in microseconds. */
+	struct FTimings
+	{
+		TArray<double> Samples;
+
+		void AddCycles(const uint64 inCycles)
+		{
+			Samples.Add(FPlatformTime::ToSeconds64(inCycles) * 1000000.0);
+		}
+
+		double GetPercentile(const double inPercentile) const
+		{
+			if (Samples.Num() == 0)
+			{
+				return 0.0;
+			}
+			TArray<double> sortedSamples = Samples;
+			sortedSamples.Sort();
+			const int32 index = FMath::Clamp(FMath::CeilToInt(inPercentile * sortedSamples.Num()) - 1, 0, sortedSamples.Num() - 1);
+			return sortedSamples[index];
+		}
+
+		double GetMean() const
+		{
+			double total = 0.0;
+			for (const double sample : Samples)
+			{
+				total += sample;
+			}
+			return Samples.Num() > 0 ? total / Samples.Num() : 0.0;
+		}
+	};
+
+	/** Named metrics of one case, in the order they are written out. */
+	struct FResults
+	{
+		FString CaseName;
+		TArray<TPair<FString, double>> Metrics;
+
+		void Add(const TCHAR* inName, const double inValue)
+		{
+			Metrics.Emplace(inName, inValue);
+		}
+
+		void AddTimings(const TCHAR* inName, const FTimings& inTimings)
+		{
+			Add(*FString::Printf(TEXT("%sMeanUs"), inName), inTimings.GetMean());
+			Add(*FString::Printf(TEXT("%sP50Us"), inName), inTimings.GetPercentile(0.5));
+			Add(*FString::Printf(TEXT("%sP90Us"), inName), inTimings.GetPercentile(0.9));
+			Add(*FString::Printf(TEXT("%sP99Us"), inName), inTimings.GetPercentile(0.99));
+			Add(*FString::Printf(TEXT("%sMaxUs"), inName), inTimings.GetPercentile(1.0));
+		}
+	};
+
+	static FString GetOutputDirectory()
+	{
+		return FPaths::ProjectSavedDir() / TEXT("SPOctreeBenchmarks");
+	}
+
+	static void WriteResults(const FResults& inResults, const TCHAR* inCsvName = TEXT("SPOctreeBenchmarks"))
+	{
+		const FDateTime timestamp = FDateTime::UtcNow();
+		const FString buildConfiguration = LexToString(FApp::GetBuildConfiguration());
+		const FString cpuBrand = FPlatformMisc::GetCPUBrand().TrimStartAndEnd();
+
+		TSharedRef<FJsonObject> jsonResults = MakeShared<FJsonObject>();
+		jsonResults->SetStringField(TEXT("Case"), inResults.CaseName);
+		jsonResults->SetStringField(TEXT("Timestamp"), timestamp.ToIso8601());
+		jsonResults->SetStringField(TEXT("BuildVersion"), FApp::GetBuildVersion());
+		jsonResults->SetStringField(TEXT("BuildConfiguration"), buildConfiguration);
+		jsonResults->SetStringField(TEXT("Platform"), FPlatformProperties::IniPlatformName());
+		jsonResults->SetStringField(TEXT("CPU"), cpuBrand);
+		TSharedRef<FJsonObject> jsonMetrics = MakeShared<FJsonObject>();
+		for (const TPair<FString, double>& metric : inResults.Metrics)
+		{
+			jsonMetrics->SetNumberField(metric.Key, metric.Value);
+		}
+		jsonResults->SetObjectField(TEXT("Metrics"), jsonMetrics);
+
+		FString jsonString;
+		TSharedRef<TJsonWriter<>> jsonWriter = TJsonWriterFactory<>::Create(&jsonString);
+		FJsonSerializer::Serialize(jsonResults, jsonWriter);
+
+		const FString jsonPath = GetOutputDirectory() / FString::Printf(TEXT("%s_%s.json"), *inResults.CaseName.Replace(TEXT(" "), TEXT("_")), *timestamp.ToString());
+		FFileHelper::SaveStringToFile(jsonString, *jsonPath);
+
+		// Every case writes the same columns, so all runs share one CSV
+		const FString csvPath = GetOutputDirectory() / FString(inCsvName) + TEXT(".csv");
+		FString csvString;
+		if (!IFileManager::Get().FileExists(*csvPath))
+		{
+			csvString += TEXT("Case,Timestamp,BuildVersion,BuildConfiguration,Platform,CPU");
+			for (const TPair<FString, double>& metric : inResults.Metrics)
+			{
+				csvString += TEXT(",") + metric.Key;
+			}
+			csvString += LINE_TERMINATOR;
+		}
+		csvString += FString::Printf(TEXT("%s,%s,%s,%s,%s,\"%s\""), *inResults.CaseName, *timestamp.ToIso8601(), FApp::GetBuildVersion(), *buildConfiguration, FPlatformProperties::IniPlatformName(), *cpuBrand);
+		for (const TPair<FString, double>& metric : inResults.Metrics)
+		{
+			csvString += FString::Printf(TEXT(",%.3f"), metric.Value);
+		}
+		csvString += LINE_TERMINATOR;
+		FFileHelper::SaveStringToFile(csvString, *csvPath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), FILEWRITE_Append);
+	}
+
+	static FString GetCaptureDirectory()
+	{
+		return GetOutputDirectory() / TEXT("Captures");
+	}
+
+	/** Reads a file written by ASPOctree::SaveElementDistribution. */
+	static bool LoadCapture(const FString& inFilePath, TArray<FSPOctreeElement>& OutElements)
+	{
+		TArray<FString> lines;
+		if (!FFileHelper::LoadFileToStringArray(lines, *inFilePath))
+		{
+			return false;
+		}
+
+		OutElements.Reset(lines.Num());
+		TArray<FString> values;
+		for (int32 lineIndex = 1; lineIndex < lines.Num(); lineIndex++)
+		{
+			lines[lineIndex].ParseIntoArray(values, TEXT(","));
+			if (values.Num() == 6)
+			{
+				const FVector origin(FCString::Atod(*values[0]), FCString::Atod(*values[1]), FCString::Atod(*values[2]));
+				const FVector extent(FCString::Atod(*values[3]), FCString::Atod(*values[4]), FCString::Atod(*values[5]));
+				OutElements.Emplace(nullptr, MakeBounds(origin, extent));
+			}
+		}
+		return OutElements.Num() > 0;
+	}
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FSPOctreeBenchmarkTest, "SPOctree.Benchmark", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+void FSPOctreeBenchmarkTest::GetTests(TArray<FString>& OutBeautifiedNames, TArray<FString>& OutTestCommands) const
+{
+	for (int32 distribution = 0; distribution < UE_ARRAY_COUNT(SPOctreeBenchmark::DistributionNames); distribution++)
+	{
+		for (const int32 sceneSize : SPOctreeBenchmark::SceneSizes)
+		{
+			const FString testName = FString::Printf(TEXT("%s %d"), SPOctreeBenchmark::DistributionNames[distribution], sceneSize);
+			OutBeautifiedNames.Add(testName);
+			OutTestCommands.Add(testName);
+		}
+	}
+}
+
+bool FSPOctreeBenchmarkTest::RunTest(const FString& Parameters)
+{
+	using namespace SPOctreeBenchmark;
+
+	FString distributionName;
+	FString sceneSizeString;
+	if (!Parameters.Split(TEXT(" "), &distributionName, &sceneSizeString))
+	{
+		AddError(FString::Printf(TEXT("Invalid benchmark case: %s"), *Parameters));
+		return false;
+	}
+	const int32 distributionIndex = MakeArrayView(DistributionNames).IndexOfByPredicate([&distributionName](const TCHAR* Name) { return distributionName == Name; });
+	if (distributionIndex == INDEX_NONE)
+	{
+		AddError(FString::Printf(TEXT("Unknown distribution: %s"), *distributionName));
+		return false;
+	}
+	const int32 numElements = FCString::Atoi(*sceneSizeString);
+
+	FResults results;
+	results.CaseName = Parameters;
+	results.Add(TEXT("NumElements"), numElements);
+
+	TArray<FSPOctreeElement> sceneElements;
+	GenerateScene((EDistribution)distributionIndex, numElements, sceneElements);
+
+	// Build
+	FSPOctree octree(FVector::ZeroVector, SceneExtent);
+	uint64 startCycles = FPlatformTime::Cycles64();
+	for (const FSPOctreeElement& element : sceneElements)
+	{
+		octree.AddElement(element);
+	}
+	results.Add(TEXT("BuildMs"), FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - startCycles));
+
+	int32 numNodes = 0;
+	int32 maxNodeElements = 0;
+	CountNodes(octree, numNodes, maxNodeElements);
+	results.Add(TEXT("NumNodes"), numNodes);
+	results.Add(TEXT("MaxNodeElements"), maxNodeElements);
+	results.Add(TEXT("OctreeBytes"), octree.GetSizeBytes());
+
+	FSPOctreeBakedIndex bakedIndex;
+	startCycles = FPlatformTime::Cycles64();
+	bakedIndex.Build(octree);
+	results.Add(TEXT("BakeMs"), FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - startCycles));
+	results.Add(TEXT("BakedNodes"), bakedIndex.GetNumNodes());
+	results.Add(TEXT("BakedBytes"), bakedIndex.GetAllocatedSize());
+
+	// Queries are centered on elements so dense scenes are measured where the elements are
+	FRandomStream random(SPOctreeTest::RandomSeed);
+	TArray<FBoxSphereBounds> queries;
+	for (int32 queryIndex = 0; queryIndex < NumQueries; queryIndex++)
+	{
+		queries.Add(MakeBounds(sceneElements[random.RandHelper(numElements)].BoxSphereBounds.Origin, FVector(QueryRadius)));
+	}
+
+	FTimings octreeQueryTimings;
+	int64 octreeHits = 0;
+	for (const FBoxSphereBounds& query : queries)
+	{
+		startCycles = FPlatformTime::Cycles64();
+		octree.FindElementsWithBoundsTest(FBoxCenterAndExtent(query.GetBox()), [&octreeHits](const FSPOctreeElement& /*Element*/)
+			{
+				octreeHits++;
+			});
+		octreeQueryTimings.AddCycles(FPlatformTime::Cycles64() - startCycles);
+	}
+	results.AddTimings(TEXT("OctreeQuery"), octreeQueryTimings);
+	results.Add(TEXT("OctreeHitsPerQuery"), (double)octreeHits / NumQueries);
+
+	FTimings bakedQueryTimings;
+	int64 bakedHits = 0;
+	for (const FBoxSphereBounds& query : queries)
+	{
+		startCycles = FPlatformTime::Cycles64();
+		bakedIndex.ForEachElementWithinBounds(query, false, [&bakedHits](int32 /*ElementIndex*/)
+			{
+				bakedHits++;
+			});
+		bakedQueryTimings.AddCycles(FPlatformTime::Cycles64() - startCycles);
+	}
+	results.AddTimings(TEXT("BakedQuery"), bakedQueryTimings);
+	results.Add(TEXT("BakedHitsPerQuery"), (double)bakedHits / NumQueries);
+
+	if (numElements <= MaxValidatedElements)
+	{
+		for (int32 queryIndex = 0; queryIndex < NumValidatedQueries; queryIndex++)
+		{
+			int32 numFound = 0;
+			bakedIndex.ForEachElementWithinBounds(queries[queryIndex], false, [&numFound](int32 /*ElementIndex*/)
+				{
+					numFound++;
+				});
+			TestEqual(FString::Printf(TEXT("Query %d element count"), queryIndex), numFound, CountElementsBruteForce(sceneElements, queries[queryIndex]));
+		}
+	}
+
+	// Same scene and queries on quantized elements, whose rounded bounds can add hits at the edge of a query
+	FSPOctreeQuantized quantizedOctree(FVector::ZeroVector, SceneExtent);
+	startCycles = FPlatformTime::Cycles64();
+	for (const FSPOctreeElement& element : sceneElements)
+	{
+		quantizedOctree.AddElement(nullptr, element.BoxSphereBounds);
+	}
+	results.Add(TEXT("QuantizedBuildMs"), FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - startCycles));
+	results.Add(TEXT("QuantizedBytes"), quantizedOctree.GetSizeBytes());
+
+	FTimings quantizedQueryTimings;
+	int64 quantizedHits = 0;
+	for (const FBoxSphereBounds& query : queries)
+	{
+		startCycles = FPlatformTime::Cycles64();
+		quantizedOctree.ForEachElementWithinBounds(query, false, [&quantizedHits](int32 /*ActorIndex*/, const FBox& /*ElementBox*/)
+			{
+				quantizedHits++;
+			});
+		quantizedQueryTimings.AddCycles(FPlatformTime::Cycles64() - startCycles);
+	}
+	results.AddTimings(TEXT("QuantizedQuery"), quantizedQueryTimings);
+	results.Add(TEXT("QuantizedHitsPerQuery"), (double)quantizedHits / NumQueries);
+
+	// Streaming sources bounce through the scene, diffing the elements in range like USPOctreeStreamingSourceComponent
+	struct FStreamingSource
+	{
+		FVector Location;
+		FVector Direction;
+		TSet<int32> TrackedElements;
+		TSet<int32> FoundElements;
+	};
+	TArray<FStreamingSource> sources;
+	for (int32 sourceIndex = 0; sourceIndex < NumStreamingSources; sourceIndex++)
+	{
+		FStreamingSource& source = sources.AddDefaulted_GetRef();
+		source.Location = random.RandPointInBox(FBox(FVector(-SceneExtent), FVector(SceneExtent)));
+		source.Direction = random.GetUnitVector();
+	}
+
+	FTimings streamingTimings;
+	int64 numTransitions = 0;
+	for (int32 step = 0; step < NumStreamingSteps; step++)
+	{
+		startCycles = FPlatformTime::Cycles64();
+		for (FStreamingSource& source : sources)
+		{
+			source.FoundElements.Reset();
+			bakedIndex.ForEachElementWithinBounds(MakeBounds(source.Location, FVector(StreamingRadius)), true, [&source](int32 ElementIndex)
+				{
+					source.FoundElements.Add(ElementIndex);
+				});
+
+			for (const int32 elementIndex : source.FoundElements)
+			{
+				if (!source.TrackedElements.Contains(elementIndex))
+				{
+					numTransitions++;
+				}
+			}
+			for (const int32 elementIndex : source.TrackedElements)
+			{
+				if (!source.FoundElements.Contains(elementIndex))
+				{
+					numTransitions++;
+				}
+			}
+			Swap(source.TrackedElements, source.FoundElements);
+		}
+		streamingTimings.AddCycles(FPlatformTime::Cycles64() - startCycles);
+
+		for (FStreamingSource& source : sources)
+		{
+			source.Location += source.Direction * StreamingStep;
+			for (int32 axis = 0; axis < 3; axis++)
+			{
+				if (FMath::Abs(source.Location[axis]) > SceneExtent)
+				{
+					source.Direction[axis] = -source.Direction[axis];
+				}
+			}
+		}
+	}
+	results.AddTimings(TEXT("StreamingStep"), streamingTimings);
+	results.Add(TEXT("StreamingTransitionsPerStep"), (double)numTransitions / NumStreamingSteps);
+
+	WriteResults(results);
+	for (const TPair<FString, double>& metric : results.Metrics)
+	{
+		AddInfo(FString::Printf(TEXT("%s: %.3f"), *metric.Key, metric.Value));
+	}
+
+	return true;
+}
+
+/**
+* Compares the ESPOctreeLayout configurations on the element distributions captured from real levels with
+* ASPOctree::SaveElementDistribution, one case per capture and layout. Without captures a synthetic clustered
+* scene stands in. Results go to Saved/SPOctreeBenchmarks/SPOctreeTuning.csv.
+*/
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FSPOctreeTuningTest, "SPOctree.Tuning", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+void FSPOctreeTuningTest::GetTests(TArray<FString>& OutBeautifiedNames, TArray<FString>& OutTestCommands) const
+{
+	TArray<FString> captureFiles;
+	IFileManager::Get().FindFiles(captureFiles, *(SPOctreeBenchmark::GetCaptureDirectory() / TEXT("*.csv")), true, false);
+	if (captureFiles.Num() == 0)
+	{
+		captureFiles.Add(TEXT("Synthetic"));
+	}
+
+	const UEnum* layoutEnum = StaticEnum<ESPOctreeLayout>();
+	for (const FString& captureFile : captureFiles)
+	{
+		for (int32 layout = 0; layout <= (int32)ESPOctreeLayout::Point; layout++)
+		{
+			const FString testName = FString::Printf(TEXT("%s %s"), *captureFile, *layoutEnum->GetNameStringByValue(layout));
+			OutBeautifiedNames.Add(testName);
+			OutTestCommands.Add(testName);
+		}
+	}
+}
+
+bool FSPOctreeTuningTest::RunTest(const FString& Parameters)
+{
+	using namespace SPOctreeBenchmark;
+
+	FString captureFile;
+	FString layoutName;
+	if (!Parameters.Split(TEXT(" "), &captureFile, &layoutName, ESearchCase::CaseSensitive, ESearchDir::FromEnd))
+	{
+		AddError(FString::Printf(TEXT("Invalid tuning case: %s"), *Parameters));
+		return false;
+	}
+	const int64 layoutValue = StaticEnum<ESPOctreeLayout>()->GetValueByNameString(layoutName);
+	if (layoutValue == INDEX_NONE)
+	{
+		AddError(FString::Printf(TEXT("Unknown layout: %s"), *layoutName));
+		return false;
+	}
+
+	TArray<FSPOctreeElement> sceneElements;
+	if (captureFile == TEXT("Synthetic"))
+	{
+		GenerateScene(EDistribution::Clustered, 100000, sceneElements);
+	}
+	else if (!LoadCapture(GetCaptureDirectory() / captureFile, sceneElements))
+	{
+		AddError(FString::Printf(TEXT("Could not read capture: %s"), *captureFile));
+		return false;
+	}
+	const int32 numElements = sceneElements.Num();
+
+	FBox sceneBox(ForceInit);
+	for (const FSPOctreeElement& element : sceneElements)
+	{
+		sceneBox += element.BoxSphereBounds.GetBox();
+	}
+
+	FResults results;
+	results.CaseName = Parameters;
+	results.Add(TEXT("NumElements"), numElements);
+
+	FSPOctree octree(sceneBox.GetCenter(), FMath::Max(sceneBox.GetExtent().GetMax(), 1.0), (ESPOctreeLayout)layoutValue);
+	const uint64 buildStartCycles = FPlatformTime::Cycles64();
+	for (const FSPOctreeElement& element : sceneElements)
+	{
+		octree.AddElement(element);
+	}
+	const double buildMs = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - buildStartCycles);
+	results.Add(TEXT("BuildMs"), buildMs);
+	results.Add(TEXT("InsertNs"), buildMs * 1000000.0 / FMath::Max(numElements, 1));
+
+	int32 numNodes = 0;
+	int32 maxNodeElements = 0;
+	CountNodes(octree, numNodes, maxNodeElements);
+	results.Add(TEXT("NumNodes"), numNodes);
+	results.Add(TEXT("MaxNodeElements"), maxNodeElements);
+	results.Add(TEXT("OctreeBytes"), octree.GetSizeBytes());
+
+	FRandomStream random(SPOctreeTest::RandomSeed);
+	FTimings queryTimings;
+	int64 queryHits = 0;
+	for (int32 queryIndex = 0; queryIndex < NumQueries; queryIndex++)
+	{
+		const FBoxSphereBounds query(sceneElements[random.RandHelper(numElements)].BoxSphereBounds.Origin, FVector(QueryRadius), QueryRadius);
+		const uint64 startCycles = FPlatformTime::Cycles64();
+		// The walk of ASPOctree::ForEachElementWithinBounds, with the node and element tests of the layout
+		const SPOctreeQuery::FQueryShape queryShape(query, false, octree.HasPointElements());
+		octree.FindNodesWithPredicate(
+			[&queryShape](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& NodeBounds)
+			{
+				return queryShape.IntersectsNode(NodeBounds);
+			},
+			[&octree, &queryShape, &queryHits](FSPOctree::FNodeIndex /*ParentNodeIndex*/, FSPOctree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+			{
+				for (const FSPOctreeElement& element : octree.GetElementsForNode(NodeIndex))
+				{
+					if (queryShape.ContainsElement(element))
+					{
+						queryHits++;
+					}
+				}
+			});
+		queryTimings.AddCycles(FPlatformTime::Cycles64() - startCycles);
+	}
+	results.AddTimings(TEXT("Query"), queryTimings);
+	results.Add(TEXT("HitsPerQuery"), (double)queryHits / NumQueries);
+
+	WriteResults(results, TEXT("SPOctreeTuning"));
+	for (const TPair<FString, double>& metric : results.Metrics)
+	{
+		AddInfo(FString::Printf(TEXT("%s: %.3f"), *metric.Key, metric.Value));
+	}
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
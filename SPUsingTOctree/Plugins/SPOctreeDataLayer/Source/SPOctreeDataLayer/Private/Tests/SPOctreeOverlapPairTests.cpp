@@ -0,0 +1,123 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "SPOctree.h"
+#include "SPOctreeTestHelpers.h"
+
+/**
+* Checks ASPOctree::ForEachOverlappingPair against a brute force test of every pair.
+*
+* Small and large elements are mixed so pairs cross sibling subtrees and reach into the loose bounds of
+* their neighbours. Every layout is run with and without a distance threshold.
+*/
+namespace SPOctreeOverlapPairTest
+{
+	static constexpr float OctreeExtent = 50000.0f;
+	static constexpr float SceneExtent = 20000.0f;
+	static constexpr int32 NumElements = 1500;
+	static constexpr int32 NumLargeElements = 30;
+	static constexpr float DistanceThresholds[] = { 0.0f, 1000.0f };
+	static constexpr ESPOctreeLayout Layouts[] = { ESPOctreeLayout::Default, ESPOctreeLayout::Dense, ESPOctreeLayout::Sparse, ESPOctreeLayout::Point };
+
+	typedef TPair<const AActor*, const AActor*> FActorPair;
+
+	static FActorPair MakeActorPair(const AActor* inActorA, const AActor* inActorB)
+	{
+		return inActorA < inActorB ? FActorPair(inActorA, inActorB) : FActorPair(inActorB, inActorA);
+	}
+
+	static void FindPairsBruteForce(const TArray<FSPOctreeElement>& inElements, const float inDistanceThreshold, const bool bPointElements, TSet<FActorPair>& OutPairs)
+	{
+		auto getPairBox = [bPointElements](const FSPOctreeElement& Element)
+		{
+			return bPointElements ? FBox(Element.BoxSphereBounds.Origin, Element.BoxSphereBounds.Origin) : Element.BoxSphereBounds.GetBox();
+		};
+
+		OutPairs.Reset();
+		for (int32 elementIndex = 0; elementIndex < inElements.Num(); elementIndex++)
+		{
+			const FBox pairBox = getPairBox(inElements[elementIndex]).ExpandBy(inDistanceThreshold);
+			for (int32 otherIndex = elementIndex + 1; otherIndex < inElements.Num(); otherIndex++)
+			{
+				if (pairBox.Intersect(getPairBox(inElements[otherIndex])))
+				{
+					OutPairs.Add(MakeActorPair(inElements[elementIndex].MyActor.Get(), inElements[otherIndex].MyActor.Get()));
+				}
+			}
+		}
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSPOctreeOverlapPairTest, "SPOctree.OverlapPairs", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FSPOctreeOverlapPairTest::RunTest(const FString& Parameters)
+{
+	using namespace SPOctreeOverlapPairTest;
+
+	const SPOctreeTest::FScopedTestWorld testWorld;
+	UWorld* world = testWorld.GetWorld();
+
+	FRandomStream random(SPOctreeTest::RandomSeed);
+	const FBox sceneBox(FVector(-SceneExtent), FVector(SceneExtent));
+
+	TArray<FSPOctreeElement> elements;
+	for (int32 elementIndex = 0; elementIndex < NumElements; elementIndex++)
+	{
+		// The first elements are large enough to be stored high in the tree and overlap many small ones
+		const float maxExtent = elementIndex < NumLargeElements ? 4000.0f : 600.0f;
+		const FVector extent(random.FRandRange(50.0f, maxExtent), random.FRandRange(50.0f, maxExtent), random.FRandRange(50.0f, maxExtent));
+		elements.Emplace(world->SpawnActor<AActor>(), FBoxSphereBounds(random.RandPointInBox(sceneBox), extent, extent.Size()));
+	}
+
+	for (const ESPOctreeLayout layout : Layouts)
+	{
+		ASPOctree* octree = world->SpawnActor<ASPOctree>();
+		octree->Layout = layout;
+		octree->Initialize(OctreeExtent, false);
+		for (const FSPOctreeElement& element : elements)
+		{
+			octree->AddOctreeElement(element, false);
+		}
+
+		for (const float distanceThreshold : DistanceThresholds)
+		{
+			TSet<FActorPair> expectedPairs;
+			FindPairsBruteForce(elements, distanceThreshold, layout == ESPOctreeLayout::Point, expectedPairs);
+
+			TSet<FActorPair> foundPairs;
+			int32 numDuplicates = 0;
+			octree->ForEachOverlappingPair(distanceThreshold, [&foundPairs, &numDuplicates](const FSPOctreeElement& ElementA, const FSPOctreeElement& ElementB)
+				{
+					bool bAlreadyFound = false;
+					foundPairs.Add(MakeActorPair(ElementA.MyActor.Get(), ElementB.MyActor.Get()), &bAlreadyFound);
+					numDuplicates += bAlreadyFound ? 1 : 0;
+				});
+
+			int32 numMissing = 0;
+			for (const FActorPair& pair : expectedPairs)
+			{
+				numMissing += foundPairs.Contains(pair) ? 0 : 1;
+			}
+
+			const FString context = FString::Printf(TEXT("Layout %d threshold %.0f"), (int32)layout, distanceThreshold);
+			// Origins of the Point layout only pair within a threshold
+			if (layout != ESPOctreeLayout::Point || distanceThreshold > 0.0f)
+			{
+				TestTrue(*FString::Printf(TEXT("%s: the scene has overlapping pairs"), *context), expectedPairs.Num() > 0);
+			}
+			TestEqual(*FString::Printf(TEXT("%s: pairs missed"), *context), numMissing, 0);
+			TestEqual(*FString::Printf(TEXT("%s: pairs not overlapping"), *context), foundPairs.Num() - (expectedPairs.Num() - numMissing), 0);
+			TestEqual(*FString::Printf(TEXT("%s: pairs reported twice"), *context), numDuplicates, 0);
+		}
+
+		octree->Destroy();
+	}
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
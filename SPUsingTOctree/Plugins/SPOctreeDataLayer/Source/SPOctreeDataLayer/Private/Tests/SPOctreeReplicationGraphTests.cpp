@@ -0,0 +1,210 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "SPOctreeReplicationGraphNode.h"
+#include "SPOctreeTestHelpers.h"
+#include "Engine/StaticMeshActor.h"
+#include "Components/StaticMeshComponent.h"
+
+/**
+* Runs USPOctreeReplicationGraphNode against simulated connections, without a net driver.
+*
+* Every connection is a bare UNetReplicationGraphConnection used as the key of its cache. A first pass with zero
+* tolerances must match a brute force distance scan exactly. A second pass keeps the default tolerances and moves
+* actors and viewers by less than them, so lists are served from the cache, and checks every list actor by actor
+* within the distance the tolerances allow. The frame time of all connections is reported for both passes.
+*/
+namespace SPOctreeReplicationGraphTest
+{
+	static constexpr float SceneExtent = 200000.0f;
+	static constexpr int32 NumActors = 5000;
+	static constexpr int32 NumMovingActors = 500;
+	static constexpr int32 NumConnections = 128;
+	static constexpr int32 NumFrames = 60;
+
+	/** Steps of the exact pass, every move is re-indexed and every viewer move queries again. */
+	static constexpr float ExactActorStep = 300.0f;
+	static constexpr float ExactViewerStep = 500.0f;
+
+	/** Steps of the tolerant pass, below the default tolerances so moves add up over a few frames. */
+	static constexpr float TolerantActorStep = 40.0f;
+	static constexpr float TolerantViewerStep = 40.0f;
+
+	struct FPassResults
+	{
+		double TotalFrameMs = 0.0;
+		double MaxFrameMs = 0.0;
+		int64 TotalRelevantActors = 0;
+		int32 CacheHits = 0;
+		int32 CacheMisses = 0;
+
+		/** Listed actors further than the tolerances allow. */
+		int32 NumOutOfRange = 0;
+
+		/** Actors too close for the tolerances to excuse, but missing from the list. */
+		int32 NumMissing = 0;
+
+		int32 NumDuplicates = 0;
+	};
+
+	static USPOctreeReplicationGraphNode* CreateNode(const TArray<AActor*>& inActors)
+	{
+		USPOctreeReplicationGraphNode* node = NewObject<USPOctreeReplicationGraphNode>();
+		for (AActor* actor : inActors)
+		{
+			node->NotifyAddNetworkActor(FNewReplicatedActorInfo(actor));
+		}
+		return node;
+	}
+
+	/**
+	* Moves actors and viewers for NumFrames and gathers every connection each frame. A list holds the actors whose
+	* indexed location is within CullDistance of the location its viewer was gathered at. Actors are re-indexed past
+	* RelocationTolerance and viewers gathered again past ViewerMoveTolerance, so with slack the sum of both, a list
+	* must hold every actor within CullDistance - slack and none beyond CullDistance + slack.
+	*/
+	static void RunPass(USPOctreeReplicationGraphNode* inNode, const TArray<AActor*>& inActors, const TArray<UNetReplicationGraphConnection*>& inConnections, TArray<FVector>& InOutViewLocations,
+		const TArray<FVector>& inViewDirections, const float inActorStep, const float inViewerStep, FRandomStream& inRandom, FPassResults& OutResults)
+	{
+		const double slack = (double)inNode->RelocationTolerance + inNode->ViewerMoveTolerance;
+		const double maxDistanceSquared = FMath::Square(inNode->CullDistance + slack);
+		const double minDistanceSquared = inNode->CullDistance > slack ? FMath::Square(inNode->CullDistance - slack) : -1.0;
+
+		TSet<const AActor*> listedActors;
+		for (int32 frame = 0; frame < NumFrames; frame++)
+		{
+			for (int32 actorIndex = 0; actorIndex < NumMovingActors; actorIndex++)
+			{
+				AActor* actor = inActors[inRandom.RandHelper(inActors.Num())];
+				actor->SetActorLocation(actor->GetActorLocation() + inRandom.GetUnitVector() * inActorStep);
+			}
+			for (int32 connectionIndex = 0; connectionIndex < inConnections.Num(); connectionIndex++)
+			{
+				InOutViewLocations[connectionIndex] += inViewDirections[connectionIndex] * inViewerStep;
+			}
+
+			int32 startCacheHits = 0;
+			int32 startCacheMisses = 0;
+			inNode->GetCacheStats(startCacheHits, startCacheMisses);
+
+			const uint64 startCycles = FPlatformTime::Cycles64();
+			inNode->PrepareForReplication();
+			for (int32 connectionIndex = 0; connectionIndex < inConnections.Num(); connectionIndex++)
+			{
+				inNode->GetRelevantActors(inConnections[connectionIndex], MakeArrayView(&InOutViewLocations[connectionIndex], 1));
+			}
+			const double frameMs = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - startCycles);
+			OutResults.TotalFrameMs += frameMs;
+			OutResults.MaxFrameMs = FMath::Max(OutResults.MaxFrameMs, frameMs);
+
+			// Validation reads every list again from its cache, which is kept out of the stats
+			int32 cacheHits = 0;
+			int32 cacheMisses = 0;
+			inNode->GetCacheStats(cacheHits, cacheMisses);
+			OutResults.CacheHits += cacheHits - startCacheHits;
+			OutResults.CacheMisses += cacheMisses - startCacheMisses;
+
+			for (int32 connectionIndex = 0; connectionIndex < inConnections.Num(); connectionIndex++)
+			{
+				const FVector& viewLocation = InOutViewLocations[connectionIndex];
+				const FActorRepListRefView& relevantActors = inNode->GetRelevantActors(inConnections[connectionIndex], MakeArrayView(&viewLocation, 1));
+				OutResults.TotalRelevantActors += relevantActors.Num();
+
+				listedActors.Reset();
+				for (int32 listIndex = 0; listIndex < relevantActors.Num(); listIndex++)
+				{
+					const AActor* actor = relevantActors[listIndex];
+					bool bAlreadyListed = false;
+					listedActors.Add(actor, &bAlreadyListed);
+					OutResults.NumDuplicates += bAlreadyListed ? 1 : 0;
+					OutResults.NumOutOfRange += FVector::DistSquared(actor->GetActorLocation(), viewLocation) > maxDistanceSquared ? 1 : 0;
+				}
+
+				for (const AActor* actor : inActors)
+				{
+					if (FVector::DistSquared(actor->GetActorLocation(), viewLocation) <= minDistanceSquared && !listedActors.Contains(actor))
+					{
+						OutResults.NumMissing++;
+					}
+				}
+			}
+		}
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSPOctreeReplicationGraphTest, "SPOctree.ReplicationGraph", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FSPOctreeReplicationGraphTest::RunTest(const FString& Parameters)
+{
+	using namespace SPOctreeReplicationGraphTest;
+
+	const SPOctreeTest::FScopedTestWorld testWorld;
+	UWorld* world = testWorld.GetWorld();
+
+	FRandomStream random(SPOctreeTest::RandomSeed);
+	const FBox sceneBox(FVector(-SceneExtent), FVector(SceneExtent));
+
+	TArray<AActor*> actors;
+	for (int32 actorIndex = 0; actorIndex < NumActors; actorIndex++)
+	{
+		AStaticMeshActor* actor = world->SpawnActor<AStaticMeshActor>(random.RandPointInBox(sceneBox), FRotator::ZeroRotator);
+		actor->GetStaticMeshComponent()->SetMobility(EComponentMobility::Movable);
+		actors.Add(actor);
+	}
+
+	// Half of the viewers stand still, so their connections answer from their cache
+	TArray<UNetReplicationGraphConnection*> connections;
+	TArray<FVector> viewLocations;
+	TArray<FVector> viewDirections;
+	for (int32 connectionIndex = 0; connectionIndex < NumConnections; connectionIndex++)
+	{
+		connections.Add(NewObject<UNetReplicationGraphConnection>());
+		viewLocations.Add(random.RandPointInBox(sceneBox));
+		viewDirections.Add(connectionIndex % 2 == 0 ? random.GetUnitVector() : FVector::ZeroVector);
+	}
+
+	// Exact answers, every list must be the brute force set
+	USPOctreeReplicationGraphNode* exactNode = CreateNode(actors);
+	exactNode->RelocationTolerance = 0.0f;
+	exactNode->ViewerMoveTolerance = 0.0f;
+	TestEqual(TEXT("Indexed actors"), exactNode->GetNumActors(), NumActors);
+
+	FPassResults exactResults;
+	RunPass(exactNode, actors, connections, viewLocations, viewDirections, ExactActorStep, ExactViewerStep, random, exactResults);
+	TestEqual(TEXT("Exact: listed actors beyond CullDistance"), exactResults.NumOutOfRange, 0);
+	TestEqual(TEXT("Exact: actors within CullDistance missing from their list"), exactResults.NumMissing, 0);
+	TestEqual(TEXT("Exact: actors listed twice"), exactResults.NumDuplicates, 0);
+	TestTrue(TEXT("Exact: still viewers answer from their cache"), exactResults.CacheHits > 0);
+
+	// Default tolerances, moving viewers also answer from their cache until they leave ViewerMoveTolerance
+	USPOctreeReplicationGraphNode* tolerantNode = CreateNode(actors);
+	FPassResults tolerantResults;
+	RunPass(tolerantNode, actors, connections, viewLocations, viewDirections, TolerantActorStep, TolerantViewerStep, random, tolerantResults);
+	TestEqual(TEXT("Tolerant: listed actors beyond CullDistance and the tolerances"), tolerantResults.NumOutOfRange, 0);
+	TestEqual(TEXT("Tolerant: actors within CullDistance less the tolerances missing from their list"), tolerantResults.NumMissing, 0);
+	TestEqual(TEXT("Tolerant: actors listed twice"), tolerantResults.NumDuplicates, 0);
+	TestTrue(TEXT("Tolerant: moving viewers answer from their cache"), tolerantResults.CacheHits > exactResults.CacheHits);
+
+	const FPassResults* passResults[] = { &exactResults, &tolerantResults };
+	const TCHAR* passNames[] = { TEXT("Exact"), TEXT("Tolerant") };
+	for (int32 passIndex = 0; passIndex < UE_ARRAY_COUNT(passResults); passIndex++)
+	{
+		const FPassResults& results = *passResults[passIndex];
+		AddInfo(FString::Printf(TEXT("%s Connections: %d Actors: %d FrameMeanMs: %.3f FrameMaxMs: %.3f RelevantActorsPerConnection: %.1f CacheHits: %d CacheMisses: %d"),
+			passNames[passIndex], NumConnections, NumActors, results.TotalFrameMs / NumFrames, results.MaxFrameMs, (double)results.TotalRelevantActors / (NumFrames * NumConnections), results.CacheHits, results.CacheMisses));
+	}
+
+	for (int32 actorIndex = 0; actorIndex < NumActors / 2; actorIndex++)
+	{
+		tolerantNode->NotifyRemoveNetworkActor(FNewReplicatedActorInfo(actors[actorIndex]));
+	}
+	TestEqual(TEXT("Actors left after removal"), tolerantNode->GetNumActors(), NumActors - NumActors / 2);
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,48 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+
+/** Setup shared by the SPOctree automation tests, see the README for how to run them headless. */
+namespace SPOctreeTest
+{
+	/** Seed of every synthetic scene, so runs can be compared with each other. */
+	static constexpr int32 RandomSeed = 0x5B0C7;
+
+	/** Game world with its own world context for the length of a test, so actors can be spawned without a map. */
+	class FScopedTestWorld
+	{
+	public:
+		FScopedTestWorld()
+		{
+			World = UWorld::CreateWorld(EWorldType::Game, false);
+			FWorldContext& worldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+			worldContext.SetCurrentWorld(World);
+		}
+
+		~FScopedTestWorld()
+		{
+			GEngine->DestroyWorldContext(World);
+			World->DestroyWorld(false);
+		}
+
+		FScopedTestWorld(const FScopedTestWorld&) = delete;
+		FScopedTestWorld& operator=(const FScopedTestWorld&) = delete;
+
+		FORCEINLINE UWorld* GetWorld() const
+		{
+			return World;
+		}
+
+	private:
+		UWorld* World;
+	};
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,127 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "SPOctree.h"
+#include "SPOctreeTestHelpers.h"
+#include "Components/BoxComponent.h"
+
+/**
+* Checks that actors whose bounds shrink and shift inside their old bounds are still found at their new location.
+*
+* Half of the actors go through UpdateActorBounds and the other half through MarkActorDirty and FlushDirtyActors.
+* The Point layout places elements by origin, so there the shifted origins must relocate their elements.
+*/
+namespace SPOctreeUpdateTest
+{
+	static constexpr float OctreeExtent = 50000.0f;
+	static constexpr float SceneExtent = 20000.0f;
+	static constexpr int32 NumActors = 2000;
+	static constexpr float OldExtent = 2000.0f;
+	static constexpr float NewExtent = 200.0f;
+
+	/** Keeps the new box inside the old one, OldExtent - NewExtent at most on every axis. */
+	static constexpr float MaxShift = 1500.0f;
+
+	static constexpr ESPOctreeLayout Layouts[] = { ESPOctreeLayout::Default, ESPOctreeLayout::Dense, ESPOctreeLayout::Sparse, ESPOctreeLayout::Point };
+
+	/** Gives an actor a box of the given extent at a location, which is what GetActorElementBounds reads. */
+	static void SetActorBox(AActor* inActor, const FVector& inLocation, const float inExtent)
+	{
+		UBoxComponent* box = CastChecked<UBoxComponent>(inActor->GetRootComponent());
+		box->SetBoxExtent(FVector(inExtent));
+		inActor->SetActorLocation(inLocation);
+	}
+
+	static AActor* SpawnBoxActor(UWorld* inWorld)
+	{
+		AActor* actor = inWorld->SpawnActor<AActor>();
+		UBoxComponent* box = NewObject<UBoxComponent>(actor);
+		box->SetMobility(EComponentMobility::Movable);
+		actor->SetRootComponent(box);
+		box->RegisterComponent();
+		return actor;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSPOctreeUpdateTest, "SPOctree.UpdateBounds", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FSPOctreeUpdateTest::RunTest(const FString& Parameters)
+{
+	using namespace SPOctreeUpdateTest;
+
+	const SPOctreeTest::FScopedTestWorld testWorld;
+	UWorld* world = testWorld.GetWorld();
+
+	FRandomStream random(SPOctreeTest::RandomSeed);
+	const FBox sceneBox(FVector(-SceneExtent), FVector(SceneExtent));
+	const FBox shiftBox(FVector(-MaxShift), FVector(MaxShift));
+
+	TArray<AActor*> actors;
+	TArray<FVector> oldLocations;
+	TArray<FVector> newLocations;
+	for (int32 actorIndex = 0; actorIndex < NumActors; actorIndex++)
+	{
+		actors.Add(SpawnBoxActor(world));
+		oldLocations.Add(random.RandPointInBox(sceneBox));
+		newLocations.Add(oldLocations.Last() + random.RandPointInBox(shiftBox));
+	}
+
+	for (const ESPOctreeLayout layout : Layouts)
+	{
+		for (int32 actorIndex = 0; actorIndex < NumActors; actorIndex++)
+		{
+			SetActorBox(actors[actorIndex], oldLocations[actorIndex], OldExtent);
+		}
+
+		ASPOctree* octree = world->SpawnActor<ASPOctree>();
+		octree->Layout = layout;
+		octree->Initialize(OctreeExtent, false);
+		octree->AddActorsToOctree(actors, false);
+
+		for (int32 actorIndex = 0; actorIndex < NumActors; actorIndex++)
+		{
+			SetActorBox(actors[actorIndex], newLocations[actorIndex], NewExtent);
+			if (actorIndex % 2 == 0)
+			{
+				octree->UpdateActorBounds(actors[actorIndex]);
+			}
+			else
+			{
+				octree->MarkActorDirty(actors[actorIndex]);
+			}
+		}
+		octree->FlushDirtyActors();
+
+		// A query around the new origin only reaches the nodes there
+		int32 numMissing = 0;
+		int32 numStale = 0;
+		for (int32 actorIndex = 0; actorIndex < NumActors; actorIndex++)
+		{
+			const FVector origin = ASPOctree::GetActorElementBounds(actors[actorIndex]).Origin;
+			bool bFound = false;
+			octree->ForEachElementWithinBounds(FBoxSphereBounds(origin, FVector(1.0f), 1.0f), false, [&actors, &bFound, &numStale, &origin, actorIndex](const FSPOctreeElement& Element)
+				{
+					if (Element.MyActor == actors[actorIndex])
+					{
+						bFound = true;
+						numStale += Element.BoxSphereBounds.Origin.Equals(origin) ? 0 : 1;
+					}
+				});
+			numMissing += bFound ? 0 : 1;
+		}
+
+		const FString context = FString::Printf(TEXT("Layout %d"), (int32)layout);
+		TestEqual(*FString::Printf(TEXT("%s: actors missed at their new location"), *context), numMissing, 0);
+		TestEqual(*FString::Printf(TEXT("%s: elements with old bounds"), *context), numStale, 0);
+
+		octree->Destroy();
+	}
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
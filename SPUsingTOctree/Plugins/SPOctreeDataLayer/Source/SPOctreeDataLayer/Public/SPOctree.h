@@ -5,8 +5,12 @@
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
 #include "Math/GenericOctree.h"
+#include "Async/Future.h"
 #include "SPOctree.generated.h"
 
+/** Maps each indexed actor to the id of its element inside the owning FSPOctree. */
+typedef TMap<TObjectPtr<AActor>, FOctreeElementId2> FSPOctreeElementIdMap;
+
 USTRUCT(BlueprintType, Blueprintable)
 struct FSPOctreeElement
 {
@@ -18,6 +22,12 @@ struct FSPOctreeElement
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Element Struct")
 	FBoxSphereBounds BoxSphereBounds;
 
+	/** Id table of the octree holding this element, kept up to date by TSPOctreeSemantics::SetElementId. */
+	FSPOctreeElementIdMap* ElementIds = nullptr;
+
+	/** One bit per class and tag the owning octree filters on that MyActor matches, see ASPOctree::ForEachActorWithinBounds. */
+	uint64 FilterMask = 0;
+
 	FSPOctreeElement()
 	{
 		BoxSphereBounds = FBoxSphereBounds(FVector(0.0f, 0.0f, 0.0f), FVector(1.0f, 1.0f, 1.0f), 1.0f);
@@ -35,25 +45,219 @@ struct FSPOctreeElement
 	}
 };
 
-struct FSPOctreeSematics
+/** Shape of one query in a batch, with the same meaning as the GetElementsWithinBounds parameters. */
+USTRUCT(BlueprintType, Blueprintable)
+struct FSPOctreeQuery
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Query Struct")
+	FBoxSphereBounds Bounds;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Query Struct")
+	bool bSphereOnlyTest = false;
+
+	FSPOctreeQuery()
+	{
+		Bounds = FBoxSphereBounds(FVector(0.0f, 0.0f, 0.0f), FVector(1.0f, 1.0f, 1.0f), 1.0f);
+	}
+
+	FSPOctreeQuery(const FBoxSphereBounds& inBounds, const bool inSphereOnlyTest)
+	{
+		Bounds = inBounds;
+		bSphereOnlyTest = inSphereOnlyTest;
+	}
+};
+
+/**
+* Results of a batch of queries packed into one array. The elements found by query i are
+* Elements[ResultStart[i]] to Elements[ResultStart[i] + ResultCount[i] - 1].
+*/
+USTRUCT(BlueprintType, Blueprintable)
+struct FSPOctreeQueryResults
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Query Struct")
+	TArray<FSPOctreeElement> Elements;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Query Struct")
+	TArray<int32> ResultStart;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Query Struct")
+	TArray<int32> ResultCount;
+
+	/** Weak reference to the actor of every element, filled by batches run on other threads, see RemoveStaleElements. */
+	TArray<TWeakObjectPtr<AActor>> ElementActors;
+
+	/** ASPOctree::GetContentVersion of the Octree the batch was run against, 0 when not run by ASPOctree::QueryAsync. */
+	uint32 ContentVersion = 0;
+
+	TArrayView<const FSPOctreeElement> GetResults(int32 inQueryIndex) const
+	{
+		return TArrayView<const FSPOctreeElement>(Elements.GetData() + ResultStart[inQueryIndex], ResultCount[inQueryIndex]);
+	}
+
+	/**
+	* Drops the elements whose actor was destroyed or unloaded since the batch ran, and points MyActor of the others
+	* at their live actor. Call it on the game thread before reading MyActor of results made on another thread.
+	* Does nothing when ElementActors was not filled.
+	*/
+	SPOCTREEDATALAYER_API void RemoveStaleElements();
+};
+
+/** Two actors whose element bounds overlap, see ASPOctree::GetOverlappingPairs. A is the actor with the lower unique id. */
+USTRUCT(BlueprintType, Blueprintable)
+struct FSPOctreeOverlapPair
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Query Struct")
+	TObjectPtr<AActor> A = nullptr;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Query Struct")
+	TObjectPtr<AActor> B = nullptr;
+
+	FSPOctreeOverlapPair()
+	{
+	}
+
+	FSPOctreeOverlapPair(AActor* inA, AActor* inB)
+	{
+		const bool bSwap = inA->GetUniqueID() > inB->GetUniqueID();
+		A = bSwap ? inB : inA;
+		B = bSwap ? inA : inB;
+	}
+
+	bool operator==(const FSPOctreeOverlapPair& OtherPair) const
+	{
+		return A == OtherPair.A && B == OtherPair.B;
+	}
+
+	friend uint32 GetTypeHash(const FSPOctreeOverlapPair& Pair)
+	{
+		return HashCombine(GetTypeHash(Pair.A), GetTypeHash(Pair.B));
+	}
+};
+
+/** Element hit by ASPOctree::LineTraceElements. */
+USTRUCT(BlueprintType, Blueprintable)
+struct FSPOctreeRayHit
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Query Struct")
+	FSPOctreeElement Element;
+
+	/** Distance from the trace start to where the trace enters the element bounds. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Query Struct")
+	float Distance = 0.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Query Struct")
+	FVector Location = FVector::ZeroVector;
+};
+
+/** Region of an ASPOctree whose actors live in their own runtime Data Layer, see ASPOctree::BuildDataLayerCells. */
+USTRUCT(BlueprintType, Blueprintable)
+struct FSPOctreeDataLayerCell
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Data Layer Struct")
+	FBox Bounds = FBox(ForceInit);
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Octree Data Layer Struct")
+	FName DataLayerLabel;
+};
+
+namespace SPOctreeMath
+{
+	/**
+	* Clips the segment Start + Direction * t, t in [0, 1], against a box.
+	* @param OutEntryTime	t at which the segment enters the box, 0 when it starts inside
+	* @return true if the segment touches the box
+	*/
+	FORCEINLINE bool SegmentIntersectsBox(const FVector& Start, const FVector& Direction, const FBox& Box, double& OutEntryTime)
+	{
+		double entryTime = 0.0;
+		double exitTime = 1.0;
+		for (int32 axis = 0; axis < 3; axis++)
+		{
+			if (FMath::Abs(Direction[axis]) < SMALL_NUMBER)
+			{
+				if (Start[axis] < Box.Min[axis] || Start[axis] > Box.Max[axis])
+				{
+					return false;
+				}
+				continue;
+			}
+
+			const double inverseDirection = 1.0 / Direction[axis];
+			double slabEntry = (Box.Min[axis] - Start[axis]) * inverseDirection;
+			double slabExit = (Box.Max[axis] - Start[axis]) * inverseDirection;
+			if (slabEntry > slabExit)
+			{
+				Swap(slabEntry, slabExit);
+			}
+			entryTime = FMath::Max(entryTime, slabEntry);
+			exitTime = FMath::Min(exitTime, slabExit);
+			if (entryTime > exitTime)
+			{
+				return false;
+			}
+		}
+		OutEntryTime = entryTime;
+		return true;
+	}
+}
+
+DECLARE_DYNAMIC_DELEGATE_OneParam(FSPOctreeQueryCompleteDelegate, const FSPOctreeQueryResults&, Results);
+
+/** Leaf size, node size and depth of the Octree of an ASPOctree, see TSPOctreeSemantics. */
+UENUM(BlueprintType)
+enum class ESPOctreeLayout : uint8
+{
+	/** Two elements per leaf, down to depth 12. */
+	Default,
+	/** Small leaves down to depth 16, for many small actors packed close together. */
+	Dense,
+	/** Large leaves and a shallow tree, for few actors spread over a large world. */
+	Sparse,
+	/**
+	* Elements are indexed and matched by their origin only, for actors whose bounds do not matter such
+	* as spawn points or pickups. Bounds, convex volume, overlap and nearest queries skip the element box
+	* tests, live or baked, and line traces are not supported.
+	*/
+	Point,
+};
+
+template<int32 InMaxElementsPerLeaf, int32 InMinInclusiveElementsPerNode, int32 InMaxNodeDepth, bool bInPointElements = false>
+struct TSPOctreeSemantics
 {
-	enum { MaxElementsPerLeaf = 2 }; // 16
-	enum { MinInclusiveElementsPerNode = 7 };
-	enum { MaxNodeDepth = 12 };
+	enum { MaxElementsPerLeaf = InMaxElementsPerLeaf };
+	enum { MinInclusiveElementsPerNode = InMinInclusiveElementsPerNode };
+	enum { MaxNodeDepth = InMaxNodeDepth };
+	enum { bPointElements = bInPointElements };
 
 	typedef TInlineAllocator<MaxElementsPerLeaf> ElementAllocator;
 
 	/**
-	* Get the bounding box of the provided octree element. In this case, the box
-	* is merely the point specified by the element.
+	* Get the bounding box of the provided octree element, only its origin for point elements.
 	*
 	* @param	Element	Octree element to get the bounding box for
 	*
 	* @return	Bounding box of the provided octree element
 	*/
-	FORCEINLINE static FBoxSphereBounds GetBoundingBox(const FSPOctreeElement& Element)
+	FORCEINLINE static FBoxCenterAndExtent GetBoundingBox(const FSPOctreeElement& Element)
 	{
-		return Element.BoxSphereBounds;
+		if constexpr (bInPointElements)
+		{
+			return FBoxCenterAndExtent(Element.BoxSphereBounds.Origin, FVector::ZeroVector);
+		}
+		else
+		{
+			return FBoxCenterAndExtent(Element.BoxSphereBounds);
+		}
 	}
 
 	FORCEINLINE static bool AreElementsEqual(const FSPOctreeElement& A, const FSPOctreeElement& B)
@@ -61,8 +265,16 @@ struct FSPOctreeSematics
 		return A.MyActor == B.MyActor;
 	}
 
+	/**
+	* Called by TOctree2 whenever an element is added or moved to a new slot,
+	* which lets ASPOctree find the element again by actor.
+	*/
 	FORCEINLINE static void SetElementId(const FSPOctreeElement& Element, FOctreeElementId2 Id)
 	{
+		if (Element.ElementIds && Element.MyActor)
+		{
+			Element.ElementIds->Add(Element.MyActor, Id);
+		}
 	}
 
 	FORCEINLINE static void ApplyOffset(FSPOctreeElement& Element, FVector Offset)
@@ -74,7 +286,246 @@ struct FSPOctreeSematics
 
 };
 
-typedef TOctree2<FSPOctreeElement, FSPOctreeSematics> FSPOctree;
+typedef TSPOctreeSemantics<2, 7, 12> FSPOctreeSematics;
+typedef TSPOctreeSemantics<4, 3, 16> FSPOctreeDenseSemantics;
+typedef TSPOctreeSemantics<32, 16, 8> FSPOctreeSparseSemantics;
+typedef TSPOctreeSemantics<16, 7, 12, true> FSPOctreePointSemantics;
+
+template<typename SemanticsType>
+class TSPOctreeLayoutTree;
+
+/**
+* TOctree2 of FSPOctreeElement with the semantics of an ESPOctreeLayout, picked when the tree is created.
+* Offers the part of the TOctree2 interface the plugin uses. Changes to the tree go to the tree of the layout
+* through one virtual call. Walks and GetElementsForNode switch on the layout and run the TOctree2 of that layout
+* with the visitors inlined, so no node or element is reached through a virtual call or a TFunctionRef.
+*/
+class SPOCTREEDATALAYER_API FSPOctree
+{
+public:
+	typedef uint32 FNodeIndex;
+
+	/** Deepest node of any layout, for the stacks of the node walks. */
+	enum { MaxNodeDepth = 16 };
+
+	FSPOctree(const FVector& inOrigin, const FVector::FReal inExtent, const ESPOctreeLayout inLayout = ESPOctreeLayout::Default);
+	~FSPOctree();
+
+	FORCEINLINE ESPOctreeLayout GetLayout() const
+	{
+		return Layout;
+	}
+
+	/** Whether elements are indexed by their origin only, see ESPOctreeLayout::Point. */
+	FORCEINLINE bool HasPointElements() const
+	{
+		return Layout == ESPOctreeLayout::Point;
+	}
+
+	/**
+	* Whether an element can take new bounds without leaving its node. The node holding a box holds anything inside
+	* it, but point elements are placed by their origin and only stay while it does not move.
+	* @param inOldBounds	Bounds the element was added with
+	* @param inNewBounds	Bounds it moves to
+	*/
+	FORCEINLINE bool CanUpdateInPlace(const FBoxSphereBounds& inOldBounds, const FBoxSphereBounds& inNewBounds) const
+	{
+		if (HasPointElements())
+		{
+			return inOldBounds.Origin == inNewBounds.Origin;
+		}
+		return inOldBounds.GetBox().IsInsideOrOn(inNewBounds.GetBox());
+	}
+
+	void AddElement(const FSPOctreeElement& inElement);
+	void RemoveElement(FOctreeElementId2 inElementId);
+	bool IsValidElementId(FOctreeElementId2 inElementId) const;
+	FSPOctreeElement& GetElementById(FOctreeElementId2 inElementId);
+	const FSPOctreeElement& GetElementById(FOctreeElementId2 inElementId) const;
+	FBoxCenterAndExtent GetRootBounds() const;
+	SIZE_T GetSizeBytes() const;
+	void Destroy();
+
+	FORCEINLINE TArrayView<const FSPOctreeElement> GetElementsForNode(FNodeIndex inNodeIndex) const;
+
+	template<typename IterateFunc>
+	FORCEINLINE void FindAllElements(const IterateFunc& Func) const
+	{
+		VisitLayoutOctree([&Func](const auto& LayoutOctree) { LayoutOctree.FindAllElements(Func); });
+	}
+
+	template<typename IterateFunc>
+	FORCEINLINE void FindElementsWithBoundsTest(const FBoxCenterAndExtent& inBoxBounds, const IterateFunc& Func) const
+	{
+		VisitLayoutOctree([&inBoxBounds, &Func](const auto& LayoutOctree) { LayoutOctree.FindElementsWithBoundsTest(inBoxBounds, Func); });
+	}
+
+	/** Same as TOctree2::FindNodesWithPredicate, parents are visited before their children. */
+	template<typename PredicateFunc, typename IterateFunc>
+	FORCEINLINE void FindNodesWithPredicate(const PredicateFunc& Predicate, const IterateFunc& Func) const
+	{
+		VisitLayoutOctree([&Predicate, &Func](const auto& LayoutOctree) { LayoutOctree.FindNodesWithPredicate(Predicate, Func); });
+	}
+
+	/** Tree of one layout, implemented by TSPOctreeLayoutTree. */
+	class FTree
+	{
+	public:
+		virtual ~FTree() {}
+		virtual void AddElement(const FSPOctreeElement& inElement) = 0;
+		virtual void RemoveElement(FOctreeElementId2 inElementId) = 0;
+		virtual bool IsValidElementId(FOctreeElementId2 inElementId) const = 0;
+		virtual FSPOctreeElement& GetElementById(FOctreeElementId2 inElementId) = 0;
+		virtual FBoxCenterAndExtent GetRootBounds() const = 0;
+		virtual SIZE_T GetSizeBytes() const = 0;
+		virtual void Destroy() = 0;
+	};
+
+private:
+	/** Calls inFunc with the TOctree2 of the layout and returns what it returns. */
+	template<typename FuncType>
+	FORCEINLINE decltype(auto) VisitLayoutOctree(const FuncType& inFunc) const;
+
+	ESPOctreeLayout Layout;
+	TUniquePtr<FTree> Tree;
+};
+
+/** FSPOctree::FTree backed by the TOctree2 of one set of semantics. */
+template<typename SemanticsType>
+class TSPOctreeLayoutTree : public FSPOctree::FTree
+{
+public:
+	typedef TOctree2<FSPOctreeElement, SemanticsType> FLayoutOctree;
+
+	static_assert(std::is_same<typename FLayoutOctree::FNodeIndex, FSPOctree::FNodeIndex>::value, "FSPOctree::FNodeIndex must match TOctree2");
+	static_assert(SemanticsType::MaxNodeDepth <= FSPOctree::MaxNodeDepth, "FSPOctree::MaxNodeDepth must cover every layout");
+
+	TSPOctreeLayoutTree(const FVector& inOrigin, const FVector::FReal inExtent)
+		: Octree(inOrigin, inExtent)
+	{
+	}
+
+	virtual void AddElement(const FSPOctreeElement& inElement) override
+	{
+		Octree.AddElement(inElement);
+	}
+
+	virtual void RemoveElement(FOctreeElementId2 inElementId) override
+	{
+		Octree.RemoveElement(inElementId);
+	}
+
+	virtual bool IsValidElementId(FOctreeElementId2 inElementId) const override
+	{
+		return Octree.IsValidElementId(inElementId);
+	}
+
+	virtual FSPOctreeElement& GetElementById(FOctreeElementId2 inElementId) override
+	{
+		return Octree.GetElementById(inElementId);
+	}
+
+	virtual FBoxCenterAndExtent GetRootBounds() const override
+	{
+		return Octree.GetRootBounds();
+	}
+
+	virtual SIZE_T GetSizeBytes() const override
+	{
+		return Octree.GetSizeBytes();
+	}
+
+	virtual void Destroy() override
+	{
+		Octree.Destroy();
+	}
+
+	FORCEINLINE const FLayoutOctree& GetOctree() const
+	{
+		return Octree;
+	}
+
+private:
+	FLayoutOctree Octree;
+};
+
+template<typename FuncType>
+FORCEINLINE decltype(auto) FSPOctree::VisitLayoutOctree(const FuncType& inFunc) const
+{
+	// The constructor only leaves the four layouts below, Default included
+	switch (Layout)
+	{
+	case ESPOctreeLayout::Dense:
+		return inFunc(static_cast<const TSPOctreeLayoutTree<FSPOctreeDenseSemantics>&>(*Tree).GetOctree());
+	case ESPOctreeLayout::Sparse:
+		return inFunc(static_cast<const TSPOctreeLayoutTree<FSPOctreeSparseSemantics>&>(*Tree).GetOctree());
+	case ESPOctreeLayout::Point:
+		return inFunc(static_cast<const TSPOctreeLayoutTree<FSPOctreePointSemantics>&>(*Tree).GetOctree());
+	default:
+		return inFunc(static_cast<const TSPOctreeLayoutTree<FSPOctreeSematics>&>(*Tree).GetOctree());
+	}
+}
+
+FORCEINLINE TArrayView<const FSPOctreeElement> FSPOctree::GetElementsForNode(FNodeIndex inNodeIndex) const
+{
+	return VisitLayoutOctree([inNodeIndex](const auto& LayoutOctree) { return TArrayView<const FSPOctreeElement>(LayoutOctree.GetElementsForNode(inNodeIndex)); });
+}
+
+namespace SPOctreeQuery
+{
+	/** Box and sphere of a bounds query, with the tests shared by all bounds queries. */
+	struct FQueryShape
+	{
+		FBox Box;
+		FSphere Sphere;
+		FBox SphereBox;
+		bool bSphereOnlyTest;
+		bool bPointElements;
+
+		FQueryShape(const FBoxSphereBounds& inBoundingBoxQuery, const bool inSphereOnlyTest, const bool inPointElements = false)
+			: Box(inBoundingBoxQuery.GetBox())
+			, Sphere(inBoundingBoxQuery.GetSphere())
+			, bSphereOnlyTest(inSphereOnlyTest)
+			, bPointElements(inPointElements)
+		{
+			SphereBox = FBox(Sphere.Center - FVector(Sphere.W), Sphere.Center + FVector(Sphere.W));
+		}
+
+		FORCEINLINE bool IntersectsNode(const FBoxCenterAndExtent& NodeBounds) const
+		{
+			const FBox nodeBox = NodeBounds.GetBox();
+			return nodeBox.IsInside(Box.GetCenter()) || nodeBox.Intersect(Box) || nodeBox.Intersect(SphereBox);
+		}
+
+		FORCEINLINE bool ContainsElement(const FSPOctreeElement& Element) const
+		{
+			if (bSphereOnlyTest)
+			{
+				return Sphere.IsInside(Element.BoxSphereBounds.Origin);
+			}
+			if (bPointElements)
+			{
+				return Box.IsInside(Element.BoxSphereBounds.Origin) || Sphere.IsInside(Element.BoxSphereBounds.Origin);
+			}
+			return Box.Intersect(Element.BoxSphereBounds.GetBox()) || Sphere.IsInside(Element.BoxSphereBounds.Origin);
+		}
+	};
+}
+
+/** Change to the element of one actor, replayed by ASPOctree on the copy its query snapshots are built from. */
+struct FSPOctreeSnapshotChange
+{
+	/** Only used as a key, never read from the thread the change is replayed on. */
+	AActor* Actor;
+	TWeakObjectPtr<AActor> ActorRef;
+	FBoxSphereBounds Bounds;
+	bool bRemoved;
+};
+
+class FSPOctreeBakedIndex;
+class FSPOctreeSnapshotSource;
+class USPOctreeBakedAsset;
+struct FConvexVolume;
 
 UCLASS(ClassGroup = (SPOctree), BlueprintType, Blueprintable)
 class SPOCTREEDATALAYER_API ASPOctree : public AActor
@@ -91,6 +542,10 @@ public:
 	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
 	bool PrintTickLogs;
 
+	/** Leaf size and depth of the Octree, applied by the next Initialize. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	ESPOctreeLayout Layout;
+
 	/**
 	* Used in conjunction with a constructor to initialize the object.
 	* @param NewBounds	Intial size of the Octree
@@ -124,6 +579,150 @@ public:
 	UFUNCTION(BlueprintCallable, Category = Octree)
 	TArray<FSPOctreeElement> GetElementsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, const bool bDrawDebug, const bool bPersistentLines, const float lifeTime);
 
+	/**
+	* Visits the elements within the specified region in place, without copying them.
+	* @param inBoundingBoxQuery	Box to query Octree.
+	* @param bSphereOnlyTest	Only test element origins against the query sphere
+	* @param inVisitor	Called once for every element found
+	*/
+	void ForEachElementWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TFunctionRef<void(const FSPOctreeElement&)> inVisitor) const;
+
+	/**
+	* Visits the elements whose origin is within a radius of a segment, the capsule a sphere sweeps when it
+	* moves from inStart to inEnd.
+	* @param inStart	Start of the sweep
+	* @param inEnd	End of the sweep
+	* @param inRadius	Radius of the swept sphere
+	* @param inVisitor	Called once for every element found
+	*/
+	void ForEachElementInCapsule(const FVector& inStart, const FVector& inEnd, const float inRadius, TFunctionRef<void(const FSPOctreeElement&)> inVisitor) const;
+
+	/**
+	* Appends the elements within the specified region to a caller owned array, which can be reused between queries.
+	* @param inBoundingBoxQuery	Box to query Octree.
+	* @param bSphereOnlyTest	Only test element origins against the query sphere
+	* @param OutElements	Array the found elements are appended to
+	*/
+	void GetElementsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TArray<FSPOctreeElement>& OutElements) const;
+
+	/**
+	* Answers several bounds queries in one walk of the Octree. Each node is only tested against the
+	* queries that overlap its parent, and each element against the queries that overlap its node.
+	* @param inQueries	Shapes to query
+	* @param OutResults	Reset and filled with the results of every query, packed by query
+	*/
+	void QueryBatch(TConstArrayView<FSPOctreeQuery> inQueries, FSPOctreeQueryResults& OutResults) const;
+
+	/**
+	* Blueprint version of QueryBatch.
+	* @param inQueries	Shapes to query
+	* @param OutResults	Packed results of every query
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void GetElementsWithinBoundsBatch(const TArray<FSPOctreeQuery>& inQueries, FSPOctreeQueryResults& OutResults);
+
+	/**
+	* Finds the elements whose origins are nearest to a point, without querying and sorting a large region.
+	* @param inPoint	Point to search around
+	* @param inMaxCount	Maximum number of elements to return
+	* @param inMaxDistance	Elements further than this are ignored, 0 or less for no limit
+	* @param inClassFilter	Only elements whose actor is of this class are returned, None for any actor
+	* @param OutElements	Elements found, nearest first
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void FindNearestElements(const FVector& inPoint, const int32 inMaxCount, const float inMaxDistance, TSubclassOf<AActor> inClassFilter, TArray<FSPOctreeElement>& OutElements) const;
+
+	/**
+	* Returns the actor whose element origin is nearest to a point within a radius.
+	* @param inPoint	Point to search around
+	* @param inMaxDistance	Actors further than this are ignored, 0 or less for no limit
+	* @param inClassFilter	Only actors of this class are considered, None for any actor
+	* @return The nearest actor, or nullptr if there is none in range
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	AActor* FindNearestActor(const FVector& inPoint, const float inMaxDistance, TSubclassOf<AActor> inClassFilter) const;
+
+	/**
+	* Traces a segment against the element bounds. Nodes behind the nearest hit found so far are
+	* skipped when only the first hit is wanted.
+	* @param inStart	Start of the trace
+	* @param inEnd	End of the trace
+	* @param bFirstHitOnly	Stop at the nearest hit
+	* @param OutHits	Elements hit, nearest first
+	* @return true if anything was hit, always false with the Point layout, whose elements have no extent to hit
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	bool LineTraceElements(const FVector& inStart, const FVector& inEnd, const bool bFirstHitOnly, TArray<FSPOctreeRayHit>& OutHits) const;
+
+	/**
+	* Visits the elements whose bounds intersect a convex volume such as a view frustum, or whose origin is
+	* inside it with the Point layout. Subtrees fully inside the volume are accepted without testing their elements.
+	* @param inVolume	Volume to query
+	* @param inVisitor	Called once for every element found
+	*/
+	void ForEachElementInConvexVolume(const FConvexVolume& inVolume, TFunctionRef<void(const FSPOctreeElement&)> inVisitor) const;
+
+	/**
+	* Returns the elements inside a perspective view frustum.
+	* @param inViewOrigin	Camera location
+	* @param inViewRotation	Camera rotation
+	* @param inFieldOfView	Horizontal field of view in degrees
+	* @param inAspectRatio	Width divided by height
+	* @param inNearPlane	Distance to the near plane
+	* @param inFarPlane	Distance to the far plane
+	* @param OutElements	Elements found
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void GetElementsInFrustum(const FVector& inViewOrigin, const FRotator& inViewRotation, const float inFieldOfView, const float inAspectRatio, const float inNearPlane, const float inFarPlane, TArray<FSPOctreeElement>& OutElements) const;
+
+	/**
+	* Writes the origin and extent of every element to a CSV file, to tune the Layout on the element
+	* distribution of a real level with the SPOctree.Tuning automation test.
+	* @param inFileName	File name, relative to Saved/SPOctreeBenchmarks/Captures
+	* @return true if the file was written
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	bool SaveElementDistribution(const FString& inFileName);
+
+	/**
+	* Visits every pair of elements whose bounds overlap. The Octree is walked by pairs of nodes: every subtree is
+	* paired with itself, and two subtrees are only descended into while their bounds, grown by inDistanceThreshold,
+	* intersect. Each pair is tested and reported once. With the Point layout pairs are measured between element origins.
+	* @param inDistanceThreshold	Also pairs elements whose boxes are less than this apart on every axis, 0 for overlaps only
+	* @param inVisitor	Called once for every pair found
+	*/
+	void ForEachOverlappingPair(const float inDistanceThreshold, TFunctionRef<void(const FSPOctreeElement&, const FSPOctreeElement&)> inVisitor);
+
+	/**
+	* Returns every pair of actors whose element bounds overlap, see ForEachOverlappingPair.
+	* @param inDistanceThreshold	Also pairs elements whose boxes are less than this apart on every axis, 0 for overlaps only
+	* @param OutPairs	Pairs found
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void GetOverlappingPairs(const float inDistanceThreshold, TArray<FSPOctreeOverlapPair>& OutPairs);
+
+	/**
+	* Returns the pairs of actors that began or stopped overlapping since the previous call. The first call
+	* reports every pair as begun, and removed actors end their pairs.
+	* @param inDistanceThreshold	Also pairs elements whose boxes are less than this apart on every axis, 0 for overlaps only
+	* @param OutBeganPairs	Pairs overlapping now but not at the previous call
+	* @param OutEndedPairs	Pairs overlapping at the previous call but not now
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void GetOverlappingPairChanges(const float inDistanceThreshold, TArray<FSPOctreeOverlapPair>& OutBeganPairs, TArray<FSPOctreeOverlapPair>& OutEndedPairs);
+
+	/** Forgets the pairs GetOverlappingPairChanges reported, so the next call reports every pair as begun. */
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void ResetOverlappingPairs();
+
+	/**
+	* Appends the actors of the elements within the specified region to a caller owned array.
+	* @param inBoundingBoxQuery	Box to query Octree.
+	* @param bSphereOnlyTest	Only test element origins against the query sphere
+	* @param OutActors	Array the found actors are appended to
+	*/
+	void GetActorsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TArray<AActor*>& OutActors) const;
+
 	/** Draws Debug information at runtime */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Debug)
 	bool bDrawDebugInfo;
@@ -131,15 +730,256 @@ public:
 	UFUNCTION(BlueprintCallable, Category = Octree)
 	void DrawBoxSphereBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, const bool bPersistentLines, const float lifeTime);
 
+	/**
+	* Returns the actors of a class within the specified region. Only actors added to the Octree are found.
+	* @param inBoundingBoxQuery	Box to query Octree.
+	* @param ActorClass	Only actors of this class are returned, None for any actor
+	* @param OutActors	Actors found
+	* @param bSphereOnlyTest	Only test element origins against the query sphere
+	*/
 	UFUNCTION(BlueprintCallable, Category = Octree)
 	void GetAllActorsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, TSubclassOf<AActor> ActorClass, TArray<AActor*>& OutActors, const bool bSphereOnlyTest, const bool bDrawDebug, const bool bPersistentLines, const float lifeTime);
 
+	/**
+	* Returns the actors of a class and with a tag within the specified region. Only actors added to the Octree are found.
+	* @param inBoundingBoxQuery	Box to query Octree.
+	* @param ActorClass	Only actors of this class are returned, None for any actor
+	* @param ActorTag	Only actors with this tag are returned, None for any actor
+	* @param OutActors	Actors found
+	* @param bSphereOnlyTest	Only test element origins against the query sphere
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void GetAllActorsWithinBoundsWithTag(const FBoxSphereBounds& inBoundingBoxQuery, TSubclassOf<AActor> ActorClass, const FName ActorTag, TArray<AActor*>& OutActors, const bool bSphereOnlyTest);
+
+	/**
+	* Visits the actors of a class and with a tag within the specified region. Every class and tag filtered on gets
+	* a bit of FSPOctreeElement::FilterMask, so subtrees and elements that do not match are rejected from their
+	* bits without reading their actors.
+	* @param inBoundingBoxQuery	Box to query Octree.
+	* @param bSphereOnlyTest	Only test element origins against the query sphere
+	* @param inActorClass	Only actors of this class are visited, nullptr for any actor
+	* @param inActorTag	Only actors with this tag are visited, None for any actor
+	* @param inVisitor	Called once for every actor found
+	*/
+	void ForEachActorWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, UClass* inActorClass, const FName& inActorTag, TFunctionRef<void(AActor*)> inVisitor);
+
+	/** Bounds an actor is indexed with: its bounds origin and extent, and the largest extent as radius. */
+	static FBoxSphereBounds GetActorElementBounds(AActor* inActor);
+
 	UFUNCTION(BlueprintCallable, Category = Octree)
 	void AddActorToOctree(AActor* inActor, const bool inHiddenInGame);
 
+	/**
+	* Adds many actors in one pass. Their bounds are read in parallel, the elements are inserted in Morton order
+	* so neighbours land in the same leaves one after the other, and the hidden state is applied to all of them
+	* once the Octree is built. Actors already in the Octree have their bounds updated.
+	* @param inActors	Actors to be added
+	* @param inHiddenInGame	Whether the actors start hidden
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void AddActorsToOctree(const TArray<AActor*>& inActors, const bool inHiddenInGame);
+
+	/**
+	* Adds every actor of a class in the world with AddActorsToOctree.
+	* @param inActorClass	Class of the actors to add, None adds every actor
+	* @param inHiddenInGame	Whether the actors start hidden
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void BuildFromWorld(TSubclassOf<AActor> inActorClass, const bool inHiddenInGame);
+
 	UFUNCTION(BlueprintCallable, Category = Octree)
 	void GetAllActors(TArray<AActor*>& OutActors);
 
+	/**
+	* Removes the element of an actor from the Octree.
+	* @param inActor	Actor previously added with AddActorToOctree or AddOctreeElement
+	* @return true if the actor was found and removed
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	bool RemoveActorFromOctree(AActor* inActor);
+
+	/**
+	* Re-reads the bounds of an actor that has moved and relocates its element.
+	* @param inActor	Actor previously added to the Octree
+	* @return true if the actor is in the Octree
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	bool UpdateActorBounds(AActor* inActor);
+
+	/**
+	* Relocates the element of an actor to new bounds. Elements whose new bounds stay inside their old
+	* bounds, or whose origin stays with the Point layout, are patched in place, everything else is
+	* removed and re-added.
+	* @param inActor	Actor previously added to the Octree
+	* @param inNewBounds	New bounds of the element
+	* @return true if the actor is in the Octree
+	*/
+	bool UpdateElementBounds(AActor* inActor, const FBoxSphereBounds& inNewBounds);
+
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	bool ContainsActor(AActor* inActor) const;
+
+	/** Dynamic actors that moved less than this distance since they were last indexed are not relocated. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	float DynamicMoveTolerance;
+
+	/**
+	* Adds an actor to the Octree and flags it as dynamic.
+	* @param inActor	Actor to be added
+	* @param inHiddenInGame	Whether the actor starts hidden
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void AddDynamicActorToOctree(AActor* inActor, const bool inHiddenInGame);
+
+	/**
+	* Flags an actor already in the Octree as dynamic or static. Dynamic actors that moved further
+	* than DynamicMoveTolerance are gathered each Tick and relocated together in one batched pass.
+	* @param inActor	Actor previously added to the Octree
+	* @param bDynamic	Whether the actor should be tracked for movement
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void SetActorDynamic(AActor* inActor, const bool bDynamic);
+
+	/** Queues an actor for the next batched relocation pass, whether or not it is dynamic. */
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void MarkActorDirty(AActor* inActor);
+
+	/** Relocates every dirty actor now instead of waiting for the next Tick. */
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void FlushDirtyActors();
+
+	/**
+	* Compiles the Octree into a flat, read-only index (see FSPOctreeBakedIndex) that answers the bounds
+	* queries until the Octree is modified again. Meant for static content that does not change after load.
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void BakeQueryIndex();
+
+	/** Drops the baked query index, queries walk the Octree again. */
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void ReleaseQueryIndex();
+
+	UFUNCTION(BlueprintPure, Category = Octree)
+	bool HasBakedQueryIndex() const;
+
+	/**
+	* Returns a read-only copy of the Octree that can be queried from any thread. The baked query index is returned
+	* as is when there is one. Otherwise the copy is the Octree as it was when the build of that copy started, see
+	* GetQuerySnapshotVersion. Once the Octree changes, the previous copy is still returned while the next one is
+	* built on the task graph, and a build only starts once the previous one finished. A copy therefore misses at most
+	* the changes made while two builds ran: its own, until the first call after it finished, and the one after it.
+	* Builds replay only the changes made since the previous build on a copy of the Octree kept on the task graph.
+	*/
+	TSharedRef<const FSPOctreeBakedIndex, ESPMode::ThreadSafe> GetQuerySnapshot();
+
+	/** Bumped by every change to the elements of the Octree. */
+	uint32 GetContentVersion() const;
+
+	/** GetContentVersion of the Octree the copy last returned by GetQuerySnapshot was built from. */
+	uint32 GetQuerySnapshotVersion() const;
+
+	/**
+	* Tells whether the elements inside a region may have changed since a content version. Only the most
+	* recent changes are remembered, anything older is reported as a change.
+	* @param inRegion	Region to check
+	* @param inSinceVersion	Value of GetContentVersion when the region was last looked at
+	* @return true if a change since inSinceVersion touched the region
+	*/
+	bool HasChangedNear(const FBox& inRegion, const uint32 inSinceVersion) const;
+
+	/**
+	* Returns the bounds of the deepest node containing a point, or an invalid box if the point is outside the Octree.
+	* Leaving these bounds means crossing into another cell of the Octree.
+	* @param inPoint	Point to look up
+	*/
+	FBox GetLeafBoundsAt(const FVector& inPoint) const;
+
+	/**
+	* Runs a batch of queries on the task graph against the latest snapshot of the Octree, see GetQuerySnapshot.
+	* The batch misses the changes made since its snapshot was built, the results carry the version it was built
+	* from. Actors of the results may have been destroyed or unloaded meanwhile: call RemoveStaleElements on the
+	* results on the game thread before reading MyActor.
+	* @param inQueries	Shapes to query
+	* @return Future holding the packed results of all queries
+	*/
+	TFuture<FSPOctreeQueryResults> QueryAsync(TArray<FSPOctreeQuery> inQueries);
+
+	/**
+	* Runs a batch of queries on the task graph and calls inOnComplete on the game thread from the
+	* first Tick after the batch finished, with the same staleness as QueryAsync. Elements whose actor
+	* was destroyed or unloaded since the snapshot are removed from the results first.
+	* @param inQueries	Shapes to query
+	* @param inOnComplete	Called with the packed results of all queries
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void QueryAsyncWithCallback(const TArray<FSPOctreeQuery>& inQueries, FSPOctreeQueryCompleteDelegate inOnComplete);
+
+	/** Octree loaded at BeginPlay instead of adding actors at runtime, see BakeToAsset. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	TObjectPtr<USPOctreeBakedAsset> BakedAsset;
+
+	/**
+	* Initializes the Octree from a baked asset. The baked index answers the queries straight away and
+	* the actors are only resolved when a query returns them. The editable Octree is rebuilt from the
+	* baked elements the first time it is modified, and elements whose actor is in a level or cell that
+	* is not loaded yet join it when that level is added to the world.
+	* @param inAsset	Asset written by BakeToAsset
+	* @return true if the asset held a baked Octree
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	bool LoadBakedAsset(USPOctreeBakedAsset* inAsset);
+
+	/**
+	* Cells of the Octree streamed by switching the runtime state of their Data Layer, see BuildDataLayerCells.
+	* USPOctreeStreamingSourceComponent loads and activates the cells near it and every other cell is unloaded.
+	*/
+	UPROPERTY(Category = "Data Layers", EditAnywhere, BlueprintReadWrite)
+	TArray<FSPOctreeDataLayerCell> DataLayerCells;
+
+	/**
+	* Visits the Data Layer cells within a distance of a point.
+	* @param inPoint	Point to measure from
+	* @param inDistance	Cells further than this from the point are skipped
+	* @param inVisitor	Called with every cell found and its distance to the point
+	*/
+	void ForEachDataLayerCellWithinDistance(const FVector& inPoint, const float inDistance, TFunctionRef<void(const FSPOctreeDataLayerCell&, const float)> inVisitor) const;
+
+#if WITH_EDITORONLY_DATA
+	/** Extent of the Octree written by BakeToAsset, centred on this actor. */
+	UPROPERTY(Category = "Baking", EditAnywhere)
+	float BakeExtent;
+
+	/** Actors of this class are baked, None bakes every actor of the level. */
+	UPROPERTY(Category = "Baking", EditAnywhere)
+	TSubclassOf<AActor> BakeActorClass;
+
+	/** Only actors with this tag are baked when set. */
+	UPROPERTY(Category = "Baking", EditAnywhere)
+	FName BakeActorTag;
+
+	/** Depth of the Octree nodes turned into cells by BuildDataLayerCells, each level splits the cells in eight. */
+	UPROPERTY(Category = "Data Layers", EditAnywhere, meta = (ClampMin = "0", ClampMax = "12"))
+	int32 DataLayerCellDepth;
+#endif
+
+#if WITH_EDITOR
+	/**
+	* Bakes the actors of the level into BakedAsset, which then replaces the AddActorToOctree calls at runtime.
+	* Baked actors keep the hidden state they are saved with in the level.
+	*/
+	UFUNCTION(CallInEditor, Category = "Baking")
+	void BakeToAsset();
+
+	/**
+	* Splits the Octree into the nodes at DataLayerCellDepth and moves the actors BakeToAsset would bake into one
+	* runtime Data Layer per node, which fills DataLayerCells. Actors in cells are streamed in and out of memory
+	* by their Data Layer, so they are meant to be left out of any baked asset or AddActorToOctree call.
+	* Running it again empties the cells of the previous run first and deletes those left without actors.
+	*/
+	UFUNCTION(CallInEditor, Category = "Data Layers")
+	void BuildDataLayerCells();
+#endif
+
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
@@ -150,7 +990,153 @@ private:
 
 	void DrawOctreeBounds();
 
-	TObjectPtr<FSPOctree> OctreeData = nullptr;
+	/** Forgets all element ids, dynamic and dirty actors. */
+	void ResetTrackedElements();
+
+	/** Adds every dynamic actor that moved past DynamicMoveTolerance to DirtyActors. */
+	void GatherMovedDynamicActors();
+
+	UFUNCTION()
+	void OnIndexedActorDestroyed(AActor* inDestroyedActor);
+
+	/** Removes a dynamic actor unloaded with its streaming level or World Partition cell, or destroyed. */
+	UFUNCTION()
+	void OnIndexedActorEndPlay(AActor* inActor, EEndPlayReason::Type inEndPlayReason);
+
+	/** Adds an element, or relocates it if its actor is already in the Octree. */
+	void InsertElement(FSPOctreeElement inElement);
+
+	/**
+	* Called after every change to the elements of the Octree.
+	* @param inChangedBounds	Region the change touched, an invalid box when it may have touched all of it
+	*/
+	void OnOctreeModified(const FBox& inChangedBounds = FBox(ForceInit));
+
+#if WITH_EDITOR
+	/** Collects the level actors picked by BakeActorClass and BakeActorTag that fit in GetBakeRootBounds. */
+	void GatherBakeActors(TArray<AActor*>& OutActors) const;
+
+	/** Root bounds of the baked Octree and of the Data Layer cells, BakeExtent around this actor. */
+	FBox GetBakeRootBounds() const;
+#endif
+
+	/**
+	* Adds the elements of a loaded baked asset to OctreeData before its first change. Elements whose actor is not
+	* loaded yet wait in UnresolvedBakedElements.
+	*/
+	void EnsureLiveOctree();
+
+	/** Adds the waiting baked elements whose actor has loaded since, and stops listening once none are left. */
+	void ResolveBakedElements();
+
+	/**
+	* Adds the waiting baked element of one actor, so changes to an actor that loaded before its level was added
+	* find its element.
+	* @param inActor	Actor that may have a waiting baked element
+	*/
+	void ResolveBakedElement(AActor* inActor);
+
+	/** Adds the element of the waiting actor at its baked bounds. */
+	void AddResolvedBakedElement(AActor* inActor, const FBoxSphereBounds& inBounds, FBox& InOutChangedBounds);
+
+	/** Resolves the waiting baked elements of the actors a streaming level or World Partition cell brought in. */
+	void OnLevelAddedToWorld(ULevel* inLevel, UWorld* inWorld);
+
+	/** Returns the FilterMask bit of a class or tag, giving it the next free bit. INDEX_NONE once every bit is taken. */
+	int32 GetFilterClassBit(UClass* inClass);
+	int32 GetFilterTagBit(const FName& inTag);
+
+	/** FilterMask of an actor for the classes and tags that have a bit. */
+	uint64 ComputeFilterMask(const AActor* inActor) const;
+
+	/** Brings the element masks up to date with the bits given since, and rebuilds NodeFilterMasks after changes. */
+	void RefreshFilterMasks();
+
+	/** Calls the delegates of the async batches that finished. */
+	void DispatchCompletedQueries();
+
+	/** Hands the changes since the previous build to SnapshotSource, which builds the next QuerySnapshot on the task graph. */
+	void StartQuerySnapshotBuild();
+
+	/**
+	* Queues a change for the next snapshot build, once SnapshotSource exists.
+	* @param inActor	Actor whose element changed
+	* @param inBounds	New bounds of the element, ignored when it was removed
+	* @param bRemoved	Whether the element was removed
+	*/
+	void RecordSnapshotChange(AActor* inActor, const FBoxSphereBounds& inBounds, const bool bRemoved = false);
+
+	TUniquePtr<FSPOctree> OctreeData;
+	FSPOctreeElementIdMap ElementIds;
+
+	/** Bits of FSPOctreeElement::FilterMask given to the classes and tags filtered on so far. */
+	UPROPERTY(Transient)
+	TMap<TObjectPtr<UClass>, int32> FilterClassBits;
+	TMap<FName, int32> FilterTagBits;
+
+	/** Union of the FilterMask of every element in the subtree of a node, by node index. */
+	TArray<uint64> NodeFilterMasks;
+
+	/** Element masks are missing bits given after they were computed. */
+	bool bElementFilterMasksDirty = false;
+
+	/** The Octree changed since NodeFilterMasks was built. */
+	bool bNodeFilterMasksDirty = true;
+
+	/** Pairs overlapping at the last GetOverlappingPairChanges. */
+	UPROPERTY(Transient)
+	TSet<FSPOctreeOverlapPair> OverlappingPairs;
+
+	/** Dynamic actors and the location they were last indexed at. Weak, so actors gone without EndPlay are skipped and dropped. */
+	TMap<TWeakObjectPtr<AActor>, FVector> DynamicActors;
+	TSet<TWeakObjectPtr<AActor>> DirtyActors;
+
+	/** Scratch buffer of the relocation pass, kept to avoid reallocating every Tick. */
+	TArray<FSPOctreeElement> RelocatedElements;
+
+	/** Flattened copy of OctreeData answering the queries while the Octree is static, see BakeQueryIndex. */
+	TSharedPtr<FSPOctreeBakedIndex, ESPMode::ThreadSafe> BakedQueryIndex;
+
+	/** Bumped by every change to the elements of the Octree. */
+	uint32 ContentVersion = 0;
+
+	struct FContentChange
+	{
+		uint32 Version;
+		FBox Bounds;
+	};
+	/** Regions touched by the latest changes, oldest first, see HasChangedNear. */
+	TArray<FContentChange> RecentChanges;
+
+	/** Copy handed out by GetQuerySnapshot and the ContentVersion it was built from. */
+	TSharedPtr<FSPOctreeBakedIndex, ESPMode::ThreadSafe> QuerySnapshot;
+	uint32 QuerySnapshotVersion = 0;
+
+	/** Copy of a newer version being built on the task graph, replaces QuerySnapshot once it is ready. */
+	TFuture<TSharedPtr<FSPOctreeBakedIndex, ESPMode::ThreadSafe>> PendingQuerySnapshot;
+	uint32 PendingQuerySnapshotVersion = 0;
+
+	/** Copy of the Octree the snapshots are built from, only touched by the running build. Made again after a reset. */
+	TSharedPtr<FSPOctreeSnapshotSource, ESPMode::ThreadSafe> SnapshotSource;
+
+	/** Changes made since the last build started, replayed on SnapshotSource by the next one. */
+	TArray<FSPOctreeSnapshotChange> SnapshotChanges;
+
+	struct FPendingAsyncQuery
+	{
+		TFuture<FSPOctreeQueryResults> Results;
+		FSPOctreeQueryCompleteDelegate OnComplete;
+	};
+	TArray<FPendingAsyncQuery> PendingAsyncQueries;
 	bool bInitialized;
 
+	/** OctreeData is still empty, the elements only live in the index loaded by LoadBakedAsset. */
+	bool bLiveOctreePending = false;
+
+	/** Baked bounds of the elements whose actor was not loaded when EnsureLiveOctree ran, by actor path. */
+	TMap<FSoftObjectPath, FBoxSphereBounds> UnresolvedBakedElements;
+
+	/** Set while UnresolvedBakedElements waits for levels to be added. */
+	FDelegateHandle LevelAddedToWorldHandle;
+
 };
@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "SPOctree.h"
+#include "SPOctreeBakedIndex.h"
+#include "SPOctreeBakedAsset.generated.h"
+
+/**
+* Octree baked in the editor and saved next to its map, see ASPOctree::BakeToAsset.
+* The node layout and element bounds are stored as flat arrays that load with one bulk copy each,
+* and actors as soft references that are resolved the first time a query returns them.
+*/
+UCLASS(BlueprintType)
+class SPOCTREEDATALAYER_API USPOctreeBakedAsset : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Serialize(FArchive& Ar) override;
+
+	/** Root bounds of the Octree the asset was baked from. */
+	UPROPERTY(Category = "Baked Octree", VisibleAnywhere, BlueprintReadOnly)
+	FBox RootBounds = FBox(ForceInit);
+
+	UPROPERTY(Category = "Baked Octree", VisibleAnywhere, BlueprintReadOnly)
+	int32 NumNodes = 0;
+
+	UPROPERTY(Category = "Baked Octree", VisibleAnywhere, BlueprintReadOnly)
+	int32 NumElements = 0;
+
+#if WITH_EDITOR
+	/**
+	* Replaces the content of the asset with a flattened copy of an Octree.
+	* @param inOctree	Octree to bake, the actors of its elements must be saved in a level
+	*/
+	void Bake(const FSPOctree& inOctree);
+#endif
+
+	/** Returns a copy of the baked index for one Octree to own, actors are resolved against the world that queries it. */
+	TSharedRef<FSPOctreeBakedIndex, ESPMode::ThreadSafe> CreateQueryIndex() const;
+
+private:
+	FSPOctreeBakedIndex BakedIndex;
+};
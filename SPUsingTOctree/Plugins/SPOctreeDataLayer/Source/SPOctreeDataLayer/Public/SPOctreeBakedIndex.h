@@ -0,0 +1,208 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SPOctree.h"
+
+struct FConvexVolume;
+struct FSPOctreeQueryCounters;
+
+/**
+* Read-only copy of an FSPOctree compiled into a flat structure-of-arrays layout.
+*
+* Nodes are stored depth first, so the subtree of a node is the contiguous range
+* [NodeIndex, NodeSubtreeEnd[NodeIndex]) and a rejected subtree is skipped with a single jump.
+* Node bounds are the tight bounds of everything in the subtree. Element centers and extents
+* live in separate float arrays, relative to the root center, and are culled four at a time
+* with VectorRegister4Float. The AActor of an element is only read once it is a hit.
+*/
+class SPOCTREEDATALAYER_API FSPOctreeBakedIndex
+{
+public:
+	/**
+	* Replaces the content of the index with a flattened copy of an Octree. Elements of the Point layout are
+	* copied with a zero extent, so queries match them by origin.
+	* @param inOctree	Octree to flatten
+	*/
+	void Build(const FSPOctree& inOctree);
+
+	void Reset();
+
+	/**
+	* Calls inVisitor with the index of every element matching the query. Uses the same rules as
+	* ASPOctree::ForEachElementWithinBounds: the element origin is inside the query sphere or, unless
+	* bSphereOnlyTest is set, the element box intersects the query box.
+	* @param inBoundingBoxQuery	Box and sphere to query
+	* @param bSphereOnlyTest	Only test element origins against the query sphere
+	* @param inVisitor	Called with the index of every element found, see GetElement
+	*/
+	void ForEachElementWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TFunctionRef<void(int32)> inVisitor) const;
+
+	/**
+	* Calls inVisitor with the index of every element whose origin is within inRadius of a segment.
+	* @param inStart	Start of the segment
+	* @param inEnd	End of the segment
+	* @param inRadius	Radius of the capsule swept along the segment
+	* @param inVisitor	Called with the index of every element found
+	*/
+	void ForEachElementInCapsule(const FVector& inStart, const FVector& inEnd, const float inRadius, TFunctionRef<void(int32)> inVisitor) const;
+
+	/** Returns the bounds of the deepest node whose subtree bounds contain a point, or an invalid box. */
+	FBox GetLeafBoundsAt(const FVector& inPoint) const;
+
+	/**
+	* Runs several queries in a single pass over the nodes and packs their results. Every node is tested
+	* only against the queries that overlap its parent, and its subtree is skipped once none is left.
+	* @param inQueries	Shapes to query
+	* @param OutResults	Reset and filled with the results of every query
+	*/
+	void QueryBatch(TConstArrayView<FSPOctreeQuery> inQueries, FSPOctreeQueryResults& OutResults) const;
+
+	/**
+	* Best-first search for the elements whose origins are nearest to a point. Nodes are taken
+	* from a priority queue ordered by distance, and the search stops once the nearest node left
+	* is further than the current inMaxCount-th best element.
+	* @param inPoint	Point to search around
+	* @param inMaxCount	Maximum number of elements to find
+	* @param inMaxDistanceSquared	Elements further than this are ignored
+	* @param inFilter	Only elements it returns true for are kept, called for candidates closer than the current best
+	* @param OutElementIndices	Reset and filled with the indices of the elements found, nearest first
+	*/
+	void FindNearestElements(const FVector& inPoint, const int32 inMaxCount, const double inMaxDistanceSquared, TFunctionRef<bool(const FSPOctreeElement&)> inFilter, TArray<int32>& OutElementIndices) const;
+
+	/**
+	* Traces a segment through the index front to back. Nodes are taken from a priority queue ordered
+	* by the time the segment enters them, so with bFirstHitOnly the walk ends at the first node entered
+	* after the nearest hit.
+	* @param inStart	Start of the trace
+	* @param inEnd	End of the trace
+	* @param bFirstHitOnly	Stop at the nearest hit
+	* @param OutHits	Reset and filled with the entry time along the segment and index of every element hit, nearest first
+	*/
+	void LineTrace(const FVector& inStart, const FVector& inEnd, const bool bFirstHitOnly, TArray<TPair<double, int32>>& OutHits) const;
+
+	/**
+	* Calls inVisitor with the index of every element intersecting a convex volume. Subtrees fully inside
+	* the volume are accepted whole, their elements are contiguous in the depth first layout.
+	* @param inVolume	Volume to query
+	* @param inVisitor	Called with the index of every element found
+	*/
+	void ForEachElementInConvexVolume(const FConvexVolume& inVolume, TFunctionRef<void(int32)> inVisitor) const;
+
+	/**
+	* Saves or loads the index as flat arrays, each read back in a single bulk copy. Actors are written as
+	* soft paths, see StoreActorPaths, and loaded elements resolve their actor on first access.
+	*/
+	void Serialize(FArchive& Ar);
+
+	/** Replaces the actor of every element with its soft path, so the index can be saved and resolved again in another world. */
+	void StoreActorPaths();
+
+#if WITH_EDITOR
+	/** Points the stored actor paths at the actors of a Play In Editor world. */
+	void FixupActorPathsForPIE(int32 inPIEInstanceID);
+#endif
+
+	/**
+	* Resolves the actor of every loaded element and takes a weak reference to the actor of every element, after
+	* which the index can be read from any thread. Actors that are not loaded yet keep a null reference and are
+	* resolved by a later call. Game thread only.
+	*/
+	void ResolveAllActors() const;
+
+	/**
+	* Sets the weak reference to the actor of every element from references taken on the game thread, for indices
+	* built on another thread. Actors are looked up by address and never read.
+	* @param inActorRefs	Weak reference of every actor, by actor
+	*/
+	void StoreActorRefs(const TMap<const AActor*, TWeakObjectPtr<AActor>>& inActorRefs);
+
+	/** Looks the actor up by soft path on indices that were saved or loaded, and scans the elements of any other index. */
+	bool ContainsActor(const AActor* inActor) const;
+
+	/** Soft path of the actor of an element, empty on indices that were never saved or loaded. */
+	const FSoftObjectPath& GetElementActorPath(int32 inElementIndex) const;
+
+	/** Elements loaded from disk get their actor resolved here on first access from the game thread. */
+	FORCEINLINE const FSPOctreeElement& GetElement(int32 inElementIndex) const
+	{
+		if (bHasUnresolvedActors && Elements[inElementIndex].MyActor == nullptr)
+		{
+			return ResolveElement(inElementIndex);
+		}
+		return Elements[inElementIndex];
+	}
+
+	FORCEINLINE int32 GetNumNodes() const
+	{
+		return NodeSubtreeEnd.Num();
+	}
+
+	FORCEINLINE int32 GetNumElements() const
+	{
+		return Elements.Num();
+	}
+
+	SIZE_T GetAllocatedSize() const;
+
+private:
+	FORCEINLINE FBox GetNodeBox(int32 inNodeIndex) const
+	{
+		const FVector center = Origin + FVector(NodeCenterX[inNodeIndex], NodeCenterY[inNodeIndex], NodeCenterZ[inNodeIndex]);
+		const FVector extent = FVector(NodeExtentX[inNodeIndex], NodeExtentY[inNodeIndex], NodeExtentZ[inNodeIndex]);
+		return FBox(center - extent, center + extent);
+	}
+
+	FORCEINLINE bool IsNodeEmpty(int32 inNodeIndex) const
+	{
+		return NodeExtentX[inNodeIndex] < 0.0f;
+	}
+
+	const FSPOctreeElement& ResolveElement(int32 inElementIndex) const;
+
+	/** Fills ElementActorPathIndices from ElementActorPaths. */
+	void BuildActorPathIndices();
+
+	/** Tests the elements [inFirstElement, inFirstElement + inNumElements) four at a time. */
+	void TestElements(int32 inFirstElement, int32 inNumElements, const FVector3f& inQueryCenter, const FVector3f& inQueryExtent, const float inSphereRadius, const bool bSphereOnlyTest, FSPOctreeQueryCounters& inCounters, TFunctionRef<void(int32)> inVisitor) const;
+
+	/** All float coordinates are relative to this point, which keeps them precise in large worlds. */
+	FVector Origin = FVector::ZeroVector;
+
+	TArray<float> NodeCenterX;
+	TArray<float> NodeCenterY;
+	TArray<float> NodeCenterZ;
+	TArray<float> NodeExtentX;
+	TArray<float> NodeExtentY;
+	TArray<float> NodeExtentZ;
+	TArray<int32> NodeSubtreeEnd;
+	TArray<int32> NodeFirstElement;
+	TArray<int32> NodeNumElements;
+
+	/** Element arrays are padded so the last group of four can always be loaded. */
+	TArray<float> ElementCenterX;
+	TArray<float> ElementCenterY;
+	TArray<float> ElementCenterZ;
+	TArray<float> ElementExtentX;
+	TArray<float> ElementExtentY;
+	TArray<float> ElementExtentZ;
+
+	/** Cold element data, only read for hits. Actors of loaded elements are filled in lazily. */
+	mutable TArray<FSPOctreeElement> Elements;
+
+	/** Soft path of the actor of every element, only set on indices that are saved or loaded. */
+	TArray<FSoftObjectPath> ElementActorPaths;
+
+	/**
+	* Weak reference to the actor of every element, copied to FSPOctreeQueryResults::ElementActors by QueryBatch so
+	* results made on other threads can be checked on the game thread. Empty until ResolveAllActors or StoreActorRefs.
+	*/
+	mutable TArray<TWeakObjectPtr<AActor>> ElementActorRefs;
+
+	/** Element index of every path in ElementActorPaths, built once the paths are stored, loaded or fixed up. */
+	TMap<FSoftObjectPath, int32> ElementActorPathIndices;
+
+	/** Some element with an actor path has no actor yet, cleared once every path has resolved. */
+	mutable bool bHasUnresolvedActors = false;
+};
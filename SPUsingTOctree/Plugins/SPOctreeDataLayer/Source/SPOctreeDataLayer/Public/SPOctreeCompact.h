@@ -0,0 +1,355 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "Math/GenericOctree.h"
+#include "UObject/ObjectKey.h"
+#include "SPOctreeStats.h"
+
+/**
+* Compact octrees for scenes with millions of small actors, such as foliage. Their elements only hold an index into
+* an FSPOctreeActorRegistry and their bounds, as floats (FSPOctreeFloatElement, 28 bytes) or as 16-bit steps
+* (FSPOctreeQuantizedElement, 16 bytes), against 64 bytes and more for an FSPOctreeElement. Actors stay out of the
+* traversal data and are only read for the elements a query returns.
+*
+* Element bounds are stored relative to the root of their tree, see FSPOctreeCompactFrame, since TOctree2 moves
+* elements between nodes without telling them.
+*/
+
+/** Range the element bounds of a compact octree are stored in: twice the extent of its root, around the root center. */
+struct SPOCTREEDATALAYER_API FSPOctreeCompactFrame
+{
+	FVector Origin = FVector::ZeroVector;
+	double Extent = 1.0;
+
+	/** Size of one step of a quantized coordinate. */
+	double QuantizationStep = 1.0;
+	double InverseQuantizationStep = 1.0;
+
+	FSPOctreeCompactFrame() {}
+
+	FSPOctreeCompactFrame(const FVector& inOrigin, const double inRootExtent);
+
+	/** Whether bounds can be stored in this frame, elements sticking out of the root by up to the root extent can. */
+	bool Contains(const FBox& inBox) const;
+};
+
+/** Element bounds as floats relative to the root center. */
+struct FSPOctreeFloatElement
+{
+	FVector3f Center;
+	FVector3f Extent;
+	uint32 ActorIndex;
+
+	FORCEINLINE static FSPOctreeFloatElement Encode(const FBoxSphereBounds& inBounds, const int32 inActorIndex, const FSPOctreeCompactFrame& inFrame)
+	{
+		FSPOctreeFloatElement element;
+		element.Center = FVector3f(inBounds.Origin - inFrame.Origin);
+		element.Extent = FVector3f(inBounds.BoxExtent);
+		element.ActorIndex = (uint32)inActorIndex;
+		return element;
+	}
+
+	FORCEINLINE FBox Decode(const FSPOctreeCompactFrame& inFrame) const
+	{
+		const FVector center = inFrame.Origin + FVector(Center);
+		return FBox(center - FVector(Extent), center + FVector(Extent));
+	}
+};
+
+/** Element bounds as 16-bit steps of the frame, rounded outwards so they always contain the bounds they were made from. */
+struct FSPOctreeQuantizedElement
+{
+	uint16 Min[3];
+	uint16 Max[3];
+	uint32 ActorIndex;
+
+	FORCEINLINE static FSPOctreeQuantizedElement Encode(const FBoxSphereBounds& inBounds, const int32 inActorIndex, const FSPOctreeCompactFrame& inFrame)
+	{
+		const FVector frameMin = inFrame.Origin - FVector(inFrame.Extent);
+		const FVector boundsMin = (inBounds.Origin - inBounds.BoxExtent - frameMin) * inFrame.InverseQuantizationStep;
+		const FVector boundsMax = (inBounds.Origin + inBounds.BoxExtent - frameMin) * inFrame.InverseQuantizationStep;
+
+		FSPOctreeQuantizedElement element;
+		for (int32 axis = 0; axis < 3; axis++)
+		{
+			element.Min[axis] = (uint16)FMath::Clamp(FMath::FloorToInt(boundsMin[axis]), 0, MAX_uint16);
+			element.Max[axis] = (uint16)FMath::Clamp(FMath::CeilToInt(boundsMax[axis]), 0, MAX_uint16);
+		}
+		element.ActorIndex = (uint32)inActorIndex;
+		return element;
+	}
+
+	FORCEINLINE FBox Decode(const FSPOctreeCompactFrame& inFrame) const
+	{
+		const FVector frameMin = inFrame.Origin - FVector(inFrame.Extent);
+		return FBox(frameMin + FVector(Min[0], Min[1], Min[2]) * inFrame.QuantizationStep, frameMin + FVector(Max[0], Max[1], Max[2]) * inFrame.QuantizationStep);
+	}
+};
+
+/**
+* Actors of a compact octree, by the index its elements store, with the id of their element in the tree.
+* The index of a removed actor is reused by the next one added.
+*/
+class SPOCTREEDATALAYER_API FSPOctreeActorRegistry
+{
+public:
+	/**
+	* Gives an actor an index. Actorless elements, as the benchmarks use, always get a new index.
+	* @param inActor	Actor to register, may be nullptr
+	* @return the index of the actor, its existing one if it was already registered
+	*/
+	int32 Add(AActor* inActor);
+
+	/** Frees the index of an actor, returns false if the actor is not registered. */
+	bool Remove(const AActor* inActor);
+
+	/** Frees an index, does nothing if it is out of range. Callers check IsOccupied so a free index is never freed twice. */
+	void RemoveAt(const int32 inIndex);
+
+	/** Returns true if the index is in range and holds an element of the tree. */
+	FORCEINLINE bool IsOccupied(const int32 inIndex) const
+	{
+		return ElementIds.IsValidIndex(inIndex) && ElementIds[inIndex].IsValidId();
+	}
+
+	/** Returns the index of an actor, INDEX_NONE if it is not registered. */
+	int32 Find(const AActor* inActor) const;
+
+	FORCEINLINE AActor* Get(const int32 inIndex) const
+	{
+		return Actors[inIndex].ResolveObjectPtr();
+	}
+
+	FORCEINLINE FOctreeElementId2 GetElementId(const int32 inIndex) const
+	{
+		return ElementIds[inIndex];
+	}
+
+	FORCEINLINE void SetElementId(const int32 inIndex, const FOctreeElementId2 inId)
+	{
+		ElementIds[inIndex] = inId;
+	}
+
+	/** Number of registered actors. */
+	int32 Num() const;
+
+	SIZE_T GetAllocatedSize() const;
+
+	void Reset();
+
+private:
+	/** Keys rather than pointers, so destroyed actors resolve to nullptr and can still be removed from ActorIndices. */
+	TArray<TObjectKey<AActor>> Actors;
+	TArray<FOctreeElementId2> ElementIds;
+	TArray<int32> FreeIndices;
+	TMap<TObjectKey<AActor>, int32> ActorIndices;
+};
+
+/**
+* Frame and registry of the compact octree changing its tree on the calling thread. TOctree2 only gives its semantics
+* the element, so TSPOctreeCompact sets this around the calls that add, move or remove elements.
+*/
+struct SPOCTREEDATALAYER_API FSPOctreeCompactContext
+{
+	const FSPOctreeCompactFrame* Frame = nullptr;
+	FSPOctreeActorRegistry* Registry = nullptr;
+
+	static FSPOctreeCompactContext*& Current();
+};
+
+template<typename ElementType>
+struct TSPOctreeCompactSemantics
+{
+	// A leaf of 16 quantized elements is four cache lines
+	enum { MaxElementsPerLeaf = 16 };
+	enum { MinInclusiveElementsPerNode = 7 };
+	enum { MaxNodeDepth = 12 };
+
+	typedef TInlineAllocator<MaxElementsPerLeaf> ElementAllocator;
+
+	FORCEINLINE static FBoxCenterAndExtent GetBoundingBox(const ElementType& Element)
+	{
+		return FBoxCenterAndExtent(Element.Decode(*FSPOctreeCompactContext::Current()->Frame));
+	}
+
+	FORCEINLINE static bool AreElementsEqual(const ElementType& A, const ElementType& B)
+	{
+		return A.ActorIndex == B.ActorIndex;
+	}
+
+	FORCEINLINE static void SetElementId(const ElementType& Element, FOctreeElementId2 Id)
+	{
+		FSPOctreeCompactContext::Current()->Registry->SetElementId((int32)Element.ActorIndex, Id);
+	}
+
+	/** Element bounds are relative to the frame, there is nothing to move. */
+	FORCEINLINE static void ApplyOffset(ElementType& /*Element*/, FVector /*Offset*/)
+	{
+	}
+};
+
+/**
+* Octree of compact elements with the registry of their actors. Queries follow the rules of
+* ASPOctree::ForEachElementWithinBounds, on bounds rounded to the precision of ElementType.
+*/
+template<typename ElementType>
+class TSPOctreeCompact
+{
+public:
+	typedef TOctree2<ElementType, TSPOctreeCompactSemantics<ElementType>> FTree;
+
+	TSPOctreeCompact(const FVector& inOrigin, const double inExtent)
+		: Frame(inOrigin, inExtent)
+		, Tree(inOrigin, inExtent)
+	{
+	}
+
+	/**
+	* Adds an element for an actor.
+	* @param inActor	Actor of the element, nullptr for an actorless element
+	* @param inBounds	Bounds of the element, see ASPOctree::GetActorElementBounds
+	* @return the registry index of the element, INDEX_NONE if the actor is already in the tree or the bounds do not fit the frame
+	*/
+	int32 AddElement(AActor* inActor, const FBoxSphereBounds& inBounds)
+	{
+		SPOCTREE_SCOPE_CYCLE_COUNTER(Add);
+
+		if ((inActor && Registry.Find(inActor) != INDEX_NONE) || !Frame.Contains(inBounds.GetBox()))
+		{
+			return INDEX_NONE;
+		}
+
+		FSPOctreeCompactContext context{ &Frame, &Registry };
+		TGuardValue<FSPOctreeCompactContext*> contextGuard(FSPOctreeCompactContext::Current(), &context);
+		const int32 actorIndex = Registry.Add(inActor);
+		Tree.AddElement(ElementType::Encode(inBounds, actorIndex, Frame));
+		return actorIndex;
+	}
+
+	/** Removes the element of an actor, returns false if the actor is not in the tree. */
+	bool RemoveActor(const AActor* inActor)
+	{
+		const int32 actorIndex = Registry.Find(inActor);
+		if (actorIndex == INDEX_NONE)
+		{
+			return false;
+		}
+		return RemoveElement(actorIndex);
+	}
+
+	/** Removes an element by registry index, returns false if the index holds no element. */
+	bool RemoveElement(const int32 inActorIndex)
+	{
+		if (!Registry.IsOccupied(inActorIndex) || !Tree.IsValidElementId(Registry.GetElementId(inActorIndex)))
+		{
+			return false;
+		}
+
+		FSPOctreeCompactContext context{ &Frame, &Registry };
+		TGuardValue<FSPOctreeCompactContext*> contextGuard(FSPOctreeCompactContext::Current(), &context);
+		Tree.RemoveElement(Registry.GetElementId(inActorIndex));
+		Registry.RemoveAt(inActorIndex);
+		return true;
+	}
+
+	/**
+	* Moves the element of an actor to new bounds.
+	* @return false if the actor is not in the tree or the bounds do not fit the frame, in which case the actor is removed
+	*/
+	bool UpdateActorBounds(AActor* inActor, const FBoxSphereBounds& inBounds)
+	{
+		return RemoveActor(inActor) && AddElement(inActor, inBounds) != INDEX_NONE;
+	}
+
+	/**
+	* Calls inVisitor with the registry index and decoded box of every element matching the query.
+	* @param inBoundingBoxQuery	Box and sphere to query
+	* @param bSphereOnlyTest	Only test element centers against the query sphere
+	* @param inVisitor	Called once for every element found
+	*/
+	void ForEachElementWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TFunctionRef<void(int32, const FBox&)> inVisitor) const
+	{
+		SPOCTREE_SCOPE_CYCLE_COUNTER(Query);
+
+		const FBox queryBox = inBoundingBoxQuery.GetBox();
+		const FSphere querySphere = inBoundingBoxQuery.GetSphere();
+		const FBox sphereBox = FBox(querySphere.Center - FVector(querySphere.W), querySphere.Center + FVector(querySphere.W));
+		FSPOctreeQueryCounters queryCounters;
+
+		Tree.FindNodesWithPredicate(
+			[&queryBox, &sphereBox](typename FTree::FNodeIndex /*ParentNodeIndex*/, typename FTree::FNodeIndex /*NodeIndex*/, const FBoxCenterAndExtent& NodeBounds)
+			{
+				const FBox nodeBox = NodeBounds.GetBox();
+				return nodeBox.IsInside(queryBox.GetCenter()) || nodeBox.Intersect(queryBox) || nodeBox.Intersect(sphereBox);
+			},
+			[this, &inVisitor, &queryBox, &querySphere, &queryCounters, bSphereOnlyTest](typename FTree::FNodeIndex /*ParentNodeIndex*/, typename FTree::FNodeIndex NodeIndex, const FBoxCenterAndExtent& /*NodeBounds*/)
+			{
+				TArrayView<const ElementType> elements = Tree.GetElementsForNode(NodeIndex);
+				queryCounters.AddNode();
+				queryCounters.AddElementsTested(elements.Num());
+				for (const ElementType& element : elements)
+				{
+					const FBox elementBox = element.Decode(Frame);
+					if (querySphere.IsInside(elementBox.GetCenter()) || (!bSphereOnlyTest && queryBox.Intersect(elementBox)))
+					{
+						queryCounters.AddHits(1);
+						inVisitor((int32)element.ActorIndex, elementBox);
+					}
+				}
+			});
+	}
+
+	/** Calls inVisitor with the actor of every element matching the query, skipping actorless and destroyed ones. */
+	void ForEachActorWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TFunctionRef<void(AActor*)> inVisitor) const
+	{
+		ForEachElementWithinBounds(inBoundingBoxQuery, bSphereOnlyTest, [this, &inVisitor](int32 ActorIndex, const FBox& /*ElementBox*/)
+			{
+				if (AActor* actor = Registry.Get(ActorIndex))
+				{
+					inVisitor(actor);
+				}
+			});
+	}
+
+	FORCEINLINE bool Contains(const AActor* inActor) const
+	{
+		return Registry.Find(inActor) != INDEX_NONE;
+	}
+
+	FORCEINLINE AActor* GetActor(const int32 inActorIndex) const
+	{
+		return Registry.Get(inActorIndex);
+	}
+
+	FORCEINLINE int32 Num() const
+	{
+		return Registry.Num();
+	}
+
+	FORCEINLINE const FSPOctreeCompactFrame& GetFrame() const
+	{
+		return Frame;
+	}
+
+	FORCEINLINE const FTree& GetTree() const
+	{
+		return Tree;
+	}
+
+	/** Memory used by the tree and the registry. */
+	SIZE_T GetSizeBytes() const
+	{
+		return Tree.GetSizeBytes() + Registry.GetAllocatedSize();
+	}
+
+private:
+	FSPOctreeCompactFrame Frame;
+	FSPOctreeActorRegistry Registry;
+	FTree Tree;
+};
+
+typedef TSPOctreeCompact<FSPOctreeFloatElement> FSPOctreeFloat;
+typedef TSPOctreeCompact<FSPOctreeQuantizedElement> FSPOctreeQuantized;
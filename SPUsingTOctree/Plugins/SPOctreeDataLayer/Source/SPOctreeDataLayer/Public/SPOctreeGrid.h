@@ -0,0 +1,148 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "SPOctree.h"
+#include "SPOctreeGrid.generated.h"
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FSPOctreeGridCellSignature, ASPOctree*, Cell);
+
+/**
+* Sparse grid of octrees for worlds too large for a single root. The world is split into cubic cells and
+* each cell gets its own ASPOctree the first time an actor lands in it, so empty space costs nothing and
+* every tree only goes as deep as its own cell needs.
+*
+* An actor belongs to the cell holding its origin. Cell octrees are loose, their root is twice the size of
+* the cell, so any actor no larger than a cell fits the octree of its cell. Larger actors go to an overflow
+* list that every query scans. Queries only visit the cells their bounds can reach.
+*/
+UCLASS(ClassGroup = (SPOctree), BlueprintType, Blueprintable)
+class SPOCTREEDATALAYER_API ASPOctreeGrid : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	ASPOctreeGrid(const FObjectInitializer& ObjectInitializer = FObjectInitializer::Get());
+
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	bool PrintLogs;
+
+	/** Half the size of a grid cell. Changing it only affects cells created afterwards. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1.0"))
+	float CellExtent;
+
+	/** Draws the bounds of the cell octrees at runtime. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Debug)
+	bool bDrawDebugInfo;
+
+	/** Broadcast when a cell gets its octree, so streaming sources and other users can start querying it. */
+	UPROPERTY(BlueprintAssignable, Category = Octree)
+	FSPOctreeGridCellSignature OnCellCreated;
+
+	/**
+	* Adds an actor to the octree of its cell, or to the overflow list if it is larger than a cell.
+	* An actor already in the grid is not added twice, its bounds are updated as by UpdateActorBounds.
+	* @param inActor	Actor to be added
+	* @param inHiddenInGame	Whether the actor starts hidden
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void AddActorToOctree(AActor* inActor, const bool inHiddenInGame);
+
+	/**
+	* Adds many actors, one ASPOctree::AddActorsToOctree batch per cell.
+	* @param inActors	Actors to be added
+	* @param inHiddenInGame	Whether the actors start hidden
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void AddActorsToOctree(const TArray<AActor*>& inActors, const bool inHiddenInGame);
+
+	/**
+	* Removes an actor from its cell or from the overflow list.
+	* @param inActor	Actor previously added to the grid
+	* @return true if the actor was found and removed
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	bool RemoveActorFromOctree(AActor* inActor);
+
+	/**
+	* Re-reads the bounds of an actor that has moved, moving it to another cell if its origin left its cell.
+	* @param inActor	Actor previously added to the grid
+	* @return true if the actor is in the grid
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	bool UpdateActorBounds(AActor* inActor);
+
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	bool ContainsActor(AActor* inActor) const;
+
+	/**
+	* Visits the elements within the specified region, in the cells the region reaches and in the overflow list.
+	* @param inBoundingBoxQuery	Box to query the grid.
+	* @param bSphereOnlyTest	Only test element origins against the query sphere
+	* @param inVisitor	Called once for every element found
+	*/
+	void ForEachElementWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TFunctionRef<void(const FSPOctreeElement&)> inVisitor) const;
+
+	/**
+	* Returns elements within the specified region.
+	* @param inBoundingBoxQuery	Box to query the grid.
+	* @param bSphereOnlyTest	Only test element origins against the query sphere
+	* @param OutElements	Elements found
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void GetElementsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, const bool bSphereOnlyTest, TArray<FSPOctreeElement>& OutElements) const;
+
+	/**
+	* Returns the actors of a class within the specified region, see ASPOctree::ForEachActorWithinBounds.
+	* @param inBoundingBoxQuery	Box to query the grid.
+	* @param ActorClass	Only actors of this class are returned, None for any actor
+	* @param OutActors	Actors found
+	* @param bSphereOnlyTest	Only test element origins against the query sphere
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void GetAllActorsWithinBounds(const FBoxSphereBounds& inBoundingBoxQuery, TSubclassOf<AActor> ActorClass, TArray<AActor*>& OutActors, const bool bSphereOnlyTest);
+
+	/** Returns the octree of every cell created so far. */
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void GetCellOctrees(TArray<ASPOctree*>& OutCells) const;
+
+	/** Returns the octree of the cell holding a point, or nullptr if that cell has none yet. */
+	UFUNCTION(BlueprintPure, Category = Octree)
+	ASPOctree* GetCellOctreeAt(const FVector& inPoint) const;
+
+	UFUNCTION(BlueprintPure, Category = Octree)
+	int32 GetNumOverflowElements() const;
+
+protected:
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+private:
+	FIntVector GetCellCoordinates(const FVector& inPoint) const;
+
+	/** Bounds of the cell octree root, the cell grown by CellExtent on every side. */
+	FBox GetCellOctreeBounds(const FIntVector& inCell) const;
+
+	ASPOctree* FindOrCreateCell(const FIntVector& inCell);
+
+	/** Whether an actor with these bounds is too large for the octree of its cell. */
+	bool IsOversized(const FBoxSphereBounds& inBounds) const;
+
+	/**
+	* Calls inVisitor with the octree of every cell a region can reach. Actors stick out of their cell by up to
+	* CellExtent, so the region is grown by that much first.
+	*/
+	void ForEachCellInRegion(const FBox& inRegion, TFunctionRef<void(ASPOctree&)> inVisitor) const;
+
+	/** Octree of every cell that held an actor, by cell coordinates. */
+	UPROPERTY(Transient)
+	TMap<FIntVector, TObjectPtr<ASPOctree>> Cells;
+
+	/** Cell of every actor in a cell octree. */
+	TMap<TObjectPtr<AActor>, FIntVector> ActorCells;
+
+	/** Actors larger than a cell, tested one by one by every query. */
+	UPROPERTY(Transient)
+	TArray<FSPOctreeElement> OverflowElements;
+};
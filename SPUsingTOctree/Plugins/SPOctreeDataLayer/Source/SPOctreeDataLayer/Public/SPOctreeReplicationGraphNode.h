@@ -0,0 +1,116 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ReplicationGraph.h"
+#include "SPOctree.h"
+#include "SPOctreeReplicationGraphNode.generated.h"
+
+/**
+* ReplicationGraph node that keeps its network actors in an FSPOctree and gives every connection the actors
+* within CullDistance of its viewers, so net relevancy costs one spatial query per connection instead of a
+* distance check per actor.
+*
+* Actors are indexed by their location, see ESPOctreeLayout::Point. PrepareForReplication re-indexes the actors
+* that moved further than RelocationTolerance, once per frame for all connections. A connection keeps its list
+* until a viewer moves further than ViewerMoveTolerance, or an actor is added, removed or moved within
+* CullDistance of it.
+*/
+UCLASS()
+class SPOCTREEDATALAYER_API USPOctreeReplicationGraphNode : public UReplicationGraphNode
+{
+	GENERATED_BODY()
+
+public:
+	USPOctreeReplicationGraphNode();
+
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	bool PrintLogs;
+
+	/** Actors further than this from every viewer of a connection are not relevant to it. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0.0"))
+	float CullDistance;
+
+	/** Half the size of the Octree root, actors outside of it are only found by viewers near the root. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1.0"))
+	float RootExtent;
+
+	/** Actors are re-indexed once they move further than this from where they were indexed. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0.0"))
+	float RelocationTolerance;
+
+	/** A connection queries the Octree again once one of its viewers moves further than this. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0.0"))
+	float ViewerMoveTolerance;
+
+	/** Changes kept to check caches against, a cache older than the oldest kept change queries again. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	int32 MaxTrackedChanges;
+
+	//~ Begin UReplicationGraphNode interface
+	virtual void NotifyAddNetworkActor(const FNewReplicatedActorInfo& ActorInfo) override;
+	virtual bool NotifyRemoveNetworkActor(const FNewReplicatedActorInfo& ActorInfo, bool bWarnIfNotFound = true) override;
+	virtual void NotifyResetAllNetworkActors() override;
+	virtual void PrepareForReplication() override;
+	virtual void GatherActorListsForConnection(const FConnectionGatherActorListParameters& Params) override;
+	virtual void LogNode(FReplicationGraphDebugInfo& DebugInfo, const FString& NodeName) const override;
+	//~ End UReplicationGraphNode interface
+
+	/**
+	* Returns the actors relevant to a connection, from its cache when nothing near its viewers changed.
+	* GatherActorListsForConnection calls it with the net connection, tests can pass any object to simulate one.
+	* @param inConnection	Key of the connection cache
+	* @param inViewLocations	Location of every viewer of the connection
+	* @return the actors within CullDistance of any viewer, valid until the next call for this connection
+	*/
+	const FActorRepListRefView& GetRelevantActors(const UObject* inConnection, TConstArrayView<FVector> inViewLocations);
+
+	/** Number of connections that answered from their cache and that queried the Octree since the last reset. */
+	void GetCacheStats(int32& OutCacheHits, int32& OutCacheMisses) const;
+
+	int32 GetNumActors() const;
+
+private:
+	void IndexActor(AActor* inActor, const FVector& inLocation);
+
+	/** Records that the actors near a location changed, see IsCacheValid. */
+	void AddChange(const FVector& inLocation);
+
+	struct FConnectionCache
+	{
+		TArray<FVector, TInlineAllocator<2>> ViewLocations;
+		FActorRepListRefView RelevantActors;
+		/** ContentVersion when RelevantActors was gathered. */
+		uint32 GatheredVersion = 0;
+		bool bGathered = false;
+	};
+
+	/** Whether a cache still holds the actors relevant to these viewers, up to the move tolerances. */
+	bool IsCacheValid(const FConnectionCache& inCache, TConstArrayView<FVector> inViewLocations) const;
+
+	TUniquePtr<FSPOctree> OctreeData;
+	FSPOctreeElementIdMap ElementIds;
+
+	/** Location every actor was last indexed at. */
+	TMap<TObjectPtr<AActor>, FVector> IndexedLocations;
+
+	TMap<TWeakObjectPtr<const UObject>, FConnectionCache> ConnectionCaches;
+
+	/** Bumped by every change to the indexed actors. */
+	uint32 ContentVersion = 0;
+
+	struct FContentChange
+	{
+		uint32 Version;
+		FVector Location;
+	};
+	/** Locations of the latest changes, oldest first, trimmed to MaxTrackedChanges every frame. */
+	TArray<FContentChange> RecentChanges;
+
+	/** Scratch set merging the actors of several viewers of one connection. */
+	TSet<AActor*> GatheredActors;
+
+	int32 CacheHits = 0;
+	int32 CacheMisses = 0;
+};
@@ -0,0 +1,80 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "Trace/Trace.h"
+
+/**
+* Instrumentation of the Octree and streaming paths, seen with "stat SPOctree", in CSV profiles under the SPOctree
+* category and in Unreal Insights on the SPOctree trace channel (-trace=cpu,SPOctree). Each part compiles out
+* with its profiler, so Shipping builds pay nothing for it.
+*/
+DECLARE_STATS_GROUP(TEXT("SPOctree"), STATGROUP_SPOctree, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Add"), STAT_SPOctree_Add, STATGROUP_SPOctree, SPOCTREEDATALAYER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Query"), STAT_SPOctree_Query, STATGROUP_SPOctree, SPOCTREEDATALAYER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Streaming Diff"), STAT_SPOctree_StreamingDiff, STATGROUP_SPOctree, SPOCTREEDATALAYER_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Streaming Transitions"), STAT_SPOctree_StreamingTransitions, STATGROUP_SPOctree, SPOCTREEDATALAYER_API);
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Nodes Visited"), STAT_SPOctree_NodesVisited, STATGROUP_SPOctree, SPOCTREEDATALAYER_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Elements Tested"), STAT_SPOctree_ElementsTested, STATGROUP_SPOctree, SPOCTREEDATALAYER_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Hits"), STAT_SPOctree_Hits, STATGROUP_SPOctree, SPOCTREEDATALAYER_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Transitions"), STAT_SPOctree_Transitions, STATGROUP_SPOctree, SPOCTREEDATALAYER_API);
+
+CSV_DECLARE_CATEGORY_MODULE_EXTERN(SPOCTREEDATALAYER_API, SPOctree);
+
+UE_TRACE_CHANNEL_EXTERN(SPOctreeChannel, SPOCTREEDATALAYER_API);
+
+#define SPOCTREE_STATS (STATS || CSV_PROFILER)
+
+/** Times the rest of the scope with STAT_SPOctree_<Stat>, the CSV timing stat <Stat> and the trace event SPOctree_<Stat>. */
+#define SPOCTREE_SCOPE_CYCLE_COUNTER(Stat) \
+	SCOPE_CYCLE_COUNTER(STAT_SPOctree_##Stat); \
+	CSV_SCOPED_TIMING_STAT(SPOctree, Stat); \
+	TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL(SPOctree_##Stat, SPOctreeChannel)
+
+/**
+* Counts the nodes and elements one query goes through, and adds them to the stat and CSV counters
+* when it goes out of scope. Safe to use from any thread, and empty when no profiler is compiled in.
+*/
+struct FSPOctreeQueryCounters
+{
+#if SPOCTREE_STATS
+	int32 NodesVisited = 0;
+	int32 ElementsTested = 0;
+	int32 Hits = 0;
+
+	FORCEINLINE void AddNode()
+	{
+		NodesVisited++;
+	}
+
+	FORCEINLINE void AddElementsTested(const int32 inCount)
+	{
+		ElementsTested += inCount;
+	}
+
+	FORCEINLINE void AddHits(const int32 inCount)
+	{
+		Hits += inCount;
+	}
+
+	~FSPOctreeQueryCounters()
+	{
+		INC_DWORD_STAT_BY(STAT_SPOctree_NodesVisited, NodesVisited);
+		INC_DWORD_STAT_BY(STAT_SPOctree_ElementsTested, ElementsTested);
+		INC_DWORD_STAT_BY(STAT_SPOctree_Hits, Hits);
+		CSV_CUSTOM_STAT(SPOctree, NodesVisited, NodesVisited, ECsvCustomStatOp::Accumulate);
+		CSV_CUSTOM_STAT(SPOctree, ElementsTested, ElementsTested, ECsvCustomStatOp::Accumulate);
+		CSV_CUSTOM_STAT(SPOctree, Hits, Hits, ECsvCustomStatOp::Accumulate);
+	}
+#else
+	FORCEINLINE void AddNode() {}
+	FORCEINLINE void AddElementsTested(const int32 /*inCount*/) {}
+	FORCEINLINE void AddHits(const int32 /*inCount*/) {}
+#endif
+};
@@ -5,8 +5,13 @@
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
 #include "SPOctree.h"
+#include "SPOctreeStreamingSubsystem.h"
 #include "SPOctreeStreamingSourceComponent.generated.h"
 
+class USplineComponent;
+class ASPOctreeGrid;
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FSPOctreeStreamingActorSignature, AActor*, Actor);
 
 UCLASS( ClassGroup = (SPOctree), BlueprintType, Blueprintable, meta=(BlueprintSpawnableComponent) )
 class SPOCTREEDATALAYER_API USPOctreeStreamingSourceComponent : public UActorComponent
@@ -29,13 +34,88 @@ public:
 	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
 	float DistanceCheck;
 
+	/**
+	* Significance given to the actors around this source by distance, an actor takes the nearest tier it is in.
+	* When empty, every actor within DistanceCheck is Full.
+	*/
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	TArray<FSPOctreeStreamingTier> Tiers;
+
+	/**
+	* Also streams in the actors along the path the owner will follow over the next PredictionTime seconds,
+	* so they are ready before they come into a tier.
+	*/
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	bool bPredictiveStreaming;
+
+	/** Seconds of movement at the current velocity that are streamed in ahead of the owner. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	float PredictionTime;
+
+	/** Radius of the capsule swept along the predicted path, 0 or less uses the outermost tier. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	float PredictionRadius;
+
+	/** Significance of the actors that are only ahead of the owner, low enough to be cheap until they come into a tier. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	ESPOctreeSignificance PredictionSignificance;
+
+	/** Path the owner follows, such as a road or a track. When set the prediction follows it instead of a straight line. */
+	UPROPERTY(Category = "Config", BlueprintReadWrite)
+	TObjectPtr<USplineComponent> PredictionPath;
+
+	/** Data Layer cells of the octrees within this distance of the owner are loaded, 0 leaves Data Layers alone. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	float DataLayerLoadDistance;
+
+	/** Data Layer cells within this distance of the owner are activated. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	float DataLayerActivateDistance;
+
+	/**
+	* Only queries the octrees again when the owner moved further than RequeryDistance, crossed into another
+	* cell of an octree, or an octree changed near the last query. Otherwise the last results are kept.
+	* Data Layer cells are found again on their own check, once the owner moved further than RequeryDistance
+	* or an octree changed within the Data Layer distances.
+	*/
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	bool bGatedQueries;
+
+	/** Distance the owner, or the end of its predicted path, moves before the octrees are queried again. */
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	float RequeryDistance;
+
+	/**
+	* Longest time between two updates of this source, 0 updates every frame. The time between updates
+	* shrinks with the speed of the owner so it never covers more than RequeryDistance.
+	*/
+	UPROPERTY(Category = "Config", EditAnywhere, BlueprintReadWrite)
+	float MaxUpdateInterval;
+
+	/** Broadcast once when an actor comes into any tier of this source. */
+	UPROPERTY(BlueprintAssignable, Category = Octree)
+	FSPOctreeStreamingActorSignature OnActorEnterRange;
+
+	/** Broadcast once when an actor leaves every tier of this source. */
+	UPROPERTY(BlueprintAssignable, Category = Octree)
+	FSPOctreeStreamingActorSignature OnActorExitRange;
+
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:	
-	// Called every frame
-	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+	/**
+	* Queries the registered octrees around the owner and reports the actors that entered,
+	* left or changed tier since the last update to the subsystem.
+	* @param inSubsystem	Subsystem reference counting the actors of all sources
+	*/
+	void UpdateStreaming(USPOctreeStreamingSubsystem& inSubsystem);
+
+	/** Gives back the references of every actor and Data Layer cell in range, used when the source stops streaming. */
+	void ReleaseTrackedActors(USPOctreeStreamingSubsystem& inSubsystem);
 
 	virtual void InitializeComponent() override;
 
@@ -47,11 +127,88 @@ public:
 	UFUNCTION(BlueprintCallable, Category = Octree)
 	void removeOctree(ASPOctree* inOctree);
 
+	/**
+	* Streams the cell octrees of a grid, the ones it has now and the ones it creates later.
+	* Actors in the overflow list of the grid are not streamed.
+	* @param inGrid	Grid to stream
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void addOctreeGrid(ASPOctreeGrid* inGrid);
+
 private:
+	UFUNCTION()
+	void OnGridCellCreated(ASPOctree* inCell);
+
+	/** Returns the tier an actor at this distance from the owner is in, Hidden when it is out of range. */
+	ESPOctreeSignificance GetSignificanceAtDistance(const double inDistance) const;
+
+	/** Finds the Data Layer cells around the owner and reports the ones whose state changed to the subsystem. */
+	void UpdateDataLayers(USPOctreeStreamingSubsystem& inSubsystem, const FVector& inOrigin);
+
+	/** Adds an actor to foundActors, an actor found more than once keeps its most significant tier. */
+	void AddFoundActor(AActor* inActor, const ESPOctreeSignificance inSignificance);
+
+	/** Returns true if the last results of the octrees can still be trusted, see bGatedQueries. */
+	bool CanSkipQuery(const FVector& inOrigin, const FVector& inPredictedEnd) const;
+
+	/** Remembers where and against which content the octrees were last queried. */
+	void RecordQuery(const FVector& inOrigin, const FVector& inPredictedEnd, const FBox& inQueryRegion);
+
+	/** Returns true if the Data Layer cells found last can still be trusted, checked apart from the actor tiers. */
+	bool CanSkipDataLayerUpdate(const FVector& inOrigin) const;
+
+	/** Remembers where and against which content the Data Layer cells were last found. */
+	void RecordDataLayerUpdate(const FVector& inOrigin);
+
+	/**
+	* Fills OutPoints with the polyline the owner is predicted to follow, starting at inOrigin.
+	* Left empty when the owner is not moving.
+	*/
+	void GetPredictedPath(const FVector& inOrigin, TArray<FVector>& OutPoints) const;
+
 	TObjectPtr<AActor> Owner = nullptr;
 
 	TArray<TObjectPtr<ASPOctree>> octrees;
-	TArray<FSPOctreeElement> trackedElements;
+
+	/** Actors in range as of the last tick and their tier. Only actors entering, leaving or changing tier are touched. */
+	TMap<TWeakObjectPtr<AActor>, ESPOctreeSignificance> trackedActors;
+
+	/** Actors found this tick, swapped with trackedActors once the diff is applied. */
+	TMap<TWeakObjectPtr<AActor>, ESPOctreeSignificance> foundActors;
+
+	/** Data Layer cells in range as of the last update and the state this source asks of them. */
+	TMap<FName, EDataLayerRuntimeState> trackedDataLayers;
+
+	/** Data Layer cells found by the last update, swapped with trackedDataLayers once the diff is applied. */
+	TMap<FName, EDataLayerRuntimeState> foundDataLayers;
+
+	/** Scratch buffer of GetPredictedPath. */
+	TArray<FVector> predictedPath;
+
+	/** State of an octree at the last query, matching the entries of octrees. */
+	struct FOctreeQueryState
+	{
+		uint32 ContentVersion = 0;
+		FBox CellBounds = FBox(ForceInit);
+	};
+	TArray<FOctreeQueryState> octreeQueryStates;
+
+	FVector lastQueryOrigin = FVector::ZeroVector;
+	FVector lastPredictedEnd = FVector::ZeroVector;
+	FBox lastQueryRegion = FBox(ForceInit);
+
+	/** Set when the octrees or settings changed, the next update always queries. */
+	bool bQueryInvalidated = true;
+
+	/** Content version of every octree when the Data Layer cells were last found, matching the entries of octrees. */
+	TArray<uint32> dataLayerContentVersions;
+
+	FVector lastDataLayerOrigin = FVector::ZeroVector;
+
+	/** Set when the octrees changed, the next update always finds the Data Layer cells again. */
+	bool bDataLayersInvalidated = true;
+
+	float nextUpdateTime = 0.0f;
 
 	float nextPrintLogTime;
 };
@@ -0,0 +1,229 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "WorldPartition/DataLayer/DataLayerSubsystem.h"
+#include "SPOctreeStreamingSubsystem.generated.h"
+
+class USPOctreeStreamingSourceComponent;
+
+/** How much of an actor is kept running, from most to least significant. */
+UENUM(BlueprintType)
+enum class ESPOctreeSignificance : uint8
+{
+	/** Visible with collision, ticking at its own rate. */
+	Full,
+	/** Visible with collision, ticking every ReducedTickInterval seconds. */
+	ReducedTick,
+	/** Visible without collision or tick. */
+	VisibleOnly,
+	/** Hidden without collision or tick. */
+	Hidden
+};
+
+/** Distance band of a streaming source and the significance it gives to the actors inside it. */
+USTRUCT(BlueprintType)
+struct FSPOctreeStreamingTier
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** Actors whose element origin is within this distance of the source get Significance, unless a nearer tier holds them. */
+	UPROPERTY(Category = "Octree Streaming Struct", EditAnywhere, BlueprintReadWrite)
+	float Distance = 1500.0f;
+
+	UPROPERTY(Category = "Octree Streaming Struct", EditAnywhere, BlueprintReadWrite)
+	ESPOctreeSignificance Significance = ESPOctreeSignificance::Full;
+};
+
+/** Significance change of an actor waiting for its turn in USPOctreeStreamingSubsystem. */
+USTRUCT(BlueprintType)
+struct FSPOctreeStreamingTransition
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(Category = "Octree Streaming Struct", BlueprintReadOnly)
+	TWeakObjectPtr<AActor> Actor;
+
+	/** Significance the actor is moved to. */
+	UPROPERTY(Category = "Octree Streaming Struct", BlueprintReadOnly)
+	ESPOctreeSignificance Significance = ESPOctreeSignificance::Hidden;
+
+	/** Distance to the nearest streaming source when the queue was last ordered. */
+	UPROPERTY(Category = "Octree Streaming Struct", BlueprintReadOnly)
+	float Distance = 0.0f;
+};
+
+/**
+* Runs every USPOctreeStreamingSourceComponent of a world in one pass per frame.
+* Each source queries its octrees and reports the significance tier of the actors in its range.
+* The subsystem reference counts each tier across all sources, an actor takes the most significant
+* tier any source gives it and is only touched when that tier changes. Changes are queued nearest
+* to a source first and applied within a per frame budget, so a dense area streams in over several frames.
+* Data Layer cells of the octrees are reference counted the same way and switched between Unloaded,
+* Loaded and Activated, so content far from every source is released from memory.
+*/
+UCLASS(Config = Game)
+class SPOCTREEDATALAYER_API USPOctreeStreamingSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+
+	virtual void Deinitialize() override;
+
+	virtual void Tick(float DeltaTime) override;
+
+	virtual TStatId GetStatId() const override;
+
+	void RegisterSource(USPOctreeStreamingSourceComponent* inSource);
+
+	void UnregisterSource(USPOctreeStreamingSourceComponent* inSource);
+
+	/** Called by a source when an actor comes into one of its tiers. */
+	void AddActorReference(AActor* inActor, const ESPOctreeSignificance inSignificance);
+
+	/** Called by a source when an actor leaves one of its tiers. */
+	void RemoveActorReference(const TWeakObjectPtr<AActor>& inActor, const ESPOctreeSignificance inSignificance);
+
+	/** Called by a source when a Data Layer cell comes within one of its Data Layer distances. */
+	void AddDataLayerReference(const FName& inDataLayerLabel, const EDataLayerRuntimeState inState);
+
+	/** Called by a source when a Data Layer cell leaves one of its Data Layer distances. */
+	void RemoveDataLayerReference(const FName& inDataLayerLabel, const EDataLayerRuntimeState inState);
+
+	/**
+	* Returns the state the sources currently ask of a Data Layer cell.
+	* @param inDataLayerLabel	Label of the Data Layer of the cell
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	EDataLayerRuntimeState GetRequestedDataLayerState(FName inDataLayerLabel) const;
+
+	/**
+	* Returns the number of streaming sources that currently have an actor in range.
+	* @param inActor	Actor to look up
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	int32 GetActorRefCount(AActor* inActor) const;
+
+	/**
+	* Returns the most significant tier any source currently gives an actor. It is applied to the actor
+	* once the transition queue reaches it.
+	* @param inActor	Actor to look up
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	ESPOctreeSignificance GetActorSignificance(AActor* inActor) const;
+
+	UPROPERTY(Category = "Config", BlueprintReadWrite)
+	bool PrintLogs;
+
+	/** Seconds between ticks of ReducedTick actors. */
+	UPROPERTY(Config, Category = "Config", BlueprintReadWrite)
+	float ReducedTickInterval = 0.25f;
+
+	/** Most significance changes applied per frame, 0 for no limit. */
+	UPROPERTY(Config, Category = "Config", BlueprintReadWrite)
+	int32 MaxTransitionsPerFrame = 0;
+
+	/** Milliseconds per frame spent changing the significance of actors, 0 for no limit. At least one transition is applied every frame. */
+	UPROPERTY(Config, Category = "Config", BlueprintReadWrite)
+	float TransitionBudgetMs = 0.0f;
+
+	/** Transitions applied by the last update. */
+	UPROPERTY(Category = "Debug", BlueprintReadOnly)
+	int32 LastTransitionCount = 0;
+
+	/** Milliseconds spent applying transitions in the last update. */
+	UPROPERTY(Category = "Debug", BlueprintReadOnly)
+	float LastTransitionTimeMs = 0.0f;
+
+	/**
+	* Returns the transitions left over by the budget of the last update, in the order they will be applied.
+	* @param OutTransitions	Reset and filled with the waiting transitions
+	*/
+	UFUNCTION(BlueprintCallable, Category = Octree)
+	void GetPendingTransitions(TArray<FSPOctreeStreamingTransition>& OutTransitions) const;
+
+	UFUNCTION(BlueprintPure, Category = Octree)
+	int32 GetNumPendingTransitions() const;
+
+private:
+	/**
+	* Applies the new significance of the actors whose tier changed, nearest to a source first,
+	* until the frame budget runs out. The rest stay queued for the next call.
+	*/
+	void ApplyVisibilityTransitions();
+
+	/** Sends the Data Layer cells whose requested state changed to the Data Layer subsystem. */
+	void ApplyDataLayerStates();
+
+	/** Sets visibility, collision and tick of an actor for a significance. */
+	void ApplySignificance(AActor* inActor, const ESPOctreeSignificance inSignificance) const;
+
+	/** Number of sources holding an actor in each tier above Hidden. */
+	struct FSignificanceRefCounts
+	{
+		int32 Counts[(int32)ESPOctreeSignificance::Hidden] = {};
+
+		ESPOctreeSignificance GetSignificance() const
+		{
+			for (int32 index = 0; index < (int32)ESPOctreeSignificance::Hidden; index++)
+			{
+				if (Counts[index] > 0)
+				{
+					return (ESPOctreeSignificance)index;
+				}
+			}
+			return ESPOctreeSignificance::Hidden;
+		}
+
+		int32 GetTotal() const
+		{
+			int32 total = 0;
+			for (int32 count : Counts)
+			{
+				total += count;
+			}
+			return total;
+		}
+	};
+
+	UPROPERTY()
+	TArray<TObjectPtr<USPOctreeStreamingSourceComponent>> Sources;
+
+	/** Number of sources asking for a Data Layer cell to be loaded or activated. */
+	struct FDataLayerRefCounts
+	{
+		int32 Loaded = 0;
+		int32 Activated = 0;
+
+		EDataLayerRuntimeState GetState() const
+		{
+			return Activated > 0 ? EDataLayerRuntimeState::Activated : (Loaded > 0 ? EDataLayerRuntimeState::Loaded : EDataLayerRuntimeState::Unloaded);
+		}
+	};
+
+	/** Cells requested by at least one source. Cells without an entry are unloaded. */
+	TMap<FName, FDataLayerRefCounts> DataLayerRefCounts;
+
+	/** Cells whose requested state changed since the last Tick. */
+	TSet<FName> ChangedDataLayers;
+
+	/** Tiers each actor is in across all sources. Actors out of every range have no entry. */
+	TMap<TWeakObjectPtr<AActor>, FSignificanceRefCounts> ActorRefCounts;
+
+	/** Significance last applied to each actor the subsystem has shown and not hidden again. */
+	TMap<TWeakObjectPtr<AActor>, ESPOctreeSignificance> AppliedSignificance;
+
+	/** Actors whose most significant tier changed and that have not been updated yet. */
+	TSet<TWeakObjectPtr<AActor>> ChangedActors;
+
+	/** ChangedActors ordered by distance, the entries after the last one applied are the queue left for the next frame. */
+	TArray<FSPOctreeStreamingTransition> PendingTransitions;
+	int32 NumAppliedTransitions = 0;
+
+	/** Scratch buffer of the owner locations of the sources. */
+	TArray<FVector> SourceLocations;
+};
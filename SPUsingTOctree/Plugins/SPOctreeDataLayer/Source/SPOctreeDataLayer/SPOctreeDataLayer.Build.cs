@@ -26,6 +26,7 @@ public class SPOctreeDataLayer : ModuleRules
 			new string[]
 			{
 				"Core",
+				"ReplicationGraph",
 				// ... add other public dependencies that you statically link with here ...
 			}
 			);
@@ -36,6 +37,7 @@ public class SPOctreeDataLayer : ModuleRules
 			{
 				"CoreUObject",
 				"Engine",
+				"Json",
 				"Slate",
 				"SlateCore",
 				// ... add private dependencies that you statically link with here ...	